@@ -0,0 +1,45 @@
+#define _DEFAULT_SOURCE
+#include "bench.h"
+
+#define PROG_OPS (256)
+
+static uint32_t seed = 1;
+
+static uint32_t rnd() {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/**
+ * 以 6xkk/7xkk/8xyN 為主，偶爾 3xkk/4xkk skip，最後跳回開頭
+ */
+static void gen(uint8_t *buf) {
+  int i;
+  for(i = 0; i < PROG_OPS; ++ i) {
+    uint8_t *op = buf + i * 2;
+    uint8_t x = rnd() & 0xf, y = rnd() & 0xf, kk = rnd();
+    switch(rnd() % 14) {
+      case 0: memcpy(op, (uint8_t[]){OP_6xkk(x, kk)}, 2); break;
+      case 1: case 2: memcpy(op, (uint8_t[]){OP_7xkk(x, kk)}, 2); break;
+      case 3: memcpy(op, (uint8_t[]){OP_8xy0(x, y)}, 2); break;
+      case 4: memcpy(op, (uint8_t[]){OP_8xy1(x, y)}, 2); break;
+      case 5: memcpy(op, (uint8_t[]){OP_8xy2(x, y)}, 2); break;
+      case 6: memcpy(op, (uint8_t[]){OP_8xy3(x, y)}, 2); break;
+      case 7: memcpy(op, (uint8_t[]){OP_8xy4(x, y)}, 2); break;
+      case 8: memcpy(op, (uint8_t[]){OP_8xy5(x, y)}, 2); break;
+      case 9: memcpy(op, (uint8_t[]){OP_8xy6(x)}, 2); break;
+      case 10: memcpy(op, (uint8_t[]){OP_8xy7(x, y)}, 2); break;
+      case 11: memcpy(op, (uint8_t[]){OP_8xye(x)}, 2); break;
+      case 12: memcpy(op, (uint8_t[]){OP_3xkk(x, kk & 3)}, 2); break;
+      default: memcpy(op, (uint8_t[]){OP_4xkk(x, kk & 3)}, 2); break;
+    }
+  }
+  // skip 可能越過第一個
+  memcpy(buf + PROG_OPS * 2, (uint8_t[]){OP_1nnn(APP_ENTRY), OP_1nnn(APP_ENTRY)}, 4);
+}
+
+int main() {
+  uint8_t prog[PROG_OPS * 2 + 4];
+  gen(prog);
+  bench_run("alu", prog, sizeof(prog));
+}
@@ -0,0 +1,56 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include "bench.h"
+#include "chip8-cfg.h"
+
+#define BUILDS (2000)
+
+static uint32_t seed = 1;
+
+static uint32_t rnd() {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/**
+ * 填滿整個 USER_SIZE 的程式，一般 instructions 中夾著 skips、往前後
+ * 跳的 1nnn 及 2nnn/00EE，讓幾乎每個 instruction 都可達
+ */
+static void gen(uint8_t *buf, int size) {
+  int i, ops = size / 2;
+  for(i = 0; i < ops; ++ i) {
+    uint8_t *op = buf + i * 2;
+    uint8_t x = rnd() & 0xf, y = rnd() & 0xf, kk = rnd();
+    uint16_t target = APP_ENTRY + (rnd() % ops) * 2;
+    switch(rnd() % 16) {
+      case 0: memcpy(op, (uint8_t[]){OP_1nnn(target)}, 2); break;
+      case 1: memcpy(op, (uint8_t[]){OP_2nnn(target)}, 2); break;
+      case 2: memcpy(op, (uint8_t[]){OP_00EE}, 2); break;
+      case 3: case 4: memcpy(op, (uint8_t[]){OP_3xkk(x, kk)}, 2); break;
+      case 5: memcpy(op, (uint8_t[]){OP_9xy0(x, y)}, 2); break;
+      case 6: memcpy(op, (uint8_t[]){OP_dxyn(x, y, 5)}, 2); break;
+      case 7: memcpy(op, (uint8_t[]){OP_8xy4(x, y)}, 2); break;
+      default: memcpy(op, (uint8_t[]){OP_7xkk(x, kk)}, 2); break;
+    }
+  }
+}
+
+int main() {
+  static uint8_t prog[USER_SIZE];
+  gen(prog, sizeof(prog));
+  AutoChip8 *vm = bench_vm(C8_ENGINE_SWITCH, prog, sizeof(prog));
+
+  int i, blocks = 0;
+  double begin = bench_now();
+  for(i = 0; i < BUILDS; ++ i) {
+    AutoChip8Cfg *cfg = c8_cfg_build(vm);
+    blocks = c8_cfg_count(cfg);
+  }
+  double elapsed = bench_now() - begin;
+
+  printf("{\"bench\":\"cfg\",\"rom_bytes\":%d,\"blocks\":%d,\"builds\":%d,\"us_per_build\":%.3f}\n",
+         (int) sizeof(prog),
+         blocks,
+         BUILDS,
+         elapsed * 1e6 / BUILDS);
+}
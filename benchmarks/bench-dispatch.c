@@ -0,0 +1,14 @@
+#define _DEFAULT_SOURCE
+#include "bench.h"
+
+/**
+ * 7001 加一後跳回，量每個 instruction 的固定成本。只有跳回自己的 1nnn
+ * 會被當成 idle loop 直接跳過，量不到 dispatch
+ */
+int main() {
+  uint8_t prog[] = {
+    OP_7xkk(0, 1),
+    OP_1nnn(APP_ENTRY),
+  };
+  bench_run("dispatch", prog, sizeof(prog));
+}
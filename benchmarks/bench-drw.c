@@ -0,0 +1,25 @@
+#define _DEFAULT_SOURCE
+#include "bench.h"
+
+/**
+ * 每圈畫四個 8 列 sprite，座標每圈移動，會跨過右緣/底部並觸發碰撞
+ */
+int main() {
+  uint8_t prog[] = {
+    OP_annn(0x300),
+    OP_7xkk(0, 3),          // 0x202
+    OP_7xkk(1, 1),
+    OP_dxyn(0, 1, 8),
+    OP_dxyn(1, 0, 8),
+    OP_8xy0(2, 0),
+    OP_7xkk(2, 30),
+    OP_dxyn(2, 1, 8),
+    OP_dxyn(2, 2, 8),
+    OP_1nnn(0x202),
+  };
+  uint8_t buf[0x108] = { 0 };
+  memcpy(buf, prog, sizeof(prog));
+  // sprite 資料放在 0x300
+  memcpy(buf + 0x100, (uint8_t[]){ 0xff, 0x81, 0xbd, 0xa5, 0xa5, 0xbd, 0x81, 0xff }, 8);
+  bench_run("drw", buf, sizeof(buf));
+}
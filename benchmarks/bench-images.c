@@ -0,0 +1,40 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+#include "bench.h"
+
+#define LFS_POINTER "version https://git-lfs"
+
+/**
+ * 參數中的每個 .ch8 各以 c8_rom_map() 載入後跑一次 bench_run_rom()，以
+ * 檔名為 bench 名稱
+ */
+int main(int argc, char *argv[]) {
+  int i;
+  for(i = 1; i < argc; ++ i) {
+    Chip8Rom rom;
+    int err = c8_rom_map(&rom, argv[i]);
+    if(err) {
+      fprintf(stderr, "unable to load %s: %s\n", argv[i], strerror(-err));
+      return 1;
+    }
+    // 沒有 git lfs pull 時 images/ 下只有 pointer 檔
+    if(rom.size >= sizeof(LFS_POINTER) - 1 &&
+       !memcmp(rom.data, LFS_POINTER, sizeof(LFS_POINTER) - 1)) {
+      printf("{\"bench\":\"%s\",\"skipped\":\"git-lfs pointer\"}\n", basename(argv[i]));
+      c8_rom_unmap(&rom);
+      continue;
+    }
+    err = bench_run_rom(basename(argv[i]), &rom);
+    c8_rom_unmap(&rom);
+    if(err == -EFBIG) {
+      AutoChip8 *vm = bench_new(C8_ENGINE_DEFAULT);
+      printf("%s too large (<= %d) to load\n", argv[i], c8_user_size(vm));
+      return 1;
+    } else if(err) {
+      fprintf(stderr, "unable to load %s: %s\n", argv[i], strerror(-err));
+      return 1;
+    }
+  }
+}
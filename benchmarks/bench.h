@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <time.h>
+#include "chip8.h"
+#include "chip8-ops.h"
+
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+#define BENCH_STEPS (20000000)
+#define BENCH_FRAMES (100000)
+
+static const Chip8Engine bench_engines[] = {
+  C8_ENGINE_SWITCH,
+  C8_ENGINE_THREADED,
+  C8_ENGINE_JIT,
+};
+
+static const char *bench_engine_names[] = {
+  [C8_ENGINE_DEFAULT] = "default",
+  [C8_ENGINE_SWITCH] = "switch",
+  [C8_ENGINE_THREADED] = "threaded",
+  [C8_ENGINE_JIT] = "jit",
+};
+
+static inline double bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline Chip8 *bench_new(Chip8Engine engine) {
+  return c8_new_with_options(&(Chip8Options){
+    .ui = UI_NULL,
+    .seed = 1,
+    .engine = engine,
+  });
+}
+
+static inline Chip8 *bench_vm(Chip8Engine engine, const uint8_t *prog, int size) {
+  Chip8 *vm = bench_new(engine);
+  c8_load(vm, (uint8_t *) prog, size);
+  return vm;
+}
+
+/**
+ * 每個 engine 先以 c8_steps() 量 instructions/sec，再以預設 clock 跑
+ * c8_run_frame() 量含 poll/flush 的 frames/sec，每個 engine 輸出一行 JSON。
+ * 沒編進來的 engine 會退回其他 engine，以 c8_engine() 的結果為準。
+ * 以 c8_load_rom() 載入，失敗時不輸出並回傳它的錯誤
+ */
+static inline int bench_run_rom(const char *name, const Chip8Rom *rom) {
+  int e, f, err;
+  for(e = 0; e < sizeof(bench_engines) / sizeof(bench_engines[0]); ++ e) {
+    AutoChip8 *vm = bench_new(bench_engines[e]);
+    AutoChip8 *fvm = bench_new(bench_engines[e]);
+    if((err = c8_load_rom(vm, rom)) || (err = c8_load_rom(fvm, rom))) {
+      return err;
+    }
+    int64_t steps = BENCH_STEPS;
+    double begin = bench_now();
+    while(steps > 0) {
+      int n = steps > 1000000 ? 1000000 : steps;
+      c8_steps(vm, n);
+      steps -= n;
+    }
+    double elapsed = bench_now() - begin;
+
+    double fbegin = bench_now();
+    for(f = 0; f < BENCH_FRAMES; ++ f) {
+      c8_run_frame(fvm, 0);
+    }
+    double felapsed = bench_now() - fbegin;
+
+    printf("{\"bench\":\"%s\",\"engine\":\"%s\",\"steps\":%d,\"ips\":%.0f,"
+           "\"ns_per_step\":%.3f,\"frames\":%d,\"fps\":%.0f}\n",
+           name,
+           bench_engine_names[c8_engine(vm)],
+           BENCH_STEPS,
+           BENCH_STEPS / elapsed,
+           elapsed * 1e9 / BENCH_STEPS,
+           BENCH_FRAMES,
+           BENCH_FRAMES / felapsed);
+  }
+  return 0;
+}
+
+static inline void bench_run(const char *name, const uint8_t *prog, int size) {
+  bench_run_rom(name, &(Chip8Rom){ .data = prog, .size = size });
+}
+
+#endif /* __BENCH_H_ */
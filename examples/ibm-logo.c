@@ -7,14 +7,13 @@
 int main() {
   AutoChip8 *vm = c8_new();
   assert(c8_pc(vm) == APP_ENTRY);
-  uint8_t buf[4096];
-  FILE *f = fopen("images/IBM Logo.ch8", "r");
-  assert(f != NULL);
-  size_t n = fread(buf, 1, sizeof(buf), f);
-  assert(n > 0);
-  fclose(f);
-  c8_load(vm, buf, n);
+  int err = c8_load_file(vm, "images/IBM Logo.ch8");
+  if(err) {
+    printf("unable to load images/IBM Logo.ch8: %s\n", strerror(-err));
+    return 1;
+  }
   while(true) {
-    c8_step(vm);
+    c8_run_frame(vm, 0);
+    c8_sync(vm);
   }
 }
@@ -0,0 +1,61 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "chip8.h"
+#include "chip8-ops.h"
+#include "chip8-lockstep.h"
+#include "logging.h"
+
+#define STEPS (600000)
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 每個 lane 以不同的 seed 取亂數後跑同一個 ALU 迴圈，偶爾因 skip 分岐
+ */
+int main(int argc, char *argv[]) {
+  int lanes = argc > 1 ? atoi(argv[1]) : 256;
+  if(lanes <= 0) {
+    printf("Usage: %s [LANES]\n", argv[0]);
+    exit(1);
+  }
+
+  uint8_t prog[] = {
+    OP_cxkk(0, 0xff),
+    OP_6xkk(1, 0),
+    OP_7xkk(1, 3),          // 0x204
+    OP_8xy4(2, 1),
+    OP_8xy3(3, 2),
+    OP_8xy5(4, 0),
+    OP_3xkk(4, 0x80),
+    OP_8xye(5),
+    OP_8xy1(5, 3),
+    OP_1nnn(0x204),
+  };
+
+  AutoChip8Lockstep *ls = c8ls_new(lanes, &(Chip8Options){ .seed = 1 });
+  c8ls_load(ls, prog, sizeof(prog));
+  double begin = now();
+  c8ls_steps(ls, STEPS);
+  double elapsed = now() - begin;
+
+  AutoChip8 *vm = c8_new_with_options(&(Chip8Options){ .ui = UI_NULL, .seed = 1 });
+  c8_load(vm, prog, sizeof(prog));
+  double single = now();
+  c8_steps(vm, STEPS);
+  single = now() - single;
+
+  uint64_t n = c8ls_instructions(ls);
+  printf("%d lanes, %llu instructions in %.3fs, %.1f MIPS (%.1f%% SIMD)\n",
+         lanes,
+         (unsigned long long) n,
+         elapsed,
+         n / elapsed / 1e6,
+         100.0 * c8ls_simd_instructions(ls) / n);
+  printf("single VM: %.1f MIPS\n", STEPS / single / 1e6);
+}
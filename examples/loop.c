@@ -9,6 +9,7 @@ int main() {
   assert(c8_pc(vm) == APP_ENTRY);
   c8_load(vm, (uint8_t[2]){OP_1nnn(0x200)}, 2);
   while(true) {
-    c8_step(vm);
+    c8_run_frame(vm, 0);
+    c8_sync(vm);
   }
 }
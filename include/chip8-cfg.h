@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "chip8.h"
+
+#ifndef __CHIP8_CFG_H_
+#define __CHIP8_CFG_H_
+
+#define AutoChip8Cfg Auto(Chip8Cfg, _c8_cfg_free)
+
+typedef struct _Chip8Cfg Chip8Cfg;
+
+typedef struct _Chip8Block Chip8Block;
+
+/**
+ * Chip8Block.flags，描述 block 的最後一個 instruction
+ */
+enum {
+  // 3XKK/4XKK/5XY0/9XY0/EX9E/EXA1，succ[0] 不跳，succ[1] 跳過下一個
+  C8_BLOCK_SKIP = 1 << 0,
+  // 1NNN，succ[0] 是目標
+  C8_BLOCK_JUMP = 1 << 1,
+  // 2NNN，succ[0] 是目標，succ[1] 是 00EE 回來的地方
+  C8_BLOCK_CALL = 1 << 2,
+  // 00EE，沒有靜態的 successors
+  C8_BLOCK_RETURN = 1 << 3,
+  // BNNN，目標要執行時才知道
+  C8_BLOCK_INDIRECT = 1 << 4,
+  // SCHIP 00FD，停在原地
+  C8_BLOCK_EXIT = 1 << 5,
+  // 目前 variant 的 illegal opcode，多半是走進了資料，不再往下分析
+  C8_BLOCK_ILLEGAL = 1 << 6,
+  // 有 back edge 指向這個 block
+  C8_BLOCK_LOOP_HEADER = 1 << 7,
+};
+
+/**
+ * [start, end) 之間連續的 instructions，只能從 start 進入，succ 是
+ * successors 的 block index，沒有時為 -1
+ */
+struct _Chip8Block {
+  uint16_t start;
+  uint16_t end;
+  int16_t succ[2];
+  uint16_t flags;
+};
+
+/**
+ * 依 vm 的 variant 從 APP_ENTRY 沿著 1NNN/2NNN/00EE/skips 走過載入的
+ * image，找出所有可達的 instructions 並切成 basic blocks，blocks 依
+ * start 排序。只看 mem 的內容，不執行也不改變 vm，之後改寫 mem 的話
+ * 要重建
+ */
+Chip8Cfg *c8_cfg_build(Chip8 *vm);
+
+void c8_cfg_free(Chip8Cfg *self);
+
+static inline void _c8_cfg_free(Chip8Cfg **p) { c8_cfg_free(*p); }
+
+int c8_cfg_count(Chip8Cfg *self);
+
+// 連續的 c8_cfg_count() 個 blocks
+const Chip8Block *c8_cfg_blocks(Chip8Cfg *self);
+
+// 含有從 pc 開始的 instruction 的 block，pc 不是可達的 instruction 時為 -1
+int c8_cfg_block_at(Chip8Cfg *self, uint16_t pc);
+
+// addr 是否屬於某個可達的 instruction，其餘載入的 bytes 都當成資料
+bool c8_cfg_is_code(Chip8Cfg *self, uint16_t addr);
+
+#endif /* __CHIP8_CFG_H_ */
@@ -0,0 +1,67 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "chip8.h"
+
+#ifndef __CHIP8_DIFF_H_
+#define __CHIP8_DIFF_H_
+
+#define AutoChip8Diff Auto(Chip8Diff, _c8diff_free)
+
+// 預設每 64K 個 instructions 比對一次
+#define C8_DIFF_INTERVAL_DEFAULT (65536)
+
+typedef struct _Chip8Diff Chip8Diff;
+
+typedef struct _Chip8Divergence Chip8Divergence;
+
+/**
+ * 第一個結果不同的 instruction，pc/opcode 取自 ref
+ */
+struct _Chip8Divergence {
+  // 執行這個 instruction 之前的 cycles
+  uint64_t cycles;
+  uint16_t pc;
+  uint16_t opcode;
+  // 執行後第一個不同的欄位，如 "v"、"mem"、"fb"
+  const char *field;
+  // 陣列欄位中的 index，其他為 -1
+  int index;
+};
+
+/**
+ * 以 ref 及 test 兩組 options 各建一個 VM 同步執行，通常只差在 engine。
+ * 每 interval 個 instructions 各算一次 guest 狀態 (registers/mem/
+ * framebuffer) 的 hash，相同時只留下 snapshot，不同時才逐欄比對，並從
+ * 上一個 snapshot 二分找出第一個造成差異的 instruction。ui 除了
+ * UI_REPLAY 之外都改為 UI_NULL，不錄 journal 也不保留 rewind。test 的
+ * seed 為 0 時沿用 ref 的 seed。journal 無法載入時同 c8_new_with_options()
+ * 回傳 NULL
+ */
+Chip8Diff *c8diff_new(const Chip8Options *ref, const Chip8Options *test, int interval);
+
+void c8diff_free(Chip8Diff *self);
+
+static inline void _c8diff_free(Chip8Diff **p) { c8diff_free(*p); }
+
+// 載入到兩個 VMs
+void c8diff_load(Chip8Diff *self, const uint8_t *app, int size);
+
+// 0 是 ref，1 是 test，兩邊要在第一次 c8diff_steps() 前設定好
+Chip8 *c8diff_vm(Chip8Diff *self, int side);
+
+// 兩邊各執行 steps 個 instructions，分歧後不再執行並回傳 false
+bool c8diff_steps(Chip8Diff *self, int steps);
+
+// 不等 interval 立即比對一次，回傳 c8diff_divergence() == NULL
+bool c8diff_check(Chip8Diff *self);
+
+// 還沒分歧時為 NULL
+const Chip8Divergence *c8diff_divergence(Chip8Diff *self);
+
+// 目前為止比對過的次數
+uint64_t c8diff_checks(Chip8Diff *self);
+
+// 所有比對點的 hash 串起來，同一個 ROM/input/seed 每次都相同，可以跨 runs 比較
+uint64_t c8diff_hash(Chip8Diff *self);
+
+#endif /* __CHIP8_DIFF_H_ */
@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include "chip8.h"
+
+#ifndef __CHIP8_LOCKSTEP_H_
+#define __CHIP8_LOCKSTEP_H_
+
+#define AutoChip8Lockstep Auto(Chip8Lockstep, _c8ls_free)
+
+typedef struct _Chip8Lockstep Chip8Lockstep;
+
+/**
+ * 以 structure-of-arrays 同步執行 lanes 個獨立的 VM。V/I/PC/DT/ST 依
+ * lane 排成陣列，停在同一個 PC 的 lanes 以 SSE2/AVX2 一起執行 ALU 及
+ * skip opcodes，其餘的 opcodes 及分岐後只剩單一 lane 的 PC 逐 lane 交給
+ * c8_step()。options 套用到每個 lane，ui 固定為 UI_NULL，seed 不為 0
+ * 時 lane n 使用 seed + n。配置或任一 lane 的 c8_init() 失敗時回傳 NULL
+ */
+Chip8Lockstep *c8ls_new(int lanes, const Chip8Options *options);
+
+void c8ls_free(Chip8Lockstep *self);
+
+static inline void _c8ls_free(Chip8Lockstep **p) { c8ls_free(*p); }
+
+int c8ls_lanes(Chip8Lockstep *self);
+
+// 載入到所有 lanes
+void c8ls_load(Chip8Lockstep *self, const uint8_t *app, int size);
+
+void c8ls_load_lane(Chip8Lockstep *self, int lane, const uint8_t *app, int size);
+
+void c8ls_set_v(Chip8Lockstep *self, int lane, uint8_t x, uint8_t v);
+
+// 每個 lane 各執行 steps 個 instructions，DT/ST 依共同的虛擬時鐘遞減
+void c8ls_steps(Chip8Lockstep *self, int steps);
+
+/**
+ * 回傳 lane 的狀態，只能以 c8_pc()/c8_v()/c8_mem8() 等讀取，下次
+ * c8ls_steps() 後失效
+ */
+Chip8 *c8ls_lane(Chip8Lockstep *self, int lane);
+
+// 所有 lanes 執行過的 instructions 總和
+uint64_t c8ls_instructions(Chip8Lockstep *self);
+
+// 其中以 SIMD 執行的部份
+uint64_t c8ls_simd_instructions(Chip8Lockstep *self);
+
+#endif /* __CHIP8_LOCKSTEP_H_ */
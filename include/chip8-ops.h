@@ -94,10 +94,22 @@
 // Vx = random byte & kk
 #define OP_cxkk(x, kk) 0xc0 | ((x) & 0xf), (kk) & 0xff
 
+// SKP Vx
+// key Vx is down, skip next instruction
+#define OP_ex9e(x) 0xe0 | ((x) & 0xf), 0x9e
+
+// SKNP Vx
+// key Vx is up, skip next instruction
+#define OP_exa1(x) 0xe0 | ((x) & 0xf), 0xa1
+
 // LD Vx, DT
 // Vx = DT
 #define OP_fx07(x) 0xf0 | ((x) & 0xf), 0x7
 
+// LD Vx, K
+// wait for a key press, Vx = key
+#define OP_fx0a(x) 0xf0 | ((x) & 0xf), 0x0a
+
 // LD DT, Vx
 // DT = Vx
 #define OP_fx15(x) 0xf0 | ((x) & 0xf), 0x15
@@ -106,16 +118,90 @@
 // ST = Vx
 #define OP_fx18(x) 0xf0 | ((x) & 0xf), 0x18
 
+// DRW Vx, Vy, nibble
+// draw n-byte sprite from mem[I] at (Vx, Vy), VF = collision
+#define OP_dxyn(x, y, n) 0xd0 | ((x) & 0xf), (((y) & 0xf) << 4) | ((n) & 0xf)
+
 // ADD I, Vx
 // I += Vx
 #define OP_fx1e(x) 0xf0 | ((x) & 0xf), 0x1e
 
-// LD B, Vx
-// mem[I] = Vx / 100, mem[I+1] = (Vx / 10) % 10, mem[I+2] = Vx % 10
-#define OP_fx1e(x) 0xf0 | ((x) & 0xf), 0x1e
+// LD F, Vx
+// I = address of the font sprite of digit Vx
+#define OP_fx29(x) 0xf0 | ((x) & 0xf), 0x29
 
 // LD B, Vx
 // mem[I] = Vx / 100, mem[I+1] = (Vx / 10) % 10, mem[I+2] = Vx % 10
-#define OP_fx1e(x) 0xf0 | ((x) & 0xf), 0x1e
+#define OP_fx33(x) 0xf0 | ((x) & 0xf), 0x33
+
+// LD [I], Vx
+// mem[I..I+x] = V0..Vx
+#define OP_fx55(x) 0xf0 | ((x) & 0xf), 0x55
+
+// LD Vx, [I]
+// V0..Vx = mem[I..I+x]
+#define OP_fx65(x) 0xf0 | ((x) & 0xf), 0x65
+
+/*
+ * SUPER-CHIP
+ */
+
+// SCD n
+// scroll down n rows
+#define OP_00cn(n) 0x0, 0xc0 | ((n) & 0xf)
+
+// SCR
+// scroll right 4 pixels
+#define OP_00fb 0x0, 0xfb
+
+// SCL
+// scroll left 4 pixels
+#define OP_00fc 0x0, 0xfc
+
+// EXIT
+#define OP_00fd 0x0, 0xfd
+
+// LOW
+// 64x32
+#define OP_00fe 0x0, 0xfe
+
+// HIGH
+// 128x64
+#define OP_00ff 0x0, 0xff
+
+// LD HF, Vx
+#define OP_fx30(x) 0xf0 | ((x) & 0xf), 0x30
+
+// LD R, Vx
+// rpl[0..x] = V0..Vx
+#define OP_fx75(x) 0xf0 | ((x) & 0xf), 0x75
+
+// LD Vx, R
+// V0..Vx = rpl[0..x]
+#define OP_fx85(x) 0xf0 | ((x) & 0xf), 0x85
+
+/*
+ * XO-CHIP
+ */
+
+// SCU n
+// scroll up n rows
+#define OP_00dn(n) 0x0, 0xd0 | ((n) & 0xf)
+
+// SAVE Vx - Vy
+// mem[I..] = Vx..Vy, I unchanged
+#define OP_5xy2(x, y) 0x50 | ((x) & 0xf), (((y) & 0xf) << 4) | 0x2
+
+// LOAD Vx - Vy
+// Vx..Vy = mem[I..], I unchanged
+#define OP_5xy3(x, y) 0x50 | ((x) & 0xf), (((y) & 0xf) << 4) | 0x3
+
+// LD I, long nnnn
+// 4 bytes instruction
+#define OP_f000(nnnn) 0xf0, 0x00, ((nnnn) >> 8) & 0xff, (nnnn) & 0xff
+
+// PLANE n
+// select bitplanes for CLS/DRW/scroll
+#define OP_fn01(n) 0xf0 | ((n) & 0xf), 0x01
 
 #endif /* __CHIP8_OPS_ */
@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "chip8.h"
+
+#ifndef __CHIP8_RECORD_H_
+#define __CHIP8_RECORD_H_
+
+/*
+ * UI_RECORD 輸出的 frame stream，數字都是 little-endian
+ *
+ *   header: "C8FS" version(1) 0 0 0
+ *   frame:  len(4) width(1) height(1) planes(1) flags(1) ts_ns(8) delta(len)
+ *
+ * delta 是這個 frame 與前一個 frame 的 XOR，以 (相同的 bytes 數, 不同的
+ * bytes 數, XOR 後的 bytes) 重覆編碼，數字都是 LEB128。frame 的內容是
+ * planes 個 width * height / 8 bytes 的 1bpp planes 接在一起。flags 有
+ * C8_REC_KEY 時前一個 frame 視為全 0，解析度改變時一定有
+ */
+#define C8_REC_MAGIC "C8FS"
+#define C8_REC_VERSION (1)
+#define C8_REC_HEADER_SIZE (8)
+#define C8_REC_FRAME_HEADER_SIZE (16)
+#define C8_REC_KEY (0x1)
+
+#define AutoChip8Reader Auto(Chip8Reader, _c8rec_free)
+
+typedef struct _Chip8Frame Chip8Frame;
+
+struct _Chip8Frame {
+  // 從 recorder 建立開始的 wall clock
+  uint64_t ts_ns;
+  int width;
+  int height;
+  int planes;
+  // 與 Ui::flush 相同，plane p 從 fb + p * FB_PLANE_SIZE 開始
+  const uint8_t *fb;
+};
+
+typedef struct _Chip8Reader Chip8Reader;
+
+/**
+ * 從 fd (檔案、pipe 或 socket) 依序解出 frames，不會 close(fd)
+ */
+Chip8Reader *c8rec_new(int fd);
+
+void c8rec_free(Chip8Reader *self);
+
+static inline void _c8rec_free(Chip8Reader **p) { c8rec_free(*p); }
+
+/**
+ * 讀下一個 frame，frame->fb 在下次呼叫前有效。回傳 1 讀到、0 正常
+ * 結束，或 negative errno: -EBADMSG 格式不對或中途截斷
+ */
+int c8rec_next(Chip8Reader *self, Chip8Frame *frame);
+
+#endif /* __CHIP8_RECORD_H_ */
@@ -10,8 +10,18 @@ typedef uint16_t OpCode;
 #define MEM_SIZE (0x1000)
 #define VM_SIZE (0x200)
 #define STACK_SIZE (0x60)
+#define USER_SIZE (MEM_SIZE - VM_SIZE - STACK_SIZE)
+// XO-CHIP 的 mem，F000 NNNN 可以定址全部，stack 放在它之後
+#define XO_MEM_SIZE (0x10000)
+#define XO_USER_SIZE (XO_MEM_SIZE - VM_SIZE)
+
+// framebuffer 不在 mem 中，最大 128x64，XO-CHIP 有兩個 planes
+#define FB_MAX_WIDTH (128)
+#define FB_MAX_HEIGHT (64)
+#define FB_PLANES (2)
+#define FB_PLANE_SIZE (FB_MAX_WIDTH * FB_MAX_HEIGHT / 8)
+// 64x32 的一個 plane
 #define FRAMEBUFFER_SIZE (0x100)
-#define USER_SIZE (MEM_SIZE - VM_SIZE - STACK_SIZE - FRAMEBUFFER_SIZE)
 
 #define APP_ENTRY (0x200)
 
@@ -39,20 +49,272 @@ enum _Chip8Key {
   C8_KEY_F,
 };
 
+typedef enum _UiKind UiKind;
+
+enum _UiKind {
+  UI_SDL,
+  UI_TERM,
+  UI_NULL,
+  // 把 frames 寫成 chip8-record.h 的 frame stream，輸出由 Chip8Options.record 指定
+  UI_RECORD,
+  // 不開視窗，按鍵來自 Chip8Options.journal 錄下的 input journal
+  UI_REPLAY,
+};
+
+typedef enum _Chip8Engine Chip8Engine;
+
+/**
+ * c8_steps() 的執行方式，c8_step() 永遠走 switch
+ */
+enum _Chip8Engine {
+  C8_ENGINE_DEFAULT,
+  // reference interpreter
+  C8_ENGINE_SWITCH,
+  // decode table + computed goto, needs -Dthreaded-dispatch=true
+  C8_ENGINE_THREADED,
+  // x86-64 basic block translation, needs -Djit=true
+  C8_ENGINE_JIT,
+};
+
+typedef enum _Chip8Variant Chip8Variant;
+
+enum _Chip8Variant {
+  C8_VARIANT_CHIP8,
+  // 128x64 hires, scrolling, 16x16 sprites, RPL flags
+  C8_VARIANT_SCHIP,
+  // SCHIP + 2 bitplanes, 5XY2/5XY3, F000 NNNN，mem 是 64KB (XO_MEM_SIZE)，stack 放在其後
+  C8_VARIANT_XOCHIP,
+};
+
+typedef struct _Chip8Options Chip8Options;
+
+/**
+ * 欄位為 0 時使用預設值
+ */
+struct _Chip8Options {
+  UiKind ui;
+  // window scale of UI_SDL, default 16
+  int scale;
+  // CXKK seed, 0 means seed from getrandom()
+  uint64_t seed;
+  // CXKK 每個 byte 都取自 getrandom()(批次取到 buffer)，不可重現
+  bool entropy;
+  // instructions per second, default C8_CLOCK_DEFAULT
+  uint32_t clock;
+  // falls back to C8_ENGINE_SWITCH when not built in
+  Chip8Engine engine;
+  // DXYN 超出底部的列繞回頂端，預設裁掉
+  bool sprite_wrap;
+  // c8_rewind() 可回溯的 frames 數，0 表示不保留
+  uint32_t rewind_frames;
+  // XO-CHIP 不能用 C8_ENGINE_JIT，改用 C8_ENGINE_THREADED
+  Chip8Variant variant;
+  // UI_RECORD 的輸出: 檔案路徑、"-" (stdout) 或 "unix:PATH"
+  const char *record;
+  /*
+   * 錄下每個 tick 的按鍵變化及 seed/clock/variant，UI_REPLAY 時則從這
+   * 個 journal 重播。重播要載入同一個 ROM
+   */
+  const char *journal;
+  /*
+   * decoded code cache 的目錄，NULL 表示不用。c8_load() 以 ROM 內容的
+   * hash 找 entry，沒有或驗證不過時才分析並寫回。小於
+   * C8_CODE_CACHE_MIN bytes 的 ROM 直接分析，switch engine 沒有
+   * decoded code，都不使用
+   */
+  const char *code_cache;
+};
+
+// 比這小的 ROM 當場分析比開檔及 mmap 快，不查也不寫 code cache
+#define C8_CODE_CACHE_MIN (0xa00)
+
+#define C8_SCALE_DEFAULT (16)
+#define C8_CLOCK_DEFAULT (600)
+
 typedef struct _Chip8 Chip8;
 
 Chip8 *c8_new();
 
+/**
+ * journal 無法建立或載入，或 UI_RECORD 的輸出無法開啟時回傳 NULL，
+ * errno 是原因，EBADMSG 表示 journal 格式不對
+ */
+Chip8 *c8_new_with_options(const Chip8Options *options);
+
 void c8_free(Chip8 *self);
 
 static inline void _c8_free(Chip8 **p) { c8_free(*p); }
 
-void c8_load(Chip8 *self, uint8_t *app, int size);
+void c8_load(Chip8 *self, const uint8_t *app, int size);
+
+/**
+ * 把 ROM 載入到 APP_ENTRY。regular file 以 mmap() 直接複製一次到 mem，
+ * pipe/stdin 等不能 mmap 的則以 read() 讀完。成功回傳 0，否則是負的
+ * errno：-EFBIG 超過 c8_user_size()、-ENODATA 空檔案，失敗時 mem 不變
+ */
+int c8_load_fd(Chip8 *self, int fd);
+
+int c8_load_file(Chip8 *self, const char *path);
+
+typedef struct _Chip8Rom Chip8Rom;
+
+/**
+ * 唯讀的 ROM image，可以 c8_load_rom() 載入到任意多個 VMs
+ */
+struct _Chip8Rom {
+  const uint8_t *data;
+  int size;
+  // data 是 MAP_SHARED 的 mapping，否則是 malloc() 的 buffer
+  bool mapped;
+};
+
+/**
+ * 以 c8_load_fd() 同樣的規則開啟 path，regular file 只建立 mapping
+ * 不複製，回傳值同 c8_load_fd()，但上限是 XO_USER_SIZE。用完以
+ * c8_rom_unmap() 釋放
+ */
+int c8_rom_map(Chip8Rom *rom, const char *path);
+
+void c8_rom_unmap(Chip8Rom *rom);
+
+// 超過 c8_user_size() 時回傳 -EFBIG，mem 不變
+int c8_load_rom(Chip8 *self, const Chip8Rom *rom);
+
+// 上次 c8_load() 的 decoded code 是否取自 Chip8Options.code_cache
+bool c8_code_cached(Chip8 *self);
 
 void c8_step(Chip8 *self);
 
 void c8_steps(Chip8 *self, int steps);
 
+/**
+ * 執行一個 60Hz frame 的 instructions，frame 開始時 poll 一次 events，
+ * 結束時 framebuffer 有變才 flush 一次。cycles_per_frame <= 0 時
+ * 執行到下一個 timer tick 為止
+ */
+void c8_run_frame(Chip8 *self, int cycles_per_frame);
+
+/**
+ * 睡到 wall clock 追上已執行的 frames，互動執行時讓 VM 維持 60Hz
+ */
+void c8_sync(Chip8 *self);
+
+/**
+ * 以 seed 重設 CXKK 的 xoshiro256** 狀態，0 表示向 getrandom() 要一個。
+ * 狀態屬於 snapshot，c8_rewind() 後會重現相同的亂數
+ */
+void c8_seed(Chip8 *self, uint64_t seed);
+
+// 已執行的 instructions
+uint64_t c8_cycles(Chip8 *self);
+
+// 已經過的 60Hz timer ticks
+uint64_t c8_frames(Chip8 *self);
+
+// 執行過的 illegal opcodes
+uint64_t c8_illegals(Chip8 *self);
+
+typedef struct _Chip8Stats Chip8Stats;
+
+/**
+ * c8_stats() 的 snapshot，opcodes/draws/flushes 需 -Dstats=true
+ */
+struct _Chip8Stats {
+  // 同 c8_cycles()
+  uint64_t instructions;
+  // 依 opcode 最高 4 bits 分類
+  uint64_t opcodes[16];
+  // DXYN
+  uint64_t draws;
+  // 實際送到 UI 的 framebuffer 更新
+  uint64_t flushes;
+  uint64_t illegals;
+  // 60Hz timer ticks，同 c8_frames()
+  uint64_t ticks;
+  // idle loop 沒有逐一執行、直接推進的 instructions
+  uint64_t idle_skipped;
+  // c8_new() 之後經過的 wall clock
+  uint64_t wall_ns;
+};
+
+/**
+ * 填入目前的統計，回傳 opcodes/draws/flushes 是否有編進來。
+ * lockstep lanes 以 SIMD 執行的 instructions 不計入 opcodes
+ */
+bool c8_stats(Chip8 *self, Chip8Stats *stats);
+
+/**
+ * 目前模式的 1bpp framebuffer，每列 c8_fb_width() / 8 bytes，MSB 是
+ * 最左邊的 pixel。64x32 時共 FRAMEBUFFER_SIZE bytes
+ */
+const uint8_t *c8_fb(Chip8 *self);
+
+// plane 0 同 c8_fb()，XO-CHIP 才會用到 plane 1
+const uint8_t *c8_fb_plane(Chip8 *self, int plane);
+
+// 64 或 128 (SCHIP 00FF 之後)
+int c8_fb_width(Chip8 *self);
+
+int c8_fb_height(Chip8 *self);
+
+// 目前模式下所有 planes 的 FNV-1a
+uint64_t c8_fb_hash(Chip8 *self);
+
+/**
+ * 在 journal 寫入結束時的 cycles 及 c8_fb_hash() 後關檔，c8_free()
+ * 時也會自動呼叫。互動執行時從 atexit() 呼叫
+ */
+void c8_journal_end(Chip8 *self);
+
+/**
+ * UI_REPLAY 的 journal 有正常結束時取出當時的 cycles 及 c8_fb_hash()，
+ * 以 c8_steps() 執行到該 cycles 後的 framebuffer 應該相同
+ */
+bool c8_replay_end(Chip8 *self, uint64_t *cycles, uint64_t *fb_hash);
+
+/**
+ * 回到 frames 個 60Hz frames 之前的狀態，1 是最近一次 timer tick 時。
+ * 每次 tick 以 XOR/RLE delta 記錄一個 snapshot，回傳實際回溯的 frames
+ * 數，被回溯的 history 即丟棄
+ */
+int c8_rewind(Chip8 *self, int frames);
+
+// 可回溯的 frames 數
+int c8_rewind_available(Chip8 *self);
+
+// history 佔用的 bytes
+size_t c8_rewind_size(Chip8 *self);
+
+// c8_mem_dirty() 及 watches 以 16 bytes 為一行追蹤寫入，XO-CHIP 也只
+// 追蹤前 MEM_SIZE bytes
+#define C8_MEM_LINE (16)
+#define C8_MEM_LINES (MEM_SIZE / C8_MEM_LINE)
+
+/**
+ * guest 寫入 watch 的範圍後呼叫，addr/len 是該次寫入與 watch 重疊的
+ * 部分。此時 PC 已指向下一個 instruction，callback 中只能讀取 vm，
+ * 不能新增/移除 watches
+ */
+typedef void (*Chip8WatchFunc)(Chip8 *vm, uint16_t addr, uint16_t len, void *data);
+
+/**
+ * 寫入 [addr, addr + len) 中任何 byte 時呼叫 func，包括 c8_load()、
+ * c8_rewind() 等 host 端的寫入。回傳給 c8_watch_remove() 的 id，範圍
+ * 不在 mem 內時回傳 -1。沒有 watches 時每次寫入只多一個 branch
+ */
+int c8_watch_add(Chip8 *self, uint16_t addr, uint16_t len, Chip8WatchFunc func, void *data);
+
+bool c8_watch_remove(Chip8 *self, int id);
+
+/**
+ * 上次清除後被寫過的 lines，bit n 是 lines[n / 64] 的第 n % 64 bit，
+ * 代表 mem[n * C8_MEM_LINE] 起的 16 bytes。clear 時取出後清除，只給
+ * 一個使用者清除，否則彼此會漏掉寫入
+ */
+void c8_mem_dirty(Chip8 *self, uint64_t lines[C8_MEM_LINES / 64], bool clear);
+
+Chip8Engine c8_engine(Chip8 *self);
+
 void c8_dump(Chip8 *self);
 
 int16_t c8_pc(Chip8 *self);
@@ -69,6 +331,12 @@ int8_t c8_dt(Chip8 *self);
 
 int8_t c8_st(Chip8 *self);
 
+// guest 可定址的 bytes，XO-CHIP 是 XO_MEM_SIZE，其餘是 MEM_SIZE
+int c8_mem_size(Chip8 *self);
+
+// c8_load() 最多可載入的 bytes，XO-CHIP 是 XO_USER_SIZE，其餘是 USER_SIZE
+int c8_user_size(Chip8 *self);
+
 uint8_t c8_mem8(Chip8 *self, int addr);
 
 uint16_t c8_mem16(Chip8 *self, int addr);
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
 
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
@@ -47,7 +49,7 @@
 
 #if LOG_LEVELS & LOG_ERROR
 #define error(fmt, ...) {       \
-  log(ERROR_STYLE, fmt, "\e[0m", __VA_ARGS__);  \
+  log_sync(ERROR_STYLE, fmt, "\e[0m", __VA_ARGS__);  \
   exit(1);                      \
 }
 #else
@@ -56,7 +58,7 @@
 
 #if LOG_LEVELS & LOG_FATAL
 #define fatal(fmt, ...) {       \
-  log(FATAL_STYLE, fmt, "\e[0m", __VA_ARGS__);  \
+  log_sync(FATAL_STYLE, fmt, "\e[0m", __VA_ARGS__);  \
   abort();                      \
 }
 #else
@@ -71,9 +73,131 @@
 #define ERROR_STYLE "\e[91mE\e[90m"
 #define FATAL_STYLE "\e[93;41mF\e[90m"
 
-#define log(prx, fmt, sfx, ...) printf(prx " %s:%d %s() " fmt sfx "\n", \
-                                       __BASE_FILE__, \
-                                       __LINE__, \
-                                       __func__ __VA_OPT__(,) __VA_ARGS__)
+#define log_printf(prx, fmt, sfx, ...) printf(prx " %s:%d %s() " fmt sfx "\n", \
+                                              __BASE_FILE__, \
+                                              __LINE__, \
+                                              __func__ __VA_OPT__(,) __VA_ARGS__)
+
+#ifdef ENABLE_LOG_ASYNC
+
+/**
+ * -Dlog-async=true 時 log() 只把 call site 及參數寫進 thread 自己的
+ * lock-free ring，由背景 thread 依 timestamp 合併後格式化輸出。
+ * ring 滿了呼叫端就自己把 rings 輸出完再繼續，不會遺失 records；
+ * -Dlog-async-drop=true 時改成丟掉並計數，呼叫端不會被擋住，但背景
+ * thread 跟不上時大部分 records 都會被丟掉。error()/fatal() 先等 ring
+ * 清空再同步輸出。背景 thread 無法建立、ring 配置失敗或程式結束之後，
+ * log() 直接同步輸出
+ */
+
+typedef struct _LogSite LogSite;
+
+struct _LogSite {
+  const char *style;
+  const char *fmt;
+  const char *sfx;
+  const char *file;
+  int line;
+  const char *func;
+};
+
+typedef struct _LogRecord LogRecord;
+
+// 回傳 NULL 時 record 被丟掉，或要改用同步輸出，見 log_fallback()
+LogRecord *log_begin(const LogSite *site);
+
+// log_begin() 回傳 NULL 是因為沒有背景 thread 或 ring 時回傳 true
+bool log_fallback();
+
+void log_put_s64(LogRecord *r, long long v);
+
+void log_put_u64(LogRecord *r, unsigned long long v);
+
+void log_put_f64(LogRecord *r, double v);
+
+// 字串複製進 record，過長時截斷
+void log_put_str(LogRecord *r, const char *v);
+
+void log_put_ptr(LogRecord *r, const void *v);
+
+void log_commit(LogRecord *r);
+
+// 等背景 thread 輸出所有已 commit 的 records
+void log_flush();
+
+// 最多 24 個參數，參數先做 default argument promotion，再依型別選 log_put_*()
+#define LOG_PUT(r, x) do {                          \
+  __typeof__((x) + 0) _log_a = (x);                 \
+  _Generic(_log_a,                                  \
+           char *: log_put_str,                     \
+           const char *: log_put_str,               \
+           float: log_put_f64,                      \
+           double: log_put_f64,                     \
+           int: log_put_s64,                        \
+           long: log_put_s64,                       \
+           long long: log_put_s64,                  \
+           unsigned: log_put_u64,                   \
+           unsigned long: log_put_u64,              \
+           unsigned long long: log_put_u64,         \
+           default: log_put_ptr)(r, _log_a);        \
+} while(0)
+
+#define LOG_NARGS(...) LOG_NARGS_(__VA_ARGS__, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, n, ...) n
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+
+#define LOG_PUT_1(r, a) LOG_PUT(r, a)
+#define LOG_PUT_2(r, a, ...) LOG_PUT(r, a); LOG_PUT_1(r, __VA_ARGS__)
+#define LOG_PUT_3(r, a, ...) LOG_PUT(r, a); LOG_PUT_2(r, __VA_ARGS__)
+#define LOG_PUT_4(r, a, ...) LOG_PUT(r, a); LOG_PUT_3(r, __VA_ARGS__)
+#define LOG_PUT_5(r, a, ...) LOG_PUT(r, a); LOG_PUT_4(r, __VA_ARGS__)
+#define LOG_PUT_6(r, a, ...) LOG_PUT(r, a); LOG_PUT_5(r, __VA_ARGS__)
+#define LOG_PUT_7(r, a, ...) LOG_PUT(r, a); LOG_PUT_6(r, __VA_ARGS__)
+#define LOG_PUT_8(r, a, ...) LOG_PUT(r, a); LOG_PUT_7(r, __VA_ARGS__)
+#define LOG_PUT_9(r, a, ...) LOG_PUT(r, a); LOG_PUT_8(r, __VA_ARGS__)
+#define LOG_PUT_10(r, a, ...) LOG_PUT(r, a); LOG_PUT_9(r, __VA_ARGS__)
+#define LOG_PUT_11(r, a, ...) LOG_PUT(r, a); LOG_PUT_10(r, __VA_ARGS__)
+#define LOG_PUT_12(r, a, ...) LOG_PUT(r, a); LOG_PUT_11(r, __VA_ARGS__)
+#define LOG_PUT_13(r, a, ...) LOG_PUT(r, a); LOG_PUT_12(r, __VA_ARGS__)
+#define LOG_PUT_14(r, a, ...) LOG_PUT(r, a); LOG_PUT_13(r, __VA_ARGS__)
+#define LOG_PUT_15(r, a, ...) LOG_PUT(r, a); LOG_PUT_14(r, __VA_ARGS__)
+#define LOG_PUT_16(r, a, ...) LOG_PUT(r, a); LOG_PUT_15(r, __VA_ARGS__)
+#define LOG_PUT_17(r, a, ...) LOG_PUT(r, a); LOG_PUT_16(r, __VA_ARGS__)
+#define LOG_PUT_18(r, a, ...) LOG_PUT(r, a); LOG_PUT_17(r, __VA_ARGS__)
+#define LOG_PUT_19(r, a, ...) LOG_PUT(r, a); LOG_PUT_18(r, __VA_ARGS__)
+#define LOG_PUT_20(r, a, ...) LOG_PUT(r, a); LOG_PUT_19(r, __VA_ARGS__)
+#define LOG_PUT_21(r, a, ...) LOG_PUT(r, a); LOG_PUT_20(r, __VA_ARGS__)
+#define LOG_PUT_22(r, a, ...) LOG_PUT(r, a); LOG_PUT_21(r, __VA_ARGS__)
+#define LOG_PUT_23(r, a, ...) LOG_PUT(r, a); LOG_PUT_22(r, __VA_ARGS__)
+#define LOG_PUT_24(r, a, ...) LOG_PUT(r, a); LOG_PUT_23(r, __VA_ARGS__)
+#define LOG_PUT_ALL(r, ...) LOG_CAT(LOG_PUT_, LOG_NARGS(__VA_ARGS__))(r, __VA_ARGS__)
+
+#define log(prx, fmt, sfx, ...) do {                                    \
+  static const LogSite _log_site = {                                    \
+    prx, fmt, sfx, __BASE_FILE__, __LINE__, __func__                    \
+  };                                                                    \
+  LogRecord *_log_r = log_begin(&_log_site);                            \
+  if(_log_r) {                                                          \
+    __VA_OPT__(LOG_PUT_ALL(_log_r, __VA_ARGS__);)                       \
+    log_commit(_log_r);                                                 \
+  } else if(log_fallback()) {                                           \
+    log_printf(prx, fmt, sfx __VA_OPT__(,) __VA_ARGS__);                \
+  }                                                                     \
+} while(0)
+
+#define log_sync(prx, fmt, sfx, ...) {                                  \
+  log_flush();                                                          \
+  log_printf(prx, fmt, sfx __VA_OPT__(,) __VA_ARGS__);                  \
+  fflush(stdout);                                                       \
+}
+
+#else
+
+#define log(prx, fmt, sfx, ...) log_printf(prx, fmt, sfx __VA_OPT__(,) __VA_ARGS__)
+
+#define log_sync(prx, fmt, sfx, ...) log_printf(prx, fmt, sfx __VA_OPT__(,) __VA_ARGS__)
+
+#endif
 
 #endif /* _LOGGING_H_ */
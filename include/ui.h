@@ -10,31 +10,36 @@
 
 #define UI(p) ((Ui *) (p))
 
-typedef enum _UiKind UiKind;
-
-enum _UiKind {
-  UI_TERM,
-  UI_SDL,
-};
-
 typedef struct _Ui Ui;
 
 struct _Ui {
   uint8_t *fb;
   void (*poll_events)(Ui *self);
+  // 睡到有新的 event 或 timeout_ns 過去，event 留給下次 poll_events 處理
+  void (*wait_events)(Ui *self, int64_t timeout_ns);
   bool (*key_pressed)(Ui *self, Chip8Key key);
-  void (*flush)(Ui *self, uint8_t *fb);
+  /*
+   * width x height (64x32 或 128x64) 的 planes 個 1bpp planes，plane p
+   * 從 fb + p * FB_PLANE_SIZE 開始，每列 width / 8 bytes。dirty 的
+   * bit n 表示第 n 列有變動，模式改變時全部的列都是 dirty
+   */
+  void (*flush)(Ui *self, const uint8_t *fb, int width, int height, int planes, uint64_t dirty);
   void (*destroy)(Ui *self);
 };
 
 Ui *ui_new(UiKind kind, int width, int height, int scale);
 
+// UI_RECORD 需要輸出目標，不經過 ui_new()，無法開啟時回傳 NULL
+Ui *ui_record_new(const char *target);
+
 void ui_free(Ui *self);
 
 void ui_poll_events(Ui *self);
 
+void ui_wait_events(Ui *self, int64_t timeout_ns);
+
 bool ui_key_pressed(Ui *self, Chip8Key key);
 
-void ui_flush(Ui *ui, uint8_t *fb);
+void ui_flush(Ui *ui, const uint8_t *fb, int width, int height, int planes, uint64_t dirty);
 
 #endif /* __UI_H_ */
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "batch.h"
+
+#define RANGE(lo, hi) (((uint64_t) (hi) << 32) | (uint32_t) (lo))
+#define RANGE_LO(r) ((uint32_t) (r))
+#define RANGE_HI(r) ((uint32_t) ((r) >> 32))
+
+typedef struct _BatchRom BatchRom;
+
+struct _BatchRom {
+  char *path;
+  // NULL 表示成功
+  const char *error;
+  uint64_t hash;
+  uint64_t cycles;
+  uint64_t illegals;
+  int64_t wall_ns;
+};
+
+typedef struct _BatchWorker BatchWorker;
+
+/**
+ * 每個 worker 一個 deque，內容是 roms 中的 [lo, hi)。只有開始前一次
+ * 分配，執行中不會再加入工作，所以兩端都用同一個 word 的 CAS 取出：
+ * owner 從 hi 端拿，thief 從 lo 端偷走一半
+ */
+struct _BatchWorker {
+  _Alignas(64) _Atomic uint64_t range;
+  pthread_t thread;
+  struct _Batch *batch;
+  int id;
+};
+
+typedef struct _Batch Batch;
+
+struct _Batch {
+  BatchRom *roms;
+  int nroms;
+  int cap;
+  int frames;
+  const char *code_cache;
+  BatchWorker *workers;
+  int nworkers;
+};
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char *load_error(int err) {
+  switch(err) {
+    case -ENODATA: return "empty file";
+    case -EFBIG: return "too large to load";
+  }
+  return strerror(-err);
+}
+
+static void run_rom(BatchRom *rom, int frames, const char *code_cache) {
+  Chip8Rom image;
+
+  int64_t begin = now_ns();
+  int err = c8_rom_map(&image, rom->path);
+  if(err) {
+    rom->error = load_error(err);
+    return;
+  }
+
+  AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+    .ui = UI_NULL,
+    .seed = BATCH_SEED,
+    .code_cache = code_cache,
+  });
+  if(!vm) {
+    c8_rom_unmap(&image);
+    rom->error = load_error(-errno);
+    return;
+  }
+  err = c8_load_rom(vm, &image);
+  c8_rom_unmap(&image);
+  if(err) {
+    rom->error = load_error(err);
+    return;
+  }
+  while(frames --) {
+    c8_run_frame(vm, 0);
+  }
+
+  rom->wall_ns = now_ns() - begin;
+  rom->hash = c8_fb_hash(vm);
+  rom->cycles = c8_cycles(vm);
+  rom->illegals = c8_illegals(vm);
+}
+
+static bool take(BatchWorker *w, int *index) {
+  uint64_t r = atomic_load_explicit(&w->range, memory_order_relaxed);
+  do {
+    if(RANGE_LO(r) >= RANGE_HI(r)) {
+      return false;
+    }
+  } while(!atomic_compare_exchange_weak_explicit(&w->range,
+                                                 &r,
+                                                 RANGE(RANGE_LO(r), RANGE_HI(r) - 1),
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed));
+  *index = RANGE_HI(r) - 1;
+  return true;
+}
+
+static bool steal(BatchWorker *thief) {
+  Batch *batch = thief->batch;
+  int i;
+  for(i = 1; i < batch->nworkers; ++ i) {
+    BatchWorker *victim = &batch->workers[(thief->id + i) % batch->nworkers];
+    uint64_t r = atomic_load_explicit(&victim->range, memory_order_relaxed);
+    uint32_t lo, half;
+    do {
+      lo = RANGE_LO(r);
+      if(lo >= RANGE_HI(r)) {
+        break;
+      }
+      half = (RANGE_HI(r) - lo + 1) / 2;
+    } while(!atomic_compare_exchange_weak_explicit(&victim->range,
+                                                   &r,
+                                                   RANGE(lo + half, RANGE_HI(r)),
+                                                   memory_order_relaxed,
+                                                   memory_order_relaxed));
+    if(lo < RANGE_HI(r)) {
+      atomic_store_explicit(&thief->range, RANGE(lo, lo + half), memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *worker_main(void *data) {
+  BatchWorker *w = data;
+  int index;
+  do {
+    while(take(w, &index)) {
+      run_rom(&w->batch->roms[index], w->batch->frames, w->batch->code_cache);
+    }
+  } while(steal(w));
+  return NULL;
+}
+
+static int is_rom(const struct dirent *e) {
+  size_t n = strlen(e->d_name);
+  return n > 4 && !strcasecmp(e->d_name + n - 4, ".ch8");
+}
+
+static char *join(const char *dir, const char *name) {
+  char *path;
+  if(name[0] == '/' || !dir[0]) {
+    path = strdup(name);
+  } else if(asprintf(&path,
+                      "%s%s%s",
+                      dir,
+                      dir[strlen(dir) - 1] == '/' ? "" : "/",
+                      name) == -1) {
+    path = NULL;
+  }
+  if(!path) {
+    fatal("%s", "out of memory");
+  }
+  return path;
+}
+
+static void add_rom(Batch *batch, char *path) {
+  if(batch->nroms == batch->cap) {
+    batch->cap = batch->cap ? batch->cap * 2 : 64;
+    batch->roms = realloc(batch->roms, sizeof(BatchRom) * batch->cap);
+    if(!batch->roms) {
+      fatal("%s", "out of memory");
+    }
+  }
+  batch->roms[batch->nroms ++] = (BatchRom) { .path = path };
+}
+
+static int scan_dir(Batch *batch, const char *dir) {
+  struct dirent **entries;
+  int n = scandir(dir, &entries, is_rom, alphasort);
+  if(n == -1) {
+    return -1;
+  }
+
+  int i;
+  for(i = 0; i < n; ++ i) {
+    add_rom(batch, join(dir, entries[i]->d_name));
+    free(entries[i]);
+  }
+  free(entries);
+  return 0;
+}
+
+static int scan_manifest(Batch *batch, const char *manifest) {
+  FILE *f = fopen(manifest, "r");
+  if(!f) {
+    return -1;
+  }
+
+  char *dir = strdup(manifest);
+  char *slash = strrchr(dir, '/');
+  if(slash) {
+    slash[1] = '\0';
+  } else {
+    dir[0] = '\0';
+  }
+
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  while((n = getline(&line, &cap, f)) != -1) {
+    while(n && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+      line[-- n] = '\0';
+    }
+    if(!n || line[0] == '#') {
+      continue;
+    }
+    add_rom(batch, join(dir, line));
+  }
+  free(line);
+  free(dir);
+  fclose(f);
+  return 0;
+}
+
+static void json_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for(; *s; ++ s) {
+    unsigned char c = *s;
+    if(c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if(c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+int batch_run(const char *path, int frames, int threads, const char *code_cache, FILE *out) {
+  Batch batch = { .frames = frames, .code_cache = code_cache };
+  struct stat st;
+  if(stat(path, &st) ||
+     (S_ISDIR(st.st_mode) ? scan_dir(&batch, path) : scan_manifest(&batch, path))) {
+    fprintf(stderr, "unable to read %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  if(threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if(threads > batch.nroms) {
+    threads = batch.nroms;
+  }
+  if(threads <= 0) {
+    threads = 1;
+  }
+
+  // 先平均切給每個 worker，跑得快的再去偷
+  batch.nworkers = threads;
+  batch.workers = aligned_alloc(64, sizeof(BatchWorker) * threads);
+  if(!batch.workers) {
+    fatal("%s", "out of memory");
+  }
+  int i;
+  for(i = 0; i < threads; ++ i) {
+    BatchWorker *w = &batch.workers[i];
+    w->batch = &batch;
+    w->id = i;
+    atomic_init(&w->range, RANGE((int64_t) batch.nroms * i / threads,
+                                 (int64_t) batch.nroms * (i + 1) / threads));
+  }
+  for(i = 1; i < threads; ++ i) {
+    int err = pthread_create(&batch.workers[i].thread, NULL, worker_main, &batch.workers[i]);
+    if(err) {
+      fatal("unable to create worker thread: %s", strerror(err));
+    }
+  }
+  worker_main(&batch.workers[0]);
+  for(i = 1; i < threads; ++ i) {
+    pthread_join(batch.workers[i].thread, NULL);
+  }
+
+  int failed = 0;
+  for(i = 0; i < batch.nroms; ++ i) {
+    BatchRom *rom = &batch.roms[i];
+    fputs("{\"rom\":", out);
+    json_string(out, rom->path);
+    if(rom->error) {
+      fputs(",\"error\":", out);
+      json_string(out, rom->error);
+      ++ failed;
+    } else {
+      fprintf(out,
+              ",\"fb_hash\":\"%016llx\",\"cycles\":%llu,\"wall_ns\":%lld,\"illegal\":%llu",
+              (unsigned long long) rom->hash,
+              (unsigned long long) rom->cycles,
+              (long long) rom->wall_ns,
+              (unsigned long long) rom->illegals);
+    }
+    fputs("}\n", out);
+    free(rom->path);
+  }
+  fflush(out);
+
+  free(batch.roms);
+  free(batch.workers);
+
+  return failed ? 2 : 0;
+}
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef __BATCH_H_
+#define __BATCH_H_
+
+#define BATCH_FRAMES_DEFAULT (600)
+// 固定 CXKK seed，同一個 ROM 每次跑出相同的 framebuffer
+#define BATCH_SEED (0x5eed)
+
+/**
+ * 以 headless VM 在 threads 個 worker 上執行 path 下所有的 .ch8，或
+ * manifest 中列出的 ROMs (一行一個，相對路徑以 manifest 所在目錄為準)，
+ * 每個 ROM 跑 frames 個 60Hz frames，依輸入順序輸出一行 JSON 結果。
+ * threads <= 0 時使用所有 online CPUs，code_cache 同 Chip8Options，
+ * 回傳 exit status
+ */
+int batch_run(const char *path, int frames, int threads, const char *code_cache, FILE *out);
+
+#endif /* __BATCH_H_ */
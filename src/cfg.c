@@ -0,0 +1,328 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+#include "chip8-cfg.h"
+
+#define BIT_GET(m, a) ((m)[(a) >> 3] >> ((a) & 7) & 1)
+#define BIT_SET(m, a) ((m)[(a) >> 3] |= 1 << ((a) & 7))
+
+// 結束 block 的 flags
+#define CFG_END (C8_BLOCK_SKIP | C8_BLOCK_JUMP | C8_BLOCK_CALL | C8_BLOCK_RETURN | \
+                 C8_BLOCK_INDIRECT | C8_BLOCK_EXIT | C8_BLOCK_ILLEGAL)
+
+struct _Chip8Cfg {
+  int count;
+  Chip8Block *blocks;
+  // 每個 address 開始的 instruction 所屬的 block
+  int16_t block_at[MEM_SIZE];
+  uint8_t code[MEM_SIZE / 8];
+};
+
+typedef struct _C8CfgWalk C8CfgWalk;
+
+/**
+ * 建構時的暫存，insn 是可達的 instructions 的開頭，leader 是 blocks
+ * 的開頭 (跳躍/呼叫的目標、skips 的兩個出口、呼叫的返回處)
+ */
+struct _C8CfgWalk {
+  const uint8_t *mem;
+  Chip8Variant variant;
+  uint8_t insn[MEM_SIZE / 8];
+  uint8_t leader[MEM_SIZE / 8];
+  int top;
+  uint16_t work[MEM_SIZE];
+  // cfg_loops() 用，blocks 不會多於 MEM_SIZE 個
+  uint8_t color[MEM_SIZE];
+  int16_t stack[MEM_SIZE][2];
+};
+
+static inline OpCode cfg_opcode(const uint8_t *mem, int pc) {
+  return mem[pc] << 8 | mem[pc + 1];
+}
+
+/**
+ * XO-CHIP 的 F000 NNNN 是 4 bytes，超出 mem 的 instruction 長度為 0
+ */
+static int cfg_len(C8CfgWalk *w, int pc) {
+  if(pc + 2 > MEM_SIZE) {
+    return 0;
+  }
+  if(w->variant == C8_VARIANT_XOCHIP && cfg_opcode(w->mem, pc) == 0xf000) {
+    return pc + 4 > MEM_SIZE ? 0 : 4;
+  }
+  return 2;
+}
+
+/**
+ * 與 c8_step()/c8_ext() 對同一個 variant 的判斷一致，一般的 instructions
+ * 回傳 0
+ */
+static uint16_t cfg_classify(OpCode op, Chip8Variant variant) {
+  bool ext = variant != C8_VARIANT_CHIP8;
+  bool xo = variant == C8_VARIANT_XOCHIP;
+  switch(op >> 12) {
+    case 0x0:
+      if(op == 0x00e0) {
+        return 0;
+      } else if(op == 0x00ee) {
+        return C8_BLOCK_RETURN;
+      } else if(ext && op == 0x00fd) {
+        return C8_BLOCK_EXIT;
+      } else if(ext && ((op & 0xfff0) == 0x00c0 || (op >= 0x00fb && op <= 0x00ff))) {
+        return 0;
+      } else if(xo && (op & 0xfff0) == 0x00d0) {
+        return 0;
+      }
+      return C8_BLOCK_ILLEGAL;
+    case 0x1:
+      return C8_BLOCK_JUMP;
+    case 0x2:
+      return C8_BLOCK_CALL;
+    case 0x3:
+    case 0x4:
+    case 0x9:
+      return C8_BLOCK_SKIP;
+    case 0x5:
+      if(!xo || !N(op)) {
+        return C8_BLOCK_SKIP;
+      }
+      return N(op) == 0x2 || N(op) == 0x3 ? 0 : C8_BLOCK_ILLEGAL;
+    case 0x8:
+      return N(op) <= 0x7 || N(op) == 0xe ? 0 : C8_BLOCK_ILLEGAL;
+    case 0xb:
+      return C8_BLOCK_INDIRECT;
+    case 0xe:
+      return KK(op) == 0x9e || KK(op) == 0xa1 ? C8_BLOCK_SKIP : C8_BLOCK_ILLEGAL;
+    case 0xf:
+      switch(KK(op)) {
+        case 0x07:
+        case 0x0a:
+        case 0x15:
+        case 0x18:
+        case 0x1e:
+        case 0x29:
+        case 0x33:
+        case 0x55:
+        case 0x65:
+          return 0;
+        case 0x00:
+          return xo && !VX(op) ? 0 : C8_BLOCK_ILLEGAL;
+        case 0x01:
+        case 0x02:
+        case 0x3a:
+          return xo ? 0 : C8_BLOCK_ILLEGAL;
+        case 0x30:
+        case 0x75:
+        case 0x85:
+          return ext ? 0 : C8_BLOCK_ILLEGAL;
+      }
+      return C8_BLOCK_ILLEGAL;
+  }
+  return 0;
+}
+
+static void cfg_leader(C8CfgWalk *w, int addr) {
+  if(addr >= MEM_SIZE || BIT_GET(w->leader, addr)) {
+    return;
+  }
+  BIT_SET(w->leader, addr);
+  w->work[w->top ++] = addr;
+}
+
+/**
+ * 從每個 leader 循序往下標記 instructions，遇到結束 block 的
+ * instruction 時把它的出口加入 leaders
+ */
+static void cfg_walk(C8CfgWalk *w, Chip8Cfg *self) {
+  cfg_leader(w, APP_ENTRY);
+  while(w->top) {
+    int pc = w->work[-- w->top];
+    while(!BIT_GET(w->insn, pc)) {
+      int len = cfg_len(w, pc);
+      if(!len) {
+        break;
+      }
+      BIT_SET(w->insn, pc);
+      int a;
+      for(a = pc; a < pc + len; ++ a) {
+        BIT_SET(self->code, a);
+      }
+
+      OpCode op = cfg_opcode(w->mem, pc);
+      int next = pc + len;
+      uint16_t flags = cfg_classify(op, w->variant);
+      if(flags & C8_BLOCK_SKIP) {
+        cfg_leader(w, next);
+        int skip = cfg_len(w, next);
+        if(skip) {
+          cfg_leader(w, next + skip);
+        }
+      } else if(flags & C8_BLOCK_JUMP) {
+        cfg_leader(w, NNN(op));
+      } else if(flags & C8_BLOCK_CALL) {
+        cfg_leader(w, NNN(op));
+        cfg_leader(w, next);
+      }
+      if(flags & CFG_END) {
+        break;
+      }
+      pc = next;
+    }
+  }
+}
+
+static int16_t cfg_block_at(Chip8Cfg *self, int addr) {
+  return addr < MEM_SIZE ? self->block_at[addr] : -1;
+}
+
+/**
+ * 依 address 順序從每個 leader 切出 block，到結束 block 的 instruction
+ * 或下一個 leader 為止，再接上 successors
+ */
+static void cfg_split(C8CfgWalk *w, Chip8Cfg *self) {
+  int addr, b = 0;
+  for(addr = 0; addr < MEM_SIZE; ++ addr) {
+    if(!BIT_GET(w->leader, addr) || !BIT_GET(w->insn, addr)) {
+      continue;
+    }
+    Chip8Block *block = &self->blocks[b];
+    int pc = addr, len;
+    block->start = addr;
+    block->flags = 0;
+    while(true) {
+      self->block_at[pc] = b;
+      len = cfg_len(w, pc);
+      block->flags = cfg_classify(cfg_opcode(w->mem, pc), w->variant);
+      int next = pc + len;
+      if(block->flags || next >= MEM_SIZE || BIT_GET(w->leader, next) || !BIT_GET(w->insn, next)) {
+        break;
+      }
+      pc = next;
+    }
+    block->end = pc + len;
+    // cfg_walk() 結束後 work 不再使用，拿來記每個 block 最後的 instruction
+    w->work[b ++] = pc;
+  }
+
+  for(b = 0; b < self->count; ++ b) {
+    Chip8Block *block = &self->blocks[b];
+    OpCode op = cfg_opcode(w->mem, w->work[b]);
+    block->succ[0] = block->succ[1] = -1;
+    if(block->flags & C8_BLOCK_SKIP) {
+      block->succ[0] = cfg_block_at(self, block->end);
+      int skip = cfg_len(w, block->end);
+      block->succ[1] = skip ? cfg_block_at(self, block->end + skip) : -1;
+    } else if(block->flags & C8_BLOCK_JUMP) {
+      block->succ[0] = cfg_block_at(self, NNN(op));
+    } else if(block->flags & C8_BLOCK_CALL) {
+      block->succ[0] = cfg_block_at(self, NNN(op));
+      block->succ[1] = cfg_block_at(self, block->end);
+    } else if(!(block->flags & CFG_END)) {
+      block->succ[0] = cfg_block_at(self, block->end);
+    }
+  }
+}
+
+/**
+ * 從 APP_ENTRY 的 block 以 DFS 走過所有 edges，指向還在 stack 上的
+ * block 的是 back edge，目標就是 loop header
+ */
+static void cfg_loops(C8CfgWalk *w, Chip8Cfg *self) {
+  enum { WHITE, GRAY, BLACK };
+  uint8_t *color = w->color;
+  // 每層記 block 及下一個要走的 successor
+  int16_t (*stack)[2] = w->stack;
+
+  int r;
+  for(r = -1; r < self->count; ++ r) {
+    int root = r < 0 ? self->block_at[APP_ENTRY] : r;
+    if(color[root] != WHITE) {
+      continue;
+    }
+    int top = 0;
+    stack[top][0] = root;
+    stack[top ++][1] = 0;
+    color[root] = GRAY;
+    while(top) {
+      int16_t *frame = stack[top - 1];
+      Chip8Block *block = &self->blocks[frame[0]];
+      if(frame[1] == 2) {
+        color[frame[0]] = BLACK;
+        -- top;
+        continue;
+      }
+      int16_t s = block->succ[frame[1] ++];
+      if(s < 0) {
+        continue;
+      }
+      if(color[s] == GRAY) {
+        self->blocks[s].flags |= C8_BLOCK_LOOP_HEADER;
+      } else if(color[s] == WHITE) {
+        color[s] = GRAY;
+        stack[top][0] = s;
+        stack[top ++][1] = 0;
+      }
+    }
+  }
+}
+
+Chip8Cfg *c8_cfg_build(Chip8 *vm) {
+  assert(vm);
+  Chip8Cfg *self = calloc(1, sizeof(Chip8Cfg));
+  C8CfgWalk *w = calloc(1, sizeof(C8CfgWalk));
+  if(!self || !w) {
+    fatal("%s", "out of memory");
+  }
+  w->mem = vm->mem;
+  w->variant = vm->variant;
+  memset(self->block_at, 0xff, sizeof(self->block_at));
+
+  cfg_walk(w, self);
+
+  int addr;
+  for(addr = 0; addr < MEM_SIZE; addr += 8) {
+    self->count += __builtin_popcount(w->leader[addr >> 3] & w->insn[addr >> 3]);
+  }
+  self->blocks = malloc(sizeof(Chip8Block) * (self->count ? self->count : 1));
+  if(!self->blocks) {
+    fatal("%s", "out of memory");
+  }
+  cfg_split(w, self);
+  cfg_loops(w, self);
+  free(w);
+
+  trace("c8_cfg_build(): %p, %d blocks", self, self->count);
+  return self;
+}
+
+void c8_cfg_free(Chip8Cfg *self) {
+  if(!self) {
+    return;
+  }
+  free(self->blocks);
+  free(self);
+}
+
+int c8_cfg_count(Chip8Cfg *self) {
+  assert(self);
+  return self->count;
+}
+
+const Chip8Block *c8_cfg_blocks(Chip8Cfg *self) {
+  assert(self);
+  return self->blocks;
+}
+
+int c8_cfg_block_at(Chip8Cfg *self, uint16_t pc) {
+  assert(self);
+  return cfg_block_at(self, pc);
+}
+
+bool c8_cfg_is_code(Chip8Cfg *self, uint16_t addr) {
+  assert(self);
+  return addr < MEM_SIZE && BIT_GET(self->code, addr);
+}
@@ -0,0 +1,503 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "config.h"
+#include "chip8.h"
+#include "ui.h"
+
+#ifndef __CHIP8_PRIV_H_
+#define __CHIP8_PRIV_H_
+
+#ifdef ENABLE_DTRACE
+#include "chip8-sdt.h"
+#else
+#define CHIP8_EXEC_BEGIN()
+#define CHIP8_EXEC_END()
+#define CHIP8_ILLEGAL_OPCODE(op)
+#endif
+
+#define C8_FRAME_RATE (60)
+
+// CHIP-8/SCHIP 的 stack 在 mem 最後面
+#define STACK_ADDR (MEM_SIZE - STACK_SIZE)
+
+// 0-F 的 4x5 字型及 SCHIP/XO-CHIP 的 8x10 字型，FX29/FX30 指向這裡
+#define FONT_ADDR (0x000)
+#define BIG_FONT_ADDR (0x050)
+
+typedef struct _C8Jit C8Jit;
+
+typedef struct _C8Code C8Code;
+
+#define VX(op) ((uint8_t)((op) >> 8) & 0xf)
+#define VY(op) ((uint8_t)((op) >> 4) & 0xf)
+#define NNN(op) ((uint16_t)(op) & 0xfff)
+#define N(op) ((uint8_t)(op) & 0xf)
+#define KK(op) ((uint8_t)(op) & 0xff)
+
+#define C8_ENTROPY_POOL (256)
+#define C8_IDLE_WAIT_NS (250000000LL)
+// idle loop 最多幾個 instructions。沒找到時隔幾個 cycles 再檢查，每次
+// 加倍到 C8_IDLE_SETTLE_MAX 為止，與 frame 長度無關
+#define C8_IDLE_MAX_OPS (8)
+#define C8_IDLE_SETTLE (16)
+#define C8_IDLE_SETTLE_MAX (1024)
+
+typedef struct _C8Rewind C8Rewind;
+
+typedef struct _C8Journal C8Journal;
+
+typedef struct _C8JournalInfo C8JournalInfo;
+
+typedef struct _C8Watch C8Watch;
+
+struct _C8Watch {
+  int id;
+  uint16_t addr;
+  uint16_t len;
+  Chip8WatchFunc func;
+  void *data;
+};
+
+// journal header 中重播需要的設定
+struct _C8JournalInfo {
+  uint64_t seed;
+  uint32_t clock;
+  Chip8Variant variant;
+};
+
+#ifdef ENABLE_STATS
+#define C8_STAT_ADD(self, counter, n) ((self)->stats.counter += (n))
+#else
+#define C8_STAT_ADD(self, counter, n) ((void) 0)
+#endif
+
+struct _Chip8 {
+  Ui *ui;
+  // 還沒 flush 的 framebuffer 列，bit n 是第 n 列
+  uint64_t dirty;
+  // c8_run_frame() 中，flush 延到 frame 邊界
+  bool in_frame;
+  Chip8Engine engine;
+  Chip8Variant variant;
+  uint32_t clock;
+  bool sprite_wrap;
+  // 遇到的 illegal opcodes
+  uint64_t illegals;
+  // guest 可定址的 mem bytes 及 stack 的位址，XO-CHIP 的 stack 在
+  // XO_MEM_SIZE 之後，guest 定址不到
+  uint32_t mem_size;
+  uint32_t stack_addr;
+  uint8_t *stack;
+  // c8_sync() 對齊 wall clock 的基準
+  uint64_t sync_frames;
+  int64_t sync_ns;
+#ifdef ENABLE_JIT
+  C8Jit *jit;
+#endif
+#ifdef ENABLE_THREADED_DISPATCH
+  C8Code *code;
+  // Chip8Options.code_cache 的複本
+  char *code_cache;
+#endif
+#ifdef ENABLE_STATS
+  // 只用到 opcodes/draws/flushes，其餘由 c8_stats() 填
+  Chip8Stats stats;
+#endif
+  int64_t created_ns;
+  // cycles 到這裡時檢查 idle loop，idle_settle 是沒找到時的間隔
+  uint64_t idle_next;
+  uint32_t idle_settle;
+  // idle loop 直接推進的 cycles
+  uint64_t idle_skipped;
+  C8Rewind *rewind;
+  // 錄製按鍵，replay 時反過來從中取出 keys
+  C8Journal *journal;
+  bool replay;
+  // 沒有 journal 時 tick 只標記，第一次讀 keys 才向 UI 取樣
+  bool keys_stale;
+  // 最近一次 c8_seed() 實際使用的 seed
+  uint64_t seed;
+  // entropy mode 時 CXKK 從這裡取，用完再 getrandom() 一次
+  bool entropy;
+  uint16_t pool_left;
+  uint8_t pool[C8_ENTROPY_POOL];
+  // 過了 timer tick，等目前的 instruction(s) 結束後拍 snapshot
+  bool snapshot_due;
+  // 上次 c8_mem_dirty() 清除後寫過的 lines
+  uint64_t mem_dirty[C8_MEM_LINES / 64];
+  // c8_watch_add() 的範圍，watch_lines 是它們涵蓋的 lines
+  int nwatches;
+  int watches_size;
+  int watch_next_id;
+  C8Watch *watches;
+  uint64_t watch_lines[C8_MEM_LINES / 64];
+
+  /*
+   * 以下到結尾都是 guest 狀態，snapshot 以 C8_STATE_OFFSET 起的
+   * c8_state_size() bytes 整段存取
+   */
+
+  // 虛擬時鐘，每個 instruction 一個 cycle，DT/ST 每 clock / 60 cycles 減一
+  uint64_t cycles;
+  uint64_t frames;
+  uint32_t countdown;
+  // CXKK 的 xoshiro256** 狀態
+  uint64_t rnd[4];
+
+  // app 不可見/直接操作的 registers
+  uint16_t pc;
+  uint16_t sp;
+
+  uint16_t i;
+  uint8_t dt;
+  uint8_t st;
+  // 停在 FX0A 等按鍵，keys_held 是開始等待時已按著、還沒放開的 keys
+  bool key_waiting;
+  uint16_t keys_held;
+  // 每個 tick 取樣一次的按鍵，EX9E/EXA1/FX0A 都看這裡
+  uint16_t keys;
+  uint8_t v[16];
+  // SCHIP 00FF 之後是 128x64
+  bool hires;
+  // XO-CHIP FN01 選的 planes，CLS/DRW/scroll 只作用在這些 planes
+  uint8_t plane_mask;
+  // SCHIP FX75/FX85
+  uint8_t rpl[16];
+  // 每列 c8_fb_width() / 8 bytes，只用到目前模式的大小
+  _Alignas(64) uint8_t fb[FB_PLANES][FB_PLANE_SIZE];
+
+  // 依 variant 配置，見 c8_vm_size()
+  uint8_t mem[];
+};
+
+#define C8_STATE_OFFSET offsetof(Chip8, cycles)
+
+static inline uint8_t *c8_state(Chip8 *self) {
+  return (uint8_t *) self + C8_STATE_OFFSET;
+}
+
+// 到 stack 結尾為止
+static inline uint32_t c8_state_size(Chip8 *self) {
+  return offsetof(Chip8, mem) - C8_STATE_OFFSET + self->stack_addr + STACK_SIZE;
+}
+
+/**
+ * 以 options 建構的 VM 要配置的 bytes，已補到 _Alignof(Chip8) 的倍數。
+ * replay 時 variant 要載入 journal 才知道，一律以 XO-CHIP 配置
+ */
+static inline size_t c8_vm_size(const Chip8Options *options) {
+  size_t size = offsetof(Chip8, mem);
+  if(options->variant == C8_VARIANT_XOCHIP || options->ui == UI_REPLAY) {
+    size += XO_MEM_SIZE + STACK_SIZE;
+  } else {
+    size += MEM_SIZE;
+  }
+  return (size + _Alignof(Chip8) - 1) & ~(_Alignof(Chip8) - 1);
+}
+
+// 最差情況每個 byte 都各自成段
+#define C8_DELTA_MAX(n) ((n) * 3 + 16)
+
+/**
+ * a 與 b 的 XOR，以 (相同的 bytes 數, 不同的 bytes 數, XOR 後的 bytes)
+ * 重覆編碼，數字都是 LEB128。回傳寫到 out 的 bytes 數，相同時為 0
+ */
+uint32_t c8_delta_encode(const uint8_t *a, const uint8_t *b, uint32_t n, uint8_t *out);
+
+// 把 delta XOR 回 n bytes 的 state，資料不完整或超出 n 時回傳 false
+bool c8_delta_apply(uint8_t *state, uint32_t n, const uint8_t *data, uint32_t len);
+
+// size 是 c8_state_size()
+C8Rewind *c8_rewind_new(uint32_t frames, uint32_t size);
+
+void c8_rewind_free(C8Rewind *self);
+
+void c8_rewind_capture(Chip8 *vm);
+
+C8Journal *c8_journal_create(const char *path, const C8JournalInfo *info);
+
+// 失敗時 err 為 negative errno，-EBADMSG 表示格式不對
+C8Journal *c8_journal_load(const char *path, C8JournalInfo *info, int *err);
+
+void c8_journal_free(C8Journal *self);
+
+void c8_journal_keys(C8Journal *self, uint64_t cycles, uint16_t keys);
+
+// 套用 cycles 之前 (含) 的 events，keys 有變時回傳 true
+bool c8_journal_replay(C8Journal *self, uint64_t cycles, uint16_t *keys);
+
+// 回到 cycles 時的位置，之後的 c8_journal_replay() 只套用更晚的 events
+void c8_journal_seek(C8Journal *self, uint64_t cycles);
+
+// 錄製時寫入 END 並關檔，之後的按鍵不再記錄
+void c8_journal_close(C8Journal *self, uint64_t cycles, uint64_t fb_hash);
+
+bool c8_journal_end_of(C8Journal *self, uint64_t *cycles, uint64_t *fb_hash);
+
+/**
+ * 在呼叫端配置的記憶體上建構/解構 VM，c8_new_with_options()/c8_free()
+ * 及 lockstep lanes 共用。self 要以 c8_vm_size() 配置並清為 0。
+ * 失敗時回傳 NULL 並設定 errno，不需 c8_fini()
+ */
+Chip8 *c8_init(Chip8 *self, const Chip8Options *options);
+
+void c8_fini(Chip8 *self);
+
+/**
+ * 解譯 PC 上的一個 opcode 並把 *pending 加一，不推進 clock，見
+ * c8_clock_sync()。JIT 遇到沒翻譯的 opcode 時也用它
+ */
+void c8_exec(Chip8 *self, uint32_t *pending);
+
+#ifdef ENABLE_JIT
+C8Jit *c8_jit_new();
+
+void c8_jit_free(C8Jit *self);
+
+void c8_jit_steps(Chip8 *vm, int steps);
+
+void c8_jit_invalidate(C8Jit *self, int addr, int len);
+#endif
+
+#ifdef ENABLE_THREADED_DISPATCH
+typedef enum _C8Handler C8Handler;
+
+enum _C8Handler {
+  C8_OP_ILLEGAL,
+  C8_OP_CLS,
+  C8_OP_RET,
+  C8_OP_JP,
+  C8_OP_CALL,
+  C8_OP_SE_VX_KK,
+  C8_OP_SNE_VX_KK,
+  C8_OP_SE_VX_VY,
+  C8_OP_LD_VX_KK,
+  C8_OP_ADD_VX_KK,
+  C8_OP_LD_VX_VY,
+  C8_OP_OR,
+  C8_OP_AND,
+  C8_OP_XOR,
+  C8_OP_ADD_VX_VY,
+  C8_OP_SUB,
+  C8_OP_SHR,
+  C8_OP_SUBN,
+  C8_OP_SHL,
+  C8_OP_SNE_VX_VY,
+  C8_OP_LD_I,
+  C8_OP_JP_V0,
+  C8_OP_RND,
+  C8_OP_DRW,
+  C8_OP_SKP,
+  C8_OP_SKNP,
+  C8_OP_LD_VX_DT,
+  C8_OP_LD_VX_K,
+  C8_OP_LD_DT,
+  C8_OP_LD_ST,
+  C8_OP_ADD_I,
+  C8_OP_LD_F,
+  C8_OP_LD_B,
+  C8_OP_LD_MEM_VX,
+  C8_OP_LD_VX_MEM,
+  C8_OP_EXT,
+  C8_OP_COUNT,
+};
+
+typedef struct _C8Decoded C8Decoded;
+
+/**
+ * 每個 opcode 事先拆好的 handler 及 operands
+ */
+struct _C8Decoded {
+  uint8_t handler;
+  uint8_t x;
+  uint8_t y;
+  uint8_t kk;
+  uint16_t nnn;
+};
+
+#define C8_CODE_LEADERS ((STACK_ADDR / 2 + 63) / 64)
+
+/**
+ * stack 之前每個偶數位址的 opcode 先解好，c8_mem_written() 時只重解
+ * 被寫到的位址。這刻意取代了原本 process 共用、以 opcode 查的 64K 項
+ * 表：只佔 12KB、不必在 process 啟動時建表，也讓 leaders 及 code cache
+ * 有地方放。CALL 常寫的 stack 不在其中。XO-CHIP 的 5XYN
+ * 與其他 variants 解法不同，建立時就決定。
+ * leaders 是 c8_load() 時 image 中 basic blocks 的開頭，每個偶數位址
+ * 一個 bit，之後 guest 改寫程式碼時不更新，只當作切 block 的提示
+ */
+struct _C8Code {
+  bool xo;
+  // 上次 c8_load() 的 ops 及 leaders 取自 code cache
+  bool cached;
+  C8Decoded ops[STACK_ADDR / 2];
+  uint64_t leaders[C8_CODE_LEADERS];
+};
+
+C8Code *c8_code_new(const uint8_t *mem, bool xo);
+
+void c8_code_update(C8Code *self, const uint8_t *mem, int addr, int len);
+
+/**
+ * c8_load() 把 size bytes 的 ROM 放進 mem 之後，以 cache 目錄中的 entry
+ * 取代 ROM 範圍的解碼及 leaders 分析，沒有可用的 entry 時照常分析並
+ * 寫回 cache。cache 為 NULL 或 size 小於 C8_CODE_CACHE_MIN 時不用 cache
+ */
+void c8_code_load(C8Code *self, const char *cache, const uint8_t *mem, int size);
+
+static inline bool c8_code_leader(const C8Code *self, int addr) {
+  return addr < STACK_ADDR && self->leaders[addr >> 7] >> (addr >> 1 & 63) & 1;
+}
+
+/**
+ * dir 中 rom 的 entry 存在、內容與 rom 相同且完整時，把它的 decoded
+ * ops 及 leaders 複製到 self 並回傳 true，其餘情況不改變 self
+ */
+bool c8_code_cache_load(C8Code *self, const char *dir, const uint8_t *rom, int size);
+
+// 把 self 中 rom 範圍的 ops 及 leaders 寫成 dir 中的 entry，失敗時只記 log
+void c8_code_cache_store(const C8Code *self, const char *dir, const uint8_t *rom, int size);
+#endif
+
+#define C8_HASH_MUL (0x9e3779b97f4a7c15ULL)
+
+/**
+ * 8 bytes 一次、4 路交錯的 multiply-xor，4 KiB 約 1µs。只用來發現不同，
+ * 不能當作內容相同的證明
+ */
+static inline uint64_t c8_hash(const uint8_t *p, size_t n) {
+  uint64_t h[4] = { 1, 2, 3, 4 }, w;
+  size_t i = 0;
+  for(; i + 32 <= n; i += 32) {
+    int k;
+    for(k = 0; k < 4; ++ k) {
+      memcpy(&w, p + i + k * 8, 8);
+      h[k] = (h[k] ^ w) * C8_HASH_MUL;
+    }
+  }
+  for(; i + 8 <= n; i += 8) {
+    memcpy(&w, p + i, 8);
+    h[0] = (h[0] ^ w) * C8_HASH_MUL;
+  }
+  for(; i < n; ++ i) {
+    h[1] = (h[1] ^ p[i]) * C8_HASH_MUL;
+  }
+  return (h[0] ^ h[1] >> 21) * C8_HASH_MUL + (h[2] ^ h[3] >> 21);
+}
+
+/**
+ * [addr, addr + len) 涵蓋的 lines 在 lines[w] 中的 bits
+ */
+static inline uint64_t c8_lines_mask(int addr, int len, int w) {
+  int first = addr / C8_MEM_LINE - w * 64;
+  int last = (addr + len - 1) / C8_MEM_LINE - w * 64;
+  if(last < 0 || first > 63) {
+    return 0;
+  }
+  first = first < 0 ? 0 : first;
+  last = last > 63 ? 63 : last;
+  return (~0ULL >> (63 - (last - first))) << first;
+}
+
+// 有 watch 的 lines 被寫到時找出重疊的 watches 並呼叫
+void c8_watch_hit(Chip8 *self, int addr, int len);
+
+/**
+ * c8_mem_written() 中 decoded code 以外的部分，c8_load() 自己更新
+ * decoded code 時用
+ */
+static inline void c8_mem_touched(Chip8 *self, int addr, int len) {
+  int w;
+  if(addr >= MEM_SIZE) {
+    return;
+  }
+  if(len > MEM_SIZE - addr) {
+    len = MEM_SIZE - addr;
+  }
+  for(w = addr / C8_MEM_LINE / 64; w <= (addr + len - 1) / C8_MEM_LINE / 64; ++ w) {
+    self->mem_dirty[w] |= c8_lines_mask(addr, len, w);
+  }
+#ifdef ENABLE_JIT
+  if(self->jit) {
+    c8_jit_invalidate(self->jit, addr, len);
+  }
+#endif
+  if(__builtin_expect(self->nwatches != 0, 0)) {
+    c8_watch_hit(self, addr, len);
+  }
+}
+
+/**
+ * 所有寫入 mem 的路徑都要通知，translated/decoded code 才不會過期。
+ * dirty lines、watches 及 decoded code 都只涵蓋前 MEM_SIZE bytes，
+ * XO-CHIP 更後面的寫入不必通知
+ */
+static inline void c8_mem_written(Chip8 *self, int addr, int len) {
+#ifdef ENABLE_THREADED_DISPATCH
+  if(self->code && addr < STACK_ADDR) {
+    c8_code_update(self->code, self->mem, addr, len);
+  }
+#endif
+  c8_mem_touched(self, addr, len);
+}
+
+void c8_timer_tick(Chip8 *self);
+
+static inline void c8_clock_advance(Chip8 *self, uint32_t n) {
+  while(n >= self->countdown) {
+    n -= self->countdown;
+    self->cycles += self->countdown;
+    c8_timer_tick(self);
+  }
+  self->cycles += n;
+  self->countdown -= n;
+}
+
+/**
+ * engines 一次跑一段，clock 只在結束時推進。pending 是已執行但還沒算進
+ * cycles 的 instructions，讀寫 DT/ST/keys 或寫記憶體前要先補上，這些
+ * opcodes 看到的 cycles 及 ticks 才與逐一推進相同
+ */
+static inline void c8_clock_sync(Chip8 *self, uint32_t *pending) {
+  if(*pending) {
+    c8_clock_advance(self, *pending);
+    *pending = 0;
+  }
+}
+
+static inline void c8_illegal(Chip8 *self, OpCode opcode) {
+  CHIP8_ILLEGAL_OPCODE(opcode);
+  self->illegals ++;
+}
+
+static inline int c8_fb_w(Chip8 *self) {
+  return self->hires ? FB_MAX_WIDTH : UI_WIDTH;
+}
+
+static inline int c8_fb_h(Chip8 *self) {
+  return self->hires ? FB_MAX_HEIGHT : UI_HEIGHT;
+}
+
+static inline void c8_flush(Chip8 *self) {
+  int h = c8_fb_h(self);
+  C8_STAT_ADD(self, flushes, 1);
+  ui_flush(self->ui,
+           self->fb[0],
+           c8_fb_w(self),
+           h,
+           self->variant == C8_VARIANT_XOCHIP ? 2 : 1,
+           self->dirty & (~0ULL >> (64 - h)));
+  self->dirty = 0;
+}
+
+// 一段執行結束，補上 pending 的 cycles，過了 tick 就拍 snapshot
+static inline void c8_run_end(Chip8 *self, uint32_t pending) {
+  c8_clock_advance(self, pending);
+  if(self->snapshot_due) {
+    c8_rewind_capture(self);
+  }
+}
+
+#endif /* __CHIP8_PRIV_H_ */
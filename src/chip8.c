@@ -1,98 +1,262 @@
+#define _DEFAULT_SOURCE
 #include <assert.h>
+#include <errno.h>
+#include <endian.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/random.h>
 #include "config.h"
 #include "logging.h"
 #include "chip8.h"
+#include "chip8-priv.h"
 #include "ui.h"
 
-#ifdef ENABLE_DTRACE
-#include "chip8-sdt.h"
-#else
-#define CHIP8_EXEC_BEGIN()
-#define CHIP8_EXEC_END()
-#define CHIP8_ILLEGAL_OPCODE(op)
-#endif
-
-#define VX(op) ((uint8_t)((op) >> 8) & 0xf)
-#define VY(op) ((uint8_t)((op) >> 4) & 0xf)
-#define NNN(op) ((uint16_t)(op) & 0xfff)
-#define N(op) ((uint8_t)(op) & 0xf)
-#define KK(op) ((uint8_t)(op) & 0xff)
-
-struct _Chip8 {
-  Ui *ui;
-  bool dirty;
-
-  // app 不可見/直接操作的 registers
-  uint16_t pc;
-  uint16_t sp;
+inline bool c8_stack_empty(Chip8 *self);
+inline uint16_t c8_stack_peek(Chip8 *self);
 
-  uint16_t i;
-  uint8_t dt;
-  uint8_t st;
-  uint8_t v[16];
+static const uint8_t c8_font[16 * 5] = {
+  0xf0, 0x90, 0x90, 0x90, 0xf0, 0x20, 0x60, 0x20, 0x20, 0x70,
+  0xf0, 0x10, 0xf0, 0x80, 0xf0, 0xf0, 0x10, 0xf0, 0x10, 0xf0,
+  0x90, 0x90, 0xf0, 0x10, 0x10, 0xf0, 0x80, 0xf0, 0x10, 0xf0,
+  0xf0, 0x80, 0xf0, 0x90, 0xf0, 0xf0, 0x10, 0x20, 0x40, 0x40,
+  0xf0, 0x90, 0xf0, 0x90, 0xf0, 0xf0, 0x90, 0xf0, 0x10, 0xf0,
+  0xf0, 0x90, 0xf0, 0x90, 0x90, 0xe0, 0x90, 0xe0, 0x90, 0xe0,
+  0xf0, 0x80, 0x80, 0x80, 0xf0, 0xe0, 0x90, 0x90, 0x90, 0xe0,
+  0xf0, 0x80, 0xf0, 0x80, 0xf0, 0xf0, 0x80, 0xf0, 0x80, 0x80,
+};
 
-  union {
-    uint8_t mem[MEM_SIZE];
-    struct {
-      uint8_t sys[VM_SIZE];
-      uint8_t user[USER_SIZE];
-      uint8_t fb[FRAMEBUFFER_SIZE];
-      uint8_t stack[STACK_SIZE];
-    };
-  };
+// SCHIP 只有 0-9，A-F 同 XO-CHIP (Octo)
+static const uint8_t c8_big_font[16 * 10] = {
+  0xff, 0xff, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xff, 0xff,
+  0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xff, 0xff,
+  0xff, 0xff, 0x03, 0x03, 0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff,
+  0xff, 0xff, 0x03, 0x03, 0xff, 0xff, 0x03, 0x03, 0xff, 0xff,
+  0xc3, 0xc3, 0xc3, 0xc3, 0xff, 0xff, 0x03, 0x03, 0x03, 0x03,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0x03, 0x03, 0xff, 0xff,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff,
+  0xff, 0xff, 0x03, 0x03, 0x06, 0x0c, 0x18, 0x18, 0x18, 0x18,
+  0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff,
+  0xff, 0xff, 0xc3, 0xc3, 0xff, 0xff, 0x03, 0x03, 0xff, 0xff,
+  0x7e, 0xff, 0xc3, 0xc3, 0xc3, 0xff, 0xff, 0xc3, 0xc3, 0xc3,
+  0xfc, 0xfc, 0xc3, 0xc3, 0xfc, 0xfc, 0xc3, 0xc3, 0xfc, 0xfc,
+  0x3c, 0xff, 0xc3, 0xc0, 0xc0, 0xc0, 0xc0, 0xc3, 0xff, 0x3c,
+  0xfc, 0xfe, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xc3, 0xfe, 0xfc,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff,
+  0xff, 0xff, 0xc0, 0xc0, 0xff, 0xff, 0xc0, 0xc0, 0xc0, 0xc0,
 };
 
-inline bool c8_stack_empty(Chip8 *self);
-inline uint16_t c8_stack_peek(Chip8 *self);
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 /**
- * 只初始 app 碰不到的部份
+ * 只初始 app 碰不到的部份，self 需已清為 0
  */
-static Chip8 *c8_init(Chip8 *self) {
+Chip8 *c8_init(Chip8 *self, const Chip8Options *options) {
   trace("c8_new(): %p", self);
+  // replay 時 seed/clock/variant 都以 journal 錄製時的為準
+  Chip8Options o = *options;
+  if(o.ui == UI_REPLAY) {
+    C8JournalInfo info;
+    int err;
+    self->journal = c8_journal_load(o.journal ? o.journal : "", &info, &err);
+    if(!self->journal) {
+      errno = -err;
+      return NULL;
+    }
+    self->replay = true;
+    o.seed = info.seed;
+    o.clock = info.clock;
+    o.variant = info.variant;
+  }
+  options = &o;
   self->pc = 0 + VM_SIZE;
   self->sp = STACK_SIZE;
-  self->ui = ui_new(UI_SDL, UI_WIDTH, UI_HEIGHT, 16);
-  self->dirty = false;
+  self->variant = options->variant;
+  self->mem_size = self->variant == C8_VARIANT_XOCHIP ? XO_MEM_SIZE : MEM_SIZE;
+  self->stack_addr = self->variant == C8_VARIANT_XOCHIP ? XO_MEM_SIZE : STACK_ADDR;
+  self->stack = self->mem + self->stack_addr;
+  memcpy(self->mem + FONT_ADDR, c8_font, sizeof(c8_font));
+  memcpy(self->mem + BIG_FONT_ADDR, c8_big_font, sizeof(c8_big_font));
+  if(options->ui == UI_RECORD) {
+    self->ui = ui_record_new(options->record);
+    if(!self->ui) {
+      return NULL;
+    }
+  } else {
+    self->ui = ui_new(options->ui,
+                      UI_WIDTH,
+                      UI_HEIGHT,
+                      options->scale ? options->scale : C8_SCALE_DEFAULT);
+  }
+  self->dirty = 0;
+  self->clock = options->clock ? options->clock : C8_CLOCK_DEFAULT;
+  if(self->clock < C8_FRAME_RATE) {
+    self->clock = C8_FRAME_RATE;
+  }
+  self->countdown = (self->clock + C8_FRAME_RATE - 1) / C8_FRAME_RATE;
+  c8_seed(self, options->seed);
+  self->entropy = options->entropy;
+  if(options->journal && !self->replay) {
+    self->journal = c8_journal_create(options->journal, &(C8JournalInfo){
+      .seed = self->seed,
+      .clock = self->clock,
+      .variant = options->variant,
+    });
+    if(!self->journal) {
+      int err = errno;
+      ui_free(self->ui);
+      errno = err;
+      return NULL;
+    }
+  }
+  if(self->journal && self->entropy) {
+    warn("%s", "entropy mode can not be replayed, use seeded CXKK");
+    self->entropy = false;
+  }
+  self->sprite_wrap = options->sprite_wrap;
+  if(options->rewind_frames) {
+    self->rewind = c8_rewind_new(options->rewind_frames, c8_state_size(self));
+    if(!self->rewind) {
+      warn("%s", "unable to allocate rewind history, rewind disabled");
+    }
+  }
+  self->created_ns = now_ns();
+  self->idle_settle = C8_IDLE_SETTLE;
+  self->plane_mask = 1;
+  self->engine = options->engine;
+  // JIT 的 skip 固定跳 2 bytes，不認得 F000 NNNN
+  if(self->variant == C8_VARIANT_XOCHIP && self->engine == C8_ENGINE_JIT) {
+    self->engine = C8_ENGINE_DEFAULT;
+  }
+#ifdef ENABLE_JIT
+  if(self->engine == C8_ENGINE_JIT) {
+    self->jit = c8_jit_new();
+    if(!self->jit) {
+      warn("unable to create JIT code cache, fall back to interpreter");
+      self->engine = C8_ENGINE_DEFAULT;
+    }
+  }
+#else
+  if(self->engine == C8_ENGINE_JIT) {
+    self->engine = C8_ENGINE_DEFAULT;
+  }
+#endif
+#ifdef ENABLE_THREADED_DISPATCH
+  if(self->engine == C8_ENGINE_DEFAULT) {
+    self->engine = C8_ENGINE_THREADED;
+  }
+  // JIT 只用 leaders 切 blocks，沒有 C8Code 也能跑
+  if(self->engine == C8_ENGINE_THREADED || self->engine == C8_ENGINE_JIT) {
+    self->code = c8_code_new(self->mem, self->variant == C8_VARIANT_XOCHIP);
+    if(!self->code && self->engine == C8_ENGINE_THREADED) {
+      warn("%s", "unable to allocate decoded code, fall back to switch");
+      self->engine = C8_ENGINE_SWITCH;
+    }
+  }
+  if(self->code && options->code_cache) {
+    self->code_cache = strdup(options->code_cache);
+  }
+#else
+  if(self->engine == C8_ENGINE_DEFAULT || self->engine == C8_ENGINE_THREADED) {
+    self->engine = C8_ENGINE_SWITCH;
+  }
+#endif
   return self;
 }
 
 Chip8 *c8_new() {
-  return c8_init(malloc(sizeof(Chip8)));
+  return c8_new_with_options(&(Chip8Options){ .ui = UI_SDL });
+}
+
+Chip8 *c8_new_with_options(const Chip8Options *options) {
+  assert(options);
+  // fb 是 _Alignas(64)，calloc() 只保證 16 bytes
+  size_t size = c8_vm_size(options);
+  Chip8 *self = aligned_alloc(_Alignof(Chip8), size);
+  if(!self) {
+    return NULL;
+  }
+  memset(self, 0, size);
+  if(!c8_init(self, options)) {
+    int err = errno;
+    free(self);
+    errno = err;
+    return NULL;
+  }
+  return self;
+}
+
+void c8_fini(Chip8 *self) {
+  c8_journal_end(self);
+  c8_journal_free(self->journal);
+  ui_free(self->ui);
+  c8_rewind_free(self->rewind);
+  free(self->watches);
+#ifdef ENABLE_JIT
+  c8_jit_free(self->jit);
+#endif
+#ifdef ENABLE_THREADED_DISPATCH
+  free(self->code);
+  free(self->code_cache);
+#endif
 }
 
 void c8_free(Chip8 *self) {
   trace("c8_free(): %p", self);
   if(self) {
-    ui_free(self->ui);
+    c8_fini(self);
     free(self);
   }
 }
 
-void c8_load(Chip8 *self, uint8_t *app, int size) {
+void c8_load(Chip8 *self, const uint8_t *app, int size) {
   assert(self);
   assert(app);
-  assert(size > 0 && size < USER_SIZE);
+  assert(size > 0 && size <= c8_user_size(self));
   memcpy(self->mem + APP_ENTRY, app, size);
+#ifdef ENABLE_THREADED_DISPATCH
+  if(self->code) {
+    c8_code_load(self->code, self->code_cache, self->mem, size);
+    c8_mem_touched(self, APP_ENTRY, size);
+    return;
+  }
+#endif
+  c8_mem_written(self, APP_ENTRY, size);
 }
 
 static inline OpCode c8_fetch(Chip8 *self) {
   OpCode op;
   assert(!(self->pc & 1));
   op = self->mem[self->pc ++] << 8;
-  return op | self->mem[self->pc ++];
+  op |= self->mem[self->pc ++];
+  C8_STAT_ADD(self, opcodes[op >> 12], 1);
+  return op;
 }
 
+/**
+ * XO-CHIP 的 F000 NNNN 有 4 bytes，要整個跳過
+ */
 static inline void c8_skip(Chip8 *self) {
+  if(self->variant == C8_VARIANT_XOCHIP &&
+     self->mem[self->pc] == 0xf0 &&
+     self->mem[(uint16_t) (self->pc + 1)] == 0x00) {
+    self->pc += 2;
+  }
   self->pc += 2;
 }
 
 static inline void c8_fb_clear(Chip8 *self) {
-  memset(self->fb, 0, FRAMEBUFFER_SIZE);
-  self->dirty = true;
+  int p;
+  for(p = 0; p < FB_PLANES; ++ p) {
+    if(self->plane_mask & (1 << p)) {
+      memset(self->fb[p], 0, FB_PLANE_SIZE);
+    }
+  }
+  self->dirty = ~0ULL;
 }
 
 static const char *to_bin(uint8_t v, char *buf) {
@@ -104,41 +268,175 @@ static const char *to_bin(uint8_t v, char *buf) {
   return buf;
 }
 
+/**
+ * 一列 pixels 以 128 bits 處理，MSB 為最左邊的 pixel，64x32 時只用
+ * 高 64 bits。framebuffer 中每列是 1 或 2 個 big-endian uint64_t
+ */
+typedef unsigned __int128 C8Row;
+
+// 固定長度的 memcpy() 才會編成單一 load/store
+static inline C8Row c8_fb_row(Chip8 *self, int p, int y) {
+  uint64_t w[2] = { 0, 0 };
+  if(self->hires) {
+    memcpy(w, self->fb[p] + y * 16, 16);
+  } else {
+    memcpy(w, self->fb[p] + y * 8, 8);
+  }
+  return (C8Row) be64toh(w[0]) << 64 | be64toh(w[1]);
+}
+
+static inline void c8_fb_set_row(Chip8 *self, int p, int y, C8Row row) {
+  uint64_t w[2] = { htobe64(row >> 64), htobe64(row) };
+  if(self->hires) {
+    memcpy(self->fb[p] + y * 16, w, 16);
+  } else {
+    memcpy(self->fb[p] + y * 8, w, 8);
+  }
+}
+
+static inline C8Row c8_fb_mask(int width) {
+  return ~(C8Row) 0 << (128 - width);
+}
+
+// 在 width 寬的列中往右 rotate n 個 pixels
+static inline C8Row c8_fb_ror(C8Row v, int n, int width) {
+  return n ? ((v >> n) | (v << (width - n))) & c8_fb_mask(width) : v;
+}
+
+/**
+ * 起點座標先繞回畫面內，超出右邊的部份 rotate 回左邊，超出底部的列
+ * 裁掉，sprite_wrap 時繞回頂端。SCHIP/XO-CHIP 的 DXY0 是 16x16，每列
+ * 2 bytes。每個選到的 plane 依序取用 I 之後的 sprite 資料。有 pixel
+ * 被清掉時 VF = 1，否則 0
+ */
 static void c8_fb_draw(Chip8 *self, int x, int y, int n) {
-  int i;
-  int bitshift = x & 0x7;
-  for(i = 0; i < n; ++ i) {
-    int dist = (y + i) * UI_WIDTH + x;
-    uint8_t *fb = self->fb + (dist >> 3);
-    uint8_t v = self->mem[self->i + i];
-    dump("x=%3u, y=%3u, dist=%4d, shift=%d, v=%s, r=%s%s",
-          x,
-          y + i,
-          dist,
-          bitshift,
-          to_bin(v, (char[9]){}),
-          to_bin(v >> bitshift, (char[9]){}),
-          to_bin(v << (8 - bitshift), (char[9]){}));
-    *fb ^= v >> bitshift;
-    if(bitshift) {
-      *(fb + 1) ^= v << (8 - bitshift);
+  int w = c8_fb_w(self), h = c8_fb_h(self);
+  int sw = 8, rows = n;
+  uint16_t addr = self->i;
+  // I 可能超出 mem，sprite 繞回開頭
+  uint32_t mask = self->mem_size - 1;
+  C8Row hit = 0;
+  int p, i;
+
+  // 最常見的 64x32 8 列 sprite，一列就是一個 uint64_t
+  if(!self->hires && n && self->plane_mask == 1) {
+    uint64_t hit64 = 0, dirty = 0;
+    const uint8_t *sprites = self->mem;
+    uint8_t *fb = self->fb[0];
+    C8_STAT_ADD(self, draws, 1);
+    x &= UI_WIDTH - 1;
+    y &= UI_HEIGHT - 1;
+    if(!self->sprite_wrap && y + n > UI_HEIGHT) {
+      n = UI_HEIGHT - y;
+    }
+    for(i = 0; i < n; ++ i) {
+      int r = (y + i) & (UI_HEIGHT - 1);
+      uint8_t bits = sprites[(addr + i) & mask];
+      uint64_t sprite = (uint64_t) bits << 56;
+      uint64_t row;
+      sprite = x ? sprite >> x | sprite << (64 - x) : sprite;
+      memcpy(&row, fb + r * 8, 8);
+      row = be64toh(row);
+      dump("x=%3u, y=%3u, v=%s", x, r, to_bin(bits, (char[9]){}));
+      hit64 |= row & sprite;
+      row = htobe64(row ^ sprite);
+      memcpy(fb + r * 8, &row, 8);
+      dirty |= 1ULL << r;
+    }
+    self->dirty |= dirty;
+    self->v[0xf] = hit64 != 0;
+    return;
+  }
+
+  C8_STAT_ADD(self, draws, 1);
+  if(!n && self->variant != C8_VARIANT_CHIP8) {
+    sw = 16;
+    rows = 16;
+  }
+  x &= w - 1;
+  y &= h - 1;
+  n = rows;
+  if(!self->sprite_wrap && y + n > h) {
+    n = h - y;
+  }
+
+  for(p = 0; p < FB_PLANES; ++ p) {
+    if(!(self->plane_mask & (1 << p))) {
+      continue;
+    }
+    for(i = 0; i < n; ++ i) {
+      int r = (y + i) & (h - 1);
+      uint16_t bits = self->mem[(addr + i * (sw >> 3)) & mask];
+      if(sw == 16) {
+        bits = bits << 8 | self->mem[(addr + i * 2 + 1) & mask];
+      }
+      C8Row sprite = c8_fb_ror((C8Row) bits << (128 - sw), x, w);
+      C8Row row = c8_fb_row(self, p, r);
+      dump("x=%3u, y=%3u, v=%s", x, r, to_bin(bits >> (sw - 8), (char[9]){}));
+      hit |= row & sprite;
+      c8_fb_set_row(self, p, r, row ^ sprite);
+      self->dirty |= 1ULL << r;
     }
+    addr += rows * (sw >> 3);
   }
+  self->v[0xf] = hit != 0;
+}
 
-  //int r, c;
-  //for(r = 0; r < 32; r ++) {
-  //  for(c = 0; c < 8; c ++) {
-  //    printf("%s", to_bin(self->fb[r * (UI_WIDTH >> 3) + c], (char[9]){}));
-  //  }
-  //  printf("\n");
-  //}
+/**
+ * 00Cn/00Dn，n > 0 往下、< 0 往上，移出畫面的列丟掉，移入的是空白
+ */
+static void c8_fb_scroll_v(Chip8 *self, int n) {
+  int h = c8_fb_h(self), stride = c8_fb_w(self) >> 3;
+  int m = n < 0 ? -n : n;
+  int p;
+  for(p = 0; p < FB_PLANES; ++ p) {
+    uint8_t *fb = self->fb[p];
+    if(!(self->plane_mask & (1 << p))) {
+      continue;
+    }
+    if(n > 0) {
+      memmove(fb + m * stride, fb, (h - m) * stride);
+      memset(fb, 0, m * stride);
+    } else {
+      memmove(fb, fb + m * stride, (h - m) * stride);
+      memset(fb + (h - m) * stride, 0, m * stride);
+    }
+  }
+  self->dirty = ~0ULL;
+}
+
+/**
+ * 00FB/00FC，n > 0 往右、< 0 往左，整列以 128-bit word 移動
+ */
+static void c8_fb_scroll_h(Chip8 *self, int n) {
+  int w = c8_fb_w(self), h = c8_fb_h(self);
+  int p, r;
+  for(p = 0; p < FB_PLANES; ++ p) {
+    if(!(self->plane_mask & (1 << p))) {
+      continue;
+    }
+    for(r = 0; r < h; ++ r) {
+      C8Row row = c8_fb_row(self, p, r);
+      row = n > 0 ? row >> n : row << -n;
+      c8_fb_set_row(self, p, r, row & c8_fb_mask(w));
+    }
+  }
+  self->dirty = ~0ULL;
+}
 
-  self->dirty = true;
+/**
+ * 00FE/00FF，每列的 bytes 數不同，所有 planes 都清掉
+ */
+static void c8_fb_set_hires(Chip8 *self, bool hires) {
+  self->hires = hires;
+  memset(self->fb, 0, sizeof(self->fb));
+  self->dirty = ~0ULL;
 }
 
 static inline void c8_push_pc(Chip8 *self) {
   self->stack[-- self->sp] = self->pc >> 8;
   self->stack[-- self->sp] = self->pc & 0xff;
+  c8_mem_written(self, self->stack_addr + self->sp, 2);
 }
 
 static inline void c8_pop_pc(Chip8 *self) {
@@ -150,23 +448,243 @@ static inline void c8_jmp(Chip8 *self, uint16_t addr) {
   self->pc = addr;
 }
 
+static inline uint64_t c8_rotl64(uint64_t x, int n) {
+  return (x << n) | (x >> (64 - n));
+}
+
+static bool c8_entropy_refill(Chip8 *self) {
+  ssize_t n = getrandom(self->pool, sizeof(self->pool), 0);
+  if(n <= 0) {
+    warn("getrandom() failed (%zd), fall back to seeded CXKK", n);
+    self->entropy = false;
+    return false;
+  }
+  self->pool_left = n;
+  return true;
+}
+
+/**
+ * 預設用 xoshiro256** 讓 CXKK 可重現，取最高的 8 bits。entropy mode
+ * 時改從 getrandom() 填的 pool 取
+ */
+static inline uint8_t c8_random(Chip8 *self) {
+  if(self->entropy && (self->pool_left || c8_entropy_refill(self))) {
+    return self->pool[-- self->pool_left];
+  }
+  uint64_t *s = self->rnd;
+  uint64_t r = c8_rotl64(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = c8_rotl64(s[3], 45);
+  return r >> 56;
+}
+
+static uint16_t c8_ui_keys(Chip8 *self) {
+  uint16_t keys = 0;
+  int k;
+  for(k = 0; k < 16; ++ k) {
+    if(ui_key_pressed(self->ui, k)) {
+      keys |= 1 << k;
+    }
+  }
+  return keys;
+}
+
+static inline uint16_t c8_keys(Chip8 *self) {
+  if(self->keys_stale) {
+    self->keys_stale = false;
+    self->keys = c8_ui_keys(self);
+  }
+  return self->keys;
+}
+
 static inline bool c8_key_pressed(Chip8 *self, int8_t key) {
-  return ui_key_pressed(self->ui, key & 0xf);
+  return c8_keys(self) >> (key & 0xf) & 1;
 }
 
-static inline int8_t c8_key_wait(Chip8 *self) {
-  return 0;
+/**
+ * 等待中新按下的 keys，開始等待前就按著的要先放開
+ */
+static uint16_t c8_key_edges(Chip8 *self) {
+  uint16_t keys = c8_keys(self);
+  self->keys_held &= keys;
+  return keys & ~self->keys_held;
 }
 
-void c8_step(Chip8 *self) {
-  OpCode opcode;
+/**
+ * FX0A，沒有新按下的 key 時 PC 停在 FX0A 並設 key_waiting，各 engine
+ * 看到後就返回，由 c8_steps() 只推進 clock 不再解譯
+ */
+static inline void c8_key_wait(Chip8 *self, uint8_t x) {
+  uint16_t edges = 0;
+  if(!self->key_waiting) {
+    self->key_waiting = true;
+    self->keys_held = c8_keys(self);
+  } else {
+    edges = c8_key_edges(self);
+  }
+  if(!edges) {
+    self->pc -= 2;
+    return;
+  }
+  self->v[x] = __builtin_ctz(edges);
+  self->key_waiting = false;
+}
 
-  assert(self);
+static void c8_bcd(Chip8 *self, uint8_t x) {
+  uint8_t l = self->v[x] % 10;
+  uint8_t m = self->v[x] / 10;
+  uint8_t h = m / 10;
+  trace("m[%hd] = %hhd, m[%hd+1] = %hhd, m[%hd+2] = %hhd, ",
+        self->i,
+        h,
+        self->i,
+        m % 10,
+        self->i,
+        l);
+  // 同 FX55，I 超出 mem 時不寫
+  if(self->i > self->mem_size - 3) {
+    warn("try to store BCD at address %hx", self->i);
+    return;
+  }
+  self->mem[self->i] = h;
+  self->mem[self->i+1] = m % 10;
+  self->mem[self->i+2] = l;
+  c8_mem_written(self, self->i, 3);
+}
 
-  CHIP8_EXEC_BEGIN();
+static void c8_regs_store(Chip8 *self, uint8_t x) {
+  if(self->mem_size - self->i < (uint32_t) (x + 1)) {
+    warn("try to store %hhd registers at address %hx",
+         x + 1,
+         self->i);
+  } else {
+    trace("store v0-v%uux on I(0x%hx)",
+          x + 1,
+          self->i);
+    memcpy(self->mem + self->i, self->v, x + 1);
+    c8_mem_written(self, self->i, x + 1);
+    self->i += x + 1;
+  }
+}
 
-  ui_poll_events(self->ui);
+static void c8_regs_load(Chip8 *self, uint8_t x) {
+  if(self->mem_size - self->i < (uint32_t) (x + 1)) {
+    warn("try to load %hhd registers from address %hx",
+         x + 1,
+         self->i);
+  } else {
+    trace("load v0-v%uux on I(0x%hx)",
+          x + 1,
+          self->i);
+    memcpy(self->v, self->mem + self->i, x + 1);
+    self->i += x + 1;
+  }
+}
+
+/**
+ * XO-CHIP 5XY2/5XY3，x > y 時反向，I 不變
+ */
+static void c8_regs_range(Chip8 *self, OpCode opcode) {
+  int x = VX(opcode), y = VY(opcode);
+  int step = x <= y ? 1 : -1;
+  int n = (y - x) * step + 1, k;
+  for(k = 0; k < n; ++ k) {
+    int addr = (self->i + k) & (self->mem_size - 1);
+    if(N(opcode) == 0x2) {
+      self->mem[addr] = self->v[x + k * step];
+      c8_mem_written(self, addr, 1);
+    } else {
+      self->v[x + k * step] = self->mem[addr];
+    }
+  }
+}
+
+/**
+ * SCHIP/XO-CHIP 擴充的 opcodes，不屬於目前 variant 時回傳 false 當成
+ * illegal。沒有音效，F002/FX3A 不動作
+ */
+static bool c8_ext(Chip8 *self, OpCode opcode) {
+  bool xo = self->variant == C8_VARIANT_XOCHIP;
+  if(self->variant == C8_VARIANT_CHIP8) {
+    return false;
+  }
+
+  switch(opcode >> 12) {
+    case 0x0:
+      if((opcode & 0xfff0) == 0x00c0) {
+        c8_fb_scroll_v(self, N(opcode));
+        return true;
+      } else if(xo && (opcode & 0xfff0) == 0x00d0) {
+        c8_fb_scroll_v(self, -N(opcode));
+        return true;
+      }
+      switch(opcode) {
+        case 0x00fb:
+          c8_fb_scroll_h(self, 4);
+          return true;
+        case 0x00fc:
+          c8_fb_scroll_h(self, -4);
+          return true;
+        case 0x00fd:
+          // 結束，停在原地
+          self->pc -= 2;
+          return true;
+        case 0x00fe:
+          c8_fb_set_hires(self, false);
+          return true;
+        case 0x00ff:
+          c8_fb_set_hires(self, true);
+          return true;
+      }
+      return false;
+    case 0x5:
+      if(!xo || (N(opcode) != 0x2 && N(opcode) != 0x3)) {
+        return false;
+      }
+      c8_regs_range(self, opcode);
+      return true;
+    case 0xf:
+      switch(KK(opcode)) {
+        case 0x00:
+          if(!xo || VX(opcode)) {
+            return false;
+          }
+          self->i = self->mem[self->pc] << 8 | self->mem[(uint16_t) (self->pc + 1)];
+          self->pc += 2;
+          return true;
+        case 0x01:
+          if(!xo) {
+            return false;
+          }
+          self->plane_mask = VX(opcode) & 0x3;
+          return true;
+        case 0x02:
+        case 0x3a:
+          return xo;
+        case 0x30:
+          self->i = BIG_FONT_ADDR + (self->v[VX(opcode)] & 0xf) * 10;
+          return true;
+        case 0x75:
+          memcpy(self->rpl, self->v, VX(opcode) + 1);
+          return true;
+        case 0x85:
+          memcpy(self->v, self->rpl, VX(opcode) + 1);
+          return true;
+      }
+      return false;
+  }
+  return false;
+}
 
+void c8_exec(Chip8 *self, uint32_t *pending) {
+  OpCode opcode;
+
+  CHIP8_EXEC_BEGIN();
   opcode = c8_fetch(self);
   trace("opcode: 0x%04hx", opcode);
   switch(opcode >> 12) {
@@ -181,8 +699,12 @@ void c8_step(Chip8 *self) {
           c8_pop_pc(self);
           break;
         default:
-          CHIP8_ILLEGAL_OPCODE(opcode);
-          return;
+          c8_clock_sync(self, pending);
+          if(c8_ext(self, opcode)) {
+            break;
+          }
+          c8_illegal(self, opcode);
+          break;
       }
       break;
     case 0x1:
@@ -191,6 +713,7 @@ void c8_step(Chip8 *self) {
       break;
     case 0x2:
       trace("call 0x%hx", NNN(opcode));
+      c8_clock_sync(self, pending);
       c8_push_pc(self);
       c8_jmp(self, NNN(opcode));
       break;
@@ -215,6 +738,14 @@ void c8_step(Chip8 *self) {
       }
       break;
     case 0x5:
+      if(N(opcode) && self->variant == C8_VARIANT_XOCHIP) {
+        c8_clock_sync(self, pending);
+        if(c8_ext(self, opcode)) {
+          break;
+        }
+        c8_illegal(self, opcode);
+        break;
+      }
       trace("v%hhx(%d) == v%hhx(%d), %s",
             VX(opcode),
             self->v[VX(opcode)],
@@ -325,8 +856,8 @@ void c8_step(Chip8 *self) {
           self->v[VX(opcode)] <<= 1;
           break;
         default:
-          CHIP8_ILLEGAL_OPCODE(opcode);
-          return;
+          c8_illegal(self, opcode);
+          break;
       }
       break;
     case 0x9:
@@ -351,8 +882,7 @@ void c8_step(Chip8 *self) {
       self->pc = (NNN(opcode) + self->v[0]) & 0xfff;
       break;
     case 0xc: {
-      char rnd;
-      getrandom(&rnd, 1, 0);
+      uint8_t rnd = c8_random(self);
       trace("v%hhx = 0x%hhx & 0x%hhx",
             VX(opcode),
             rnd,
@@ -372,6 +902,7 @@ void c8_step(Chip8 *self) {
       break;
     }
     case 0xe:
+      c8_clock_sync(self, pending);
       switch(opcode & 0xff) {
         case 0x9e:
           if(c8_key_pressed(self, self->v[VX(opcode)])) {
@@ -384,24 +915,29 @@ void c8_step(Chip8 *self) {
           }
           break;
         default:
-          CHIP8_ILLEGAL_OPCODE(opcode);
-          return;
+          c8_illegal(self, opcode);
+          break;
       }
       break;
     case 0xf:
       switch(opcode & 0xff) {
         case 0x07:
+          c8_clock_sync(self, pending);
           trace("v%hhx = dt(%hhu)", VX(opcode), self->dt);
           self->v[VX(opcode)] = self->dt;
           break;
         case 0x0a:
-          self->v[VX(opcode)] = c8_key_wait(self);
+          c8_clock_sync(self, pending);
+          trace("v%hhx = key", VX(opcode));
+          c8_key_wait(self, VX(opcode));
           break;
         case 0x15:
+          c8_clock_sync(self, pending);
           trace("dt = v%hhx(%hhu)", VX(opcode), self->v[VX(opcode)]);
           self->dt = self->v[VX(opcode)];
           break;
         case 0x18:
+          c8_clock_sync(self, pending);
           trace("st = v%hhx(%hhu)", VX(opcode), self->v[VX(opcode)]);
           self->st = self->v[VX(opcode)];
           break;
@@ -410,53 +946,27 @@ void c8_step(Chip8 *self) {
           self->i += (int8_t) self->v[VX(opcode)];
           break;
         case 0x29:
-          // TODO
+          trace("I = font(v%hhx(%hhu))", VX(opcode), self->v[VX(opcode)]);
+          self->i = FONT_ADDR + (self->v[VX(opcode)] & 0xf) * 5;
           break;
-        case 0x33: {
-          uint8_t l = self->v[VX(opcode)] % 10;
-          uint8_t m = self->v[VX(opcode)] / 10;
-          uint8_t h = m / 10;
-          trace("m[%hd] = %hhd, m[%hd+1] = %hhd, m[%hd+2] = %hhd, ",
-                self->i,
-                h,
-                self->i,
-                m % 10,
-                self->i,
-                l);
-          self->mem[self->i] = h;
-          self->mem[self->i+1] = m % 10;
-          self->mem[self->i+2] = l;
+        case 0x33:
+          c8_clock_sync(self, pending);
+          c8_bcd(self, VX(opcode));
           break;
-        }
         case 0x55:
-          if(MEM_SIZE - self->i < (VX(opcode) + 1)) {
-            warn("try to store %hhd registers at address %hx",
-                 VX(opcode) + 1,
-                 self->i);
-          } else {
-            trace("store v0-v%uux on I(0x%hx)",
-                  VX(opcode) + 1,
-                  self->i);
-            memcpy(self->mem + self->i, self->v, VX(opcode) + 1);
-            self->i += VX(opcode) + 1;
-          }
+          c8_clock_sync(self, pending);
+          c8_regs_store(self, VX(opcode));
           break;
         case 0x65:
-          if(MEM_SIZE - self->i < (VX(opcode) + 1)) {
-            warn("try to load %hhd registers from address %hx",
-                 VX(opcode) + 1,
-                 self->i);
-          } else {
-            trace("load v0-v%uux on I(0x%hx)",
-                  VX(opcode) + 1,
-                  self->i);
-            memcpy(self->v, self->mem + self->i, VX(opcode) + 1);
-            self->i += VX(opcode) + 1;
-          }
+          c8_regs_load(self, VX(opcode));
           break;
         default:
-          CHIP8_ILLEGAL_OPCODE(opcode);
-          return;
+          c8_clock_sync(self, pending);
+          if(c8_ext(self, opcode)) {
+            break;
+          }
+          c8_illegal(self, opcode);
+          break;
       }
       break;
     default:
@@ -464,18 +974,808 @@ void c8_step(Chip8 *self) {
       break;
   }
 
-  if(self->dirty) {
-    ui_flush(self->ui, self->fb);
-    self->dirty = false;
+  ++ *pending;
+  CHIP8_EXEC_END();
+}
+
+void c8_step(Chip8 *self) {
+  uint32_t pending = 0;
+
+  assert(self);
+
+  if(!self->in_frame) {
+    ui_poll_events(self->ui);
+  }
+  c8_exec(self, &pending);
+  if(self->dirty && !self->in_frame) {
+    c8_flush(self);
   }
+  c8_run_end(self, pending);
+}
 
-  CHIP8_EXEC_END();
+#ifdef ENABLE_THREADED_DISPATCH
+/**
+ * 不認得的 0x0/0xF opcodes 交給 c8_ext()，由它依 variant 決定是否 illegal
+ */
+static C8Handler c8_decode(OpCode opcode, bool xo) {
+  switch(opcode >> 12) {
+    case 0x0:
+      switch(opcode & 0xfff) {
+        case 0x0e0: return C8_OP_CLS;
+        case 0x0ee: return C8_OP_RET;
+        default: return C8_OP_EXT;
+      }
+    case 0x1: return C8_OP_JP;
+    case 0x2: return C8_OP_CALL;
+    case 0x3: return C8_OP_SE_VX_KK;
+    case 0x4: return C8_OP_SNE_VX_KK;
+    case 0x5: return xo && N(opcode) ? C8_OP_EXT : C8_OP_SE_VX_VY;
+    case 0x6: return C8_OP_LD_VX_KK;
+    case 0x7: return C8_OP_ADD_VX_KK;
+    case 0x8:
+      switch(opcode & 0xf) {
+        case 0x0: return C8_OP_LD_VX_VY;
+        case 0x1: return C8_OP_OR;
+        case 0x2: return C8_OP_AND;
+        case 0x3: return C8_OP_XOR;
+        case 0x4: return C8_OP_ADD_VX_VY;
+        case 0x5: return C8_OP_SUB;
+        case 0x6: return C8_OP_SHR;
+        case 0x7: return C8_OP_SUBN;
+        case 0xe: return C8_OP_SHL;
+        default: return C8_OP_ILLEGAL;
+      }
+    case 0x9: return C8_OP_SNE_VX_VY;
+    case 0xa: return C8_OP_LD_I;
+    case 0xb: return C8_OP_JP_V0;
+    case 0xc: return C8_OP_RND;
+    case 0xd: return C8_OP_DRW;
+    case 0xe:
+      switch(opcode & 0xff) {
+        case 0x9e: return C8_OP_SKP;
+        case 0xa1: return C8_OP_SKNP;
+        default: return C8_OP_ILLEGAL;
+      }
+    default:
+      switch(opcode & 0xff) {
+        case 0x07: return C8_OP_LD_VX_DT;
+        case 0x0a: return C8_OP_LD_VX_K;
+        case 0x15: return C8_OP_LD_DT;
+        case 0x18: return C8_OP_LD_ST;
+        case 0x1e: return C8_OP_ADD_I;
+        case 0x29: return C8_OP_LD_F;
+        case 0x33: return C8_OP_LD_B;
+        case 0x55: return C8_OP_LD_MEM_VX;
+        case 0x65: return C8_OP_LD_VX_MEM;
+        default: return C8_OP_EXT;
+      }
+  }
 }
 
-void c8_steps(Chip8 *self, int steps) {
-  for(; steps > 0; -- steps) {
+static inline C8Decoded c8_decoded(OpCode op, bool xo) {
+  return (C8Decoded) {
+    .handler = c8_decode(op, xo),
+    .x = VX(op),
+    .y = VY(op),
+    .kk = (op >> 12) == 0xd ? N(op) : KK(op),
+    .nnn = NNN(op),
+  };
+}
+
+/**
+ * 位址 a 的 opcode 由 mem[a] 及 mem[a + 1] 組成，寫到 byte b 只影響
+ * b & ~1 的 opcode
+ */
+void c8_code_update(C8Code *self, const uint8_t *mem, int addr, int len) {
+  int a = addr & ~1, end = addr + len;
+  if(end > STACK_ADDR) {
+    end = STACK_ADDR;
+  }
+  for(; a < end; a += 2) {
+    self->ops[a >> 1] = c8_decoded(mem[a] << 8 | mem[a + 1], self->xo);
+  }
+}
+
+C8Code *c8_code_new(const uint8_t *mem, bool xo) {
+  C8Code *self = calloc(1, sizeof(C8Code));
+  if(self) {
+    self->xo = xo;
+    c8_code_update(self, mem, 0, STACK_ADDR);
+  }
+  return self;
+}
+
+static inline void c8_code_mark(C8Code *self, int addr) {
+  if(!(addr & 1) && addr < STACK_ADDR) {
+    self->leaders[addr >> 7] |= 1ULL << (addr >> 1 & 63);
+  }
+}
+
+/**
+ * 把 [APP_ENTRY, end) 中每個偶數位址都當成 instruction，標出跳躍/呼叫
+ * 的目標及各種跳躍之後的位址。不追蹤可達性，資料被當成 instructions
+ * 時只是多幾個 leaders
+ */
+static void c8_code_leaders(C8Code *self, int end) {
+  int a;
+  memset(self->leaders, 0, sizeof(self->leaders));
+  c8_code_mark(self, APP_ENTRY);
+  for(a = APP_ENTRY; a + 1 < end; a += 2) {
+    const C8Decoded *d = &self->ops[a >> 1];
+    switch(d->handler) {
+      case C8_OP_JP:
+      case C8_OP_CALL:
+        c8_code_mark(self, d->nnn);
+        c8_code_mark(self, a + 2);
+        break;
+      case C8_OP_SE_VX_KK:
+      case C8_OP_SNE_VX_KK:
+      case C8_OP_SE_VX_VY:
+      case C8_OP_SNE_VX_VY:
+      case C8_OP_SKP:
+      case C8_OP_SKNP:
+        c8_code_mark(self, a + 2);
+        c8_code_mark(self, a + 4);
+        break;
+      case C8_OP_RET:
+      case C8_OP_JP_V0:
+        c8_code_mark(self, a + 2);
+        break;
+    }
+  }
+}
+
+/**
+ * cache 只存完全落在 ROM 中的 opcodes，奇數長度時最後一個 opcode 含有
+ * ROM 之後的 byte，一律當場解碼。小 ROM 不用 cache
+ */
+void c8_code_load(C8Code *self, const char *cache, const uint8_t *mem, int size) {
+  int end = APP_ENTRY + size < STACK_ADDR ? APP_ENTRY + size : STACK_ADDR;
+  if(size < C8_CODE_CACHE_MIN) {
+    cache = NULL;
+  }
+  self->cached = cache && c8_code_cache_load(self, cache, mem + APP_ENTRY, size);
+  if(self->cached) {
+    if(end & 1) {
+      c8_code_update(self, mem, end - 1, 1);
+    }
+    return;
+  }
+  c8_code_update(self, mem, APP_ENTRY, end - APP_ENTRY);
+  c8_code_leaders(self, end);
+  if(cache) {
+    c8_code_cache_store(self, cache, mem + APP_ENTRY, size);
+  }
+}
+
+/**
+ * 與 c8_exec() 語意相同，但從 C8Code 取出解好的 opcode，以 computed
+ * goto 串接各 handler。奇數 PC 或 PC 在 stack 之後時當場解碼。
+ * 跑完整段才推進 clock，SYNC() 同 c8_clock_sync()
+ */
+static void c8_steps_threaded(Chip8 *self, int steps) {
+  static const void *handlers[C8_OP_COUNT] = {
+    [C8_OP_ILLEGAL] = &&op_illegal,
+    [C8_OP_CLS] = &&op_cls,
+    [C8_OP_RET] = &&op_ret,
+    [C8_OP_JP] = &&op_jp,
+    [C8_OP_CALL] = &&op_call,
+    [C8_OP_SE_VX_KK] = &&op_se_vx_kk,
+    [C8_OP_SNE_VX_KK] = &&op_sne_vx_kk,
+    [C8_OP_SE_VX_VY] = &&op_se_vx_vy,
+    [C8_OP_LD_VX_KK] = &&op_ld_vx_kk,
+    [C8_OP_ADD_VX_KK] = &&op_add_vx_kk,
+    [C8_OP_LD_VX_VY] = &&op_ld_vx_vy,
+    [C8_OP_OR] = &&op_or,
+    [C8_OP_AND] = &&op_and,
+    [C8_OP_XOR] = &&op_xor,
+    [C8_OP_ADD_VX_VY] = &&op_add_vx_vy,
+    [C8_OP_SUB] = &&op_sub,
+    [C8_OP_SHR] = &&op_shr,
+    [C8_OP_SUBN] = &&op_subn,
+    [C8_OP_SHL] = &&op_shl,
+    [C8_OP_SNE_VX_VY] = &&op_sne_vx_vy,
+    [C8_OP_LD_I] = &&op_ld_i,
+    [C8_OP_JP_V0] = &&op_jp_v0,
+    [C8_OP_RND] = &&op_rnd,
+    [C8_OP_DRW] = &&op_drw,
+    [C8_OP_SKP] = &&op_skp,
+    [C8_OP_SKNP] = &&op_sknp,
+    [C8_OP_LD_VX_DT] = &&op_ld_vx_dt,
+    [C8_OP_LD_VX_K] = &&op_ld_vx_k,
+    [C8_OP_LD_DT] = &&op_ld_dt,
+    [C8_OP_LD_ST] = &&op_ld_st,
+    [C8_OP_ADD_I] = &&op_add_i,
+    [C8_OP_LD_F] = &&op_ld_f,
+    [C8_OP_LD_B] = &&op_ld_b,
+    [C8_OP_LD_MEM_VX] = &&op_ld_mem_vx,
+    [C8_OP_LD_VX_MEM] = &&op_ld_vx_mem,
+    [C8_OP_EXT] = &&op_ext,
+  };
+  OpCode opcode;
+  uint16_t pc;
+  const C8Decoded *d;
+  C8Decoded slow;
+  uint8_t *v = self->v;
+  const C8Decoded *ops = self->code->ops;
+  bool xo = self->code->xo;
+  // 上次 c8_clock_sync() 時的 steps，pending 就是 base - steps
+  int base = steps;
+
+#define DISPATCH() {                        \
+  CHIP8_EXEC_BEGIN();                       \
+  pc = self->pc;                            \
+  opcode = c8_fetch(self);                  \
+  if(pc < STACK_ADDR && !(pc & 1)) {        \
+    d = &ops[pc >> 1];                      \
+  } else {                                  \
+    slow = c8_decoded(opcode, xo);          \
+    d = &slow;                              \
+  }                                         \
+  goto *handlers[d->handler];               \
+}
+
+#define NEXT() {                            \
+  CHIP8_EXEC_END();                         \
+  if(-- steps <= 0) {                       \
+    goto done;                              \
+  }                                         \
+  DISPATCH();                               \
+}
+
+#define SYNC() {                            \
+  c8_clock_advance(self, base - steps);     \
+  base = steps;                             \
+}
+
+  if(steps <= 0) {
+    return;
+  }
+
+  DISPATCH();
+
+op_illegal:
+  c8_illegal(self, opcode);
+  NEXT();
+op_cls:
+  c8_fb_clear(self);
+  NEXT();
+op_ret:
+  c8_pop_pc(self);
+  NEXT();
+op_jp:
+  c8_jmp(self, d->nnn);
+  NEXT();
+op_call:
+  SYNC();
+  c8_push_pc(self);
+  c8_jmp(self, d->nnn);
+  NEXT();
+op_se_vx_kk:
+  if(v[d->x] == d->kk) {
+    c8_skip(self);
+  }
+  NEXT();
+op_sne_vx_kk:
+  if(v[d->x] != d->kk) {
+    c8_skip(self);
+  }
+  NEXT();
+op_se_vx_vy:
+  if(v[d->x] == v[d->y]) {
+    c8_skip(self);
+  }
+  NEXT();
+op_ld_vx_kk:
+  v[d->x] = d->kk;
+  NEXT();
+op_add_vx_kk:
+  v[d->x] += d->kk;
+  NEXT();
+op_ld_vx_vy:
+  v[d->x] = v[d->y];
+  NEXT();
+op_or:
+  v[d->x] |= v[d->y];
+  NEXT();
+op_and:
+  v[d->x] &= v[d->y];
+  NEXT();
+op_xor:
+  v[d->x] ^= v[d->y];
+  NEXT();
+op_add_vx_vy: {
+  uint16_t r = v[d->x] + v[d->y];
+  v[0xf] = r > 255;
+  v[d->x] = r;
+  NEXT();
+}
+op_sub: {
+  uint8_t r = v[d->x] - v[d->y];
+  v[0xf] = v[d->x] > v[d->y];
+  v[d->x] = r;
+  NEXT();
+}
+op_shr:
+  v[0xf] = v[d->x] & 0x1;
+  v[d->x] >>= 1;
+  NEXT();
+op_subn: {
+  uint8_t r = v[d->y] - v[d->x];
+  v[0xf] = v[d->y] > v[d->x];
+  v[d->x] = r;
+  NEXT();
+}
+op_shl:
+  v[0xf] = v[d->x] >> 7;
+  v[d->x] <<= 1;
+  NEXT();
+op_sne_vx_vy:
+  if(v[d->x] != v[d->y]) {
+    c8_skip(self);
+  }
+  NEXT();
+op_ld_i:
+  self->i = d->nnn;
+  NEXT();
+op_jp_v0:
+  self->pc = (d->nnn + v[0]) & 0xfff;
+  NEXT();
+op_rnd:
+  v[d->x] = c8_random(self) & d->kk;
+  NEXT();
+op_drw:
+  c8_fb_draw(self, v[d->x], v[d->y], d->kk);
+  NEXT();
+op_skp:
+  SYNC();
+  if(c8_key_pressed(self, v[d->x])) {
+    c8_skip(self);
+  }
+  NEXT();
+op_sknp:
+  SYNC();
+  if(!c8_key_pressed(self, v[d->x])) {
+    c8_skip(self);
+  }
+  NEXT();
+op_ld_vx_dt:
+  SYNC();
+  v[d->x] = self->dt;
+  NEXT();
+op_ld_vx_k:
+  SYNC();
+  c8_key_wait(self, d->x);
+  if(self->key_waiting) {
+    CHIP8_EXEC_END();
+    -- steps;
+    goto done;
+  }
+  NEXT();
+op_ld_dt:
+  SYNC();
+  self->dt = v[d->x];
+  NEXT();
+op_ld_st:
+  SYNC();
+  self->st = v[d->x];
+  NEXT();
+op_add_i:
+  self->i += (int8_t) v[d->x];
+  NEXT();
+op_ld_f:
+  self->i = FONT_ADDR + (v[d->x] & 0xf) * 5;
+  NEXT();
+op_ld_b:
+  SYNC();
+  c8_bcd(self, d->x);
+  NEXT();
+op_ld_mem_vx:
+  SYNC();
+  c8_regs_store(self, d->x);
+  NEXT();
+op_ld_vx_mem:
+  c8_regs_load(self, d->x);
+  NEXT();
+op_ext:
+  SYNC();
+  if(!c8_ext(self, opcode)) {
+    goto op_illegal;
+  }
+  NEXT();
+
+done:
+  c8_run_end(self, base - steps);
+
+#undef SYNC
+#undef NEXT
+#undef DISPATCH
+}
+#endif
+
+/**
+ * 停在 FX0A 時每次最多推進到下一個 tick，timer 照常遞減。等待的
+ * cycles 算成重覆執行 FX0A
+ */
+static void c8_key_idle(Chip8 *self, uint32_t n) {
+  if(c8_key_edges(self)) {
     c8_step(self);
+    return;
+  }
+  if(n > self->countdown) {
+    n = self->countdown;
+  }
+  C8_STAT_ADD(self, opcodes[0xf], n);
+  c8_run_end(self, n);
+}
+
+/**
+ * 不寫記憶體、不動 stack/timers、不取亂數的 opcodes，重覆執行的結果只
+ * 取決於 registers、DT 及 keys
+ */
+static bool c8_idle_op(OpCode op) {
+  switch(op >> 12) {
+    case 0x1: case 0x3: case 0x4: case 0x6: case 0x7: case 0xa: case 0xb:
+      return true;
+    case 0x5: case 0x9:
+      return N(op) == 0;
+    case 0x8:
+      return N(op) <= 0x7 || N(op) == 0xe;
+    case 0xe:
+      return KK(op) == 0x9e || KK(op) == 0xa1;
+    case 0xf:
+      return KK(op) == 0x07 || KK(op) == 0x1e;
+  }
+  return false;
+}
+
+/**
+ * 從目前的 PC 直接以 c8_exec() 試跑最多 C8_IDLE_MAX_OPS 個
+ * c8_idle_op()，不推進 clock，之後再還原 PC/I/V。回到同一個 PC 且
+ * registers 都沒變時就是沒有進展的 loop，回傳長度並把各 opcode 分類的
+ * 個數加到 ops；registers 有變時回傳負的長度。試跑時 DT 及 keys 都固定，
+ * 讀到它們時設 *timed
+ */
+static int c8_idle_loop(Chip8 *self, uint32_t *ops, bool *timed) {
+  uint16_t pc = self->pc, i = self->i;
+  uint8_t v[16];
+  uint32_t pending;
+  int n, len = 0;
+#ifdef ENABLE_STATS
+  uint64_t opcodes[16];
+  memcpy(opcodes, self->stats.opcodes, sizeof(opcodes));
+#endif
+
+  memcpy(v, self->v, sizeof(v));
+  for(n = 1; n <= C8_IDLE_MAX_OPS; ++ n) {
+    if(self->pc & 1 || self->pc + 1 >= self->mem_size) {
+      break;
+    }
+    OpCode op = self->mem[self->pc] << 8 | self->mem[self->pc + 1];
+    if(!c8_idle_op(op)) {
+      break;
+    }
+    ++ ops[op >> 12];
+    *timed |= (op >> 12) == 0xe || (op & 0xf0ff) == 0xf007;
+    // pending 維持 0，c8_clock_sync() 不會推進 clock
+    pending = 0;
+    c8_exec(self, &pending);
+    if(self->pc == pc) {
+      len = self->i == i && !memcmp(self->v, v, sizeof(v)) ? n : -n;
+      break;
+    }
   }
+
+  self->pc = pc;
+  self->i = i;
+  memcpy(self->v, v, sizeof(v));
+#ifdef ENABLE_STATS
+  memcpy(self->stats.opcodes, opcodes, sizeof(opcodes));
+#endif
+  return len;
+}
+
+/**
+ * 卡在 idle loop 時一次推進整數個 loop。有讀 DT 或 keys 的 loop 最多
+ * 到下一個 tick，每圈讀到的都與現在相同；其餘的 loop 與 timers 無關，
+ * 可以跨過 ticks。結果與逐一執行一樣，回傳推進的 cycles。
+ * 找到 loop 後馬上再檢查，沒找到時隔 idle_settle 個 cycles。tick 後
+ * 從 loop 中間開始試跑時，第一圈會讀到新的 DT，所以剛找到過 loop 時
+ * 只隔一圈就再試
+ */
+static uint32_t c8_idle_skip(Chip8 *self, uint32_t n) {
+  uint32_t ops[16] = { 0 };
+  bool timed = false;
+  int len = c8_idle_loop(self, ops, &timed);
+  if(len <= 0) {
+    self->idle_next = self->cycles + self->idle_settle;
+    if(len && self->idle_settle == C8_IDLE_SETTLE) {
+      self->idle_next = self->cycles - len;
+    }
+    if(self->idle_settle < C8_IDLE_SETTLE_MAX) {
+      self->idle_settle *= 2;
+    }
+    return 0;
+  }
+  self->idle_settle = C8_IDLE_SETTLE;
+  if((timed || self->rewind) && n > self->countdown) {
+    n = self->countdown;
+  }
+  uint32_t k = n / len;
+  if(!k) {
+    // 放不下一圈，照常執行到 tick 或 steps 結束再檢查
+    self->idle_next = self->cycles + n;
+    return 0;
+  }
+#ifdef ENABLE_STATS
+  int i;
+  for(i = 0; i < 16; ++ i) {
+    self->stats.opcodes[i] += ops[i] * k;
+  }
+#endif
+  self->idle_skipped += k * len;
+  c8_run_end(self, k * len);
+  self->idle_next = self->cycles;
+  return k * len;
+}
+
+static void c8_steps_engine(Chip8 *self, int steps) {
+#ifdef ENABLE_JIT
+  if(self->engine == C8_ENGINE_JIT) {
+    c8_jit_steps(self, steps);
+    return;
+  }
+#endif
+#ifdef ENABLE_THREADED_DISPATCH
+  if(self->engine == C8_ENGINE_THREADED) {
+    c8_steps_threaded(self, steps);
+    return;
+  }
+#endif
+  uint32_t pending = 0;
+  for(; steps > 0 && !self->key_waiting; -- steps) {
+    c8_exec(self, &pending);
+  }
+  c8_run_end(self, pending);
+}
+
+/**
+ * engine 遇到 FX0A 等待時提早返回，剩下的 cycles 交給 c8_key_idle()。
+ * 不在 c8_run_frame() 中時，開始前處理 UI events，結束才 flush。
+ * cycles 到 idle_next 時檢查是否卡在 idle loop，見 c8_idle_skip()
+ */
+void c8_steps(Chip8 *self, int steps) {
+  assert(self);
+  uint64_t end = self->cycles + (steps > 0 ? steps : 0);
+  if(!self->in_frame) {
+    ui_poll_events(self->ui);
+  }
+  while(self->cycles < end) {
+    uint32_t left = end - self->cycles;
+    if(self->key_waiting) {
+      c8_key_idle(self, left);
+      continue;
+    }
+    if(self->cycles >= self->idle_next && c8_idle_skip(self, left)) {
+      continue;
+    }
+    // engines 可以跨過 ticks，只有 rewind 的 snapshots 要拍在 tick 上
+    uint32_t n = left;
+    if(self->rewind && n > self->countdown) {
+      n = self->countdown;
+    }
+    if(self->idle_next - self->cycles < n) {
+      n = self->idle_next - self->cycles;
+    }
+    c8_steps_engine(self, n);
+  }
+  if(self->dirty && !self->in_frame) {
+    c8_flush(self);
+  }
+}
+
+/**
+ * 按鍵只在 tick 時取樣，兩個 ticks 之間 keys 不變。journal 記下 tick
+ * 時的變化及當時的 cycles，replay 在同一個 tick 套用，結果就完全相同
+ */
+static void c8_input_tick(Chip8 *self) {
+  if(self->replay) {
+    c8_journal_replay(self->journal, self->cycles, &self->keys);
+    return;
+  }
+  ui_poll_events(self->ui);
+  if(!self->journal) {
+    self->keys_stale = true;
+    return;
+  }
+  uint16_t keys = c8_ui_keys(self);
+  if(keys != self->keys) {
+    c8_journal_keys(self->journal, self->cycles, keys);
+  }
+  self->keys = keys;
+}
+
+/**
+ * DT/ST 減一、取樣按鍵，並算出下一個 60Hz tick 前還有幾個 cycles
+ */
+void c8_timer_tick(Chip8 *self) {
+  if(self->dt) {
+    -- self->dt;
+  }
+  if(self->st) {
+    -- self->st;
+  }
+  ++ self->frames;
+  c8_input_tick(self);
+  self->snapshot_due = self->rewind != NULL;
+  self->countdown = ((self->frames + 1) * self->clock + C8_FRAME_RATE - 1) / C8_FRAME_RATE
+                    - self->cycles;
+}
+
+void c8_run_frame(Chip8 *self, int cycles_per_frame) {
+  assert(self);
+
+  if(cycles_per_frame <= 0) {
+    cycles_per_frame = self->countdown;
+  }
+
+  self->in_frame = true;
+  c8_steps(self, cycles_per_frame);
+  self->in_frame = false;
+  if(self->dirty) {
+    c8_flush(self);
+  }
+}
+
+void c8_sync(Chip8 *self) {
+  int64_t now, due;
+
+  assert(self);
+
+  // 等 FX0A 且 timers 都停了，畫面與狀態都不會變，睡到有 event 為止
+  // (最多 C8_IDLE_WAIT_NS)，之後重新對齊 wall clock
+  if(self->key_waiting && !self->dt && !self->st) {
+    ui_wait_events(self->ui, C8_IDLE_WAIT_NS);
+    self->sync_ns = 0;
+    return;
+  }
+
+  now = now_ns();
+  due = self->sync_ns + (int64_t) (self->frames - self->sync_frames) * 1000000000LL / C8_FRAME_RATE;
+  // 第一次或落後太多 (例如被 debugger 停住) 時重新對齊，不追趕
+  if(!self->sync_ns || now - due > 100000000LL) {
+    self->sync_ns = now;
+    self->sync_frames = self->frames;
+    return;
+  }
+
+  if(due > now && self->key_waiting) {
+    // timers 還在跑，有按鍵就提早回來
+    ui_wait_events(self->ui, due - now);
+  } else if(due > now) {
+    struct timespec ts = {
+      .tv_sec = due / 1000000000LL,
+      .tv_nsec = due % 1000000000LL,
+    };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+  }
+}
+
+/**
+ * splitmix64 把 64-bit seed 展開成 xoshiro256** 的 256-bit 狀態，
+ * 狀態不會全為 0
+ */
+void c8_seed(Chip8 *self, uint64_t seed) {
+  assert(self);
+  int i;
+  if(!seed && getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+    seed = (uint64_t) time(NULL) ^ (uintptr_t) self;
+  }
+  self->seed = seed;
+  for(i = 0; i < 4; ++ i) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    self->rnd[i] = z ^ (z >> 31);
+  }
+}
+
+inline uint64_t c8_cycles(Chip8 *self) {
+  assert(self);
+  return self->cycles;
+}
+
+inline uint64_t c8_frames(Chip8 *self) {
+  assert(self);
+  return self->frames;
+}
+
+inline uint64_t c8_illegals(Chip8 *self) {
+  assert(self);
+  return self->illegals;
+}
+
+bool c8_stats(Chip8 *self, Chip8Stats *stats) {
+  assert(self);
+  assert(stats);
+#ifdef ENABLE_STATS
+  *stats = self->stats;
+#else
+  memset(stats, 0, sizeof(Chip8Stats));
+#endif
+  stats->instructions = self->cycles;
+  stats->illegals = self->illegals;
+  stats->ticks = self->frames;
+  stats->idle_skipped = self->idle_skipped;
+  stats->wall_ns = now_ns() - self->created_ns;
+#ifdef ENABLE_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline const uint8_t *c8_fb(Chip8 *self) {
+  assert(self);
+  return self->fb[0];
+}
+
+const uint8_t *c8_fb_plane(Chip8 *self, int plane) {
+  assert(self);
+  assert(plane >= 0 && plane < FB_PLANES);
+  return self->fb[plane];
+}
+
+int c8_fb_width(Chip8 *self) {
+  assert(self);
+  return c8_fb_w(self);
+}
+
+int c8_fb_height(Chip8 *self) {
+  assert(self);
+  return c8_fb_h(self);
+}
+
+uint64_t c8_fb_hash(Chip8 *self) {
+  assert(self);
+  int size = c8_fb_w(self) * c8_fb_h(self) / 8;
+  int planes = self->variant == C8_VARIANT_XOCHIP ? 2 : 1;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  int p, i;
+  for(p = 0; p < planes; ++ p) {
+    for(i = 0; i < size; ++ i) {
+      h = (h ^ self->fb[p][i]) * 0x100000001b3ULL;
+    }
+  }
+  return h;
+}
+
+void c8_journal_end(Chip8 *self) {
+  assert(self);
+  if(self->journal && !self->replay) {
+    c8_journal_close(self->journal, self->cycles, c8_fb_hash(self));
+  }
+}
+
+bool c8_replay_end(Chip8 *self, uint64_t *cycles, uint64_t *fb_hash) {
+  assert(self);
+  assert(cycles);
+  assert(fb_hash);
+  return self->replay && c8_journal_end_of(self->journal, cycles, fb_hash);
+}
+
+Chip8Engine c8_engine(Chip8 *self) {
+  assert(self);
+  return self->engine;
+}
+
+bool c8_code_cached(Chip8 *self) {
+  assert(self);
+#ifdef ENABLE_THREADED_DISPATCH
+  return self->code && self->code->cached;
+#else
+  return false;
+#endif
 }
 
 void c8_dump(Chip8 *self) {
@@ -524,15 +1824,25 @@ inline int8_t c8_st(Chip8 *self) {
   return self->st;
 }
 
+int c8_mem_size(Chip8 *self) {
+  assert(self);
+  return self->mem_size;
+}
+
+int c8_user_size(Chip8 *self) {
+  assert(self);
+  return self->variant == C8_VARIANT_XOCHIP ? XO_USER_SIZE : USER_SIZE;
+}
+
 inline uint8_t c8_mem8(Chip8 *self, int addr) {
   assert(self);
-  assert(addr >= 0 && addr < MEM_SIZE);
+  assert(addr >= 0 && addr < (int) self->mem_size);
   return *(uint8_t *)(self->mem + addr);
 }
 
 inline uint16_t c8_mem16(Chip8 *self, int addr) {
   assert(self);
-  assert(addr >= 0 && addr < MEM_SIZE && (addr % 2 == 0));
+  assert(addr >= 0 && addr < (int) self->mem_size && (addr % 2 == 0));
   return (self->mem[addr] << 8) | self->mem[addr + 1];
 }
 
@@ -0,0 +1,197 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+
+/*
+ * entry 是 dir 下的 <ROM 的 c8_hash()>[-xo].c8code，只給同一台機器上的
+ * processes 共用，數字都是 native byte order
+ *
+ *   header:  C8CodeCacheHeader
+ *   rom:     size bytes，與要載入的 ROM 逐 byte 比對，hash 碰撞也不會誤用
+ *   ops:     APP_ENTRY 起完全落在 ROM 中 (且在 STACK_ADDR 之前) 的 C8Decoded
+ *   leaders: C8Code.leaders
+ *
+ * checksum 是 rom 之後所有 bytes 的 c8_hash()。版本、handlers 個數或
+ * C8Decoded 大小不同的是舊版寫的，長度或 checksum 不對的是損壞的，
+ * 都當作沒有 entry，分析完再整個覆寫
+ */
+#define C8_CODE_CACHE_MAGIC "C8DC"
+// C8Decoded 的內容或 handlers 的編號改變時加一
+#define C8_CODE_CACHE_VERSION (1)
+
+typedef struct _C8CodeCacheHeader C8CodeCacheHeader;
+
+struct _C8CodeCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t size;
+  uint16_t handlers;
+  uint8_t decoded;
+  uint8_t xo;
+  uint64_t checksum;
+};
+
+// ROM 中完整的 opcodes 個數
+static int cache_ops(int size) {
+  int end = APP_ENTRY + size < STACK_ADDR ? APP_ENTRY + size : STACK_ADDR;
+  return (end - APP_ENTRY) / 2;
+}
+
+static size_t cache_size(int size) {
+  return sizeof(C8CodeCacheHeader) +
+         size +
+         sizeof(C8Decoded) * cache_ops(size) +
+         sizeof(((C8Code *) 0)->leaders);
+}
+
+static bool cache_path(char *path, const char *dir, const uint8_t *rom, int size, bool xo) {
+  int n = snprintf(path,
+                   PATH_MAX,
+                   "%s/%016llx%s.c8code",
+                   dir,
+                   (unsigned long long) c8_hash(rom, size),
+                   xo ? "-xo" : "");
+  return n > 0 && n < PATH_MAX;
+}
+
+static bool cache_valid(const uint8_t *data, bool xo, const uint8_t *rom, int size) {
+  C8CodeCacheHeader h;
+  memcpy(&h, data, sizeof(h));
+  if(memcmp(h.magic, C8_CODE_CACHE_MAGIC, 4) ||
+     h.version != C8_CODE_CACHE_VERSION ||
+     h.handlers != C8_OP_COUNT ||
+     h.decoded != sizeof(C8Decoded)) {
+    return false;
+  }
+  if(h.xo != xo || h.size != (uint32_t) size) {
+    return false;
+  }
+  const uint8_t *payload = data + sizeof(h) + size;
+  if(memcmp(data + sizeof(h), rom, size)) {
+    return false;
+  }
+  return h.checksum == c8_hash(payload, cache_size(size) - sizeof(h) - size);
+}
+
+bool c8_code_cache_load(C8Code *self, const char *dir, const uint8_t *rom, int size) {
+  assert(self);
+  assert(dir);
+  char path[PATH_MAX];
+  if(!cache_path(path, dir, rom, size, self->xo)) {
+    return false;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) {
+    trace("code cache miss: %s", path);
+    return false;
+  }
+
+  struct stat st;
+  size_t len = cache_size(size);
+  void *data = MAP_FAILED;
+  if(!fstat(fd, &st) && st.st_size == (off_t) len) {
+    data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(data == MAP_FAILED) {
+    debug("ignore code cache %s: size %lld", path, (long long) st.st_size);
+    return false;
+  }
+
+  bool valid = cache_valid(data, self->xo, rom, size);
+  if(valid) {
+    const uint8_t *p = (const uint8_t *) data + sizeof(C8CodeCacheHeader) + size;
+    int n = cache_ops(size);
+    memcpy(&self->ops[APP_ENTRY >> 1], p, sizeof(C8Decoded) * n);
+    memcpy(self->leaders, p + sizeof(C8Decoded) * n, sizeof(self->leaders));
+    trace("code cache hit: %s", path);
+  } else {
+    debug("ignore stale or corrupt code cache %s", path);
+  }
+  munmap(data, len);
+  return valid;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len) {
+  while(len) {
+    ssize_t n = write(fd, data, len);
+    if(n == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * 先寫到同一個目錄的暫存檔再 rename()，同時載入的 processes 只會看到
+ * 完整的 entry。同一個 ROM 同時寫入時內容相同，誰最後 rename() 都一樣
+ */
+void c8_code_cache_store(const C8Code *self, const char *dir, const uint8_t *rom, int size) {
+  assert(self);
+  assert(dir);
+  char path[PATH_MAX], temp[PATH_MAX];
+  if(!cache_path(path, dir, rom, size, self->xo) ||
+     snprintf(temp, PATH_MAX, "%s.XXXXXX", path) >= PATH_MAX) {
+    return;
+  }
+
+  size_t len = cache_size(size);
+  uint8_t *data = malloc(len);
+  if(!data) {
+    return;
+  }
+  C8CodeCacheHeader h = {
+    .version = C8_CODE_CACHE_VERSION,
+    .size = size,
+    .handlers = C8_OP_COUNT,
+    .decoded = sizeof(C8Decoded),
+    .xo = self->xo,
+  };
+  memcpy(h.magic, C8_CODE_CACHE_MAGIC, 4);
+  int n = cache_ops(size);
+  uint8_t *p = data + sizeof(h);
+  memcpy(p, rom, size);
+  p += size;
+  memcpy(p, &self->ops[APP_ENTRY >> 1], sizeof(C8Decoded) * n);
+  memcpy(p + sizeof(C8Decoded) * n, self->leaders, sizeof(self->leaders));
+  h.checksum = c8_hash(p, len - sizeof(h) - size);
+  memcpy(data, &h, sizeof(h));
+
+  if(mkdir(dir, 0755) && errno != EEXIST) {
+    warn("unable to create code cache %s: %s", dir, strerror(errno));
+    free(data);
+    return;
+  }
+  int fd = mkstemp(temp);
+  if(fd == -1) {
+    warn("unable to write code cache %s: %s", temp, strerror(errno));
+    free(data);
+    return;
+  }
+  bool ok = !fchmod(fd, 0644) && write_all(fd, data, len);
+  ok = !close(fd) && ok;
+  if(!ok || rename(temp, path)) {
+    warn("unable to write code cache %s: %s", path, strerror(errno));
+    unlink(temp);
+  } else {
+    trace("code cache store: %s, %zu bytes", path, len);
+  }
+  free(data);
+}
@@ -0,0 +1,84 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t v) {
+  while(v >= 0x80) {
+    *p ++ = v | 0x80;
+    v >>= 7;
+  }
+  *p ++ = v;
+  return p;
+}
+
+/**
+ * 超過 end 或超過 5 bytes 時回傳 NULL
+ */
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t *v) {
+  int shift = 0;
+  *v = 0;
+  do {
+    if(p == end || shift > 28) {
+      return NULL;
+    }
+    *v |= (uint32_t) (*p & 0x7f) << shift;
+    shift += 7;
+  } while(*p ++ & 0x80);
+  return p;
+}
+
+uint32_t c8_delta_encode(const uint8_t *a, const uint8_t *b, uint32_t n, uint8_t *out) {
+  uint8_t *p = out;
+  uint32_t i = 0, last = 0;
+  while(i < n) {
+    // 大部份的 bytes 都沒變，8 bytes 一次跳過
+    while(i + 8 <= n) {
+      uint64_t x, y;
+      memcpy(&x, a + i, 8);
+      memcpy(&y, b + i, 8);
+      if(x != y) {
+        break;
+      }
+      i += 8;
+    }
+    while(i < n && a[i] == b[i]) {
+      ++ i;
+    }
+    if(i == n) {
+      break;
+    }
+
+    uint32_t start = i;
+    while(i < n && a[i] != b[i]) {
+      ++ i;
+    }
+    p = put_varint(p, start - last);
+    p = put_varint(p, i - start);
+    for(; start < i; ++ start) {
+      *p ++ = a[start] ^ b[start];
+    }
+    last = i;
+  }
+  return p - out;
+}
+
+bool c8_delta_apply(uint8_t *state, uint32_t n, const uint8_t *data, uint32_t len) {
+  const uint8_t *p = data, *end = data + len;
+  uint32_t skip, run, off = 0;
+  while(p < end) {
+    if(!(p = get_varint(p, end, &skip)) || !(p = get_varint(p, end, &run))) {
+      return false;
+    }
+    if(skip > n - off || run > n - off - skip || run > (uint32_t) (end - p)) {
+      return false;
+    }
+    off += skip;
+    while(run --) {
+      state[off ++] ^= *p ++;
+    }
+  }
+  return true;
+}
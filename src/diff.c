@@ -0,0 +1,306 @@
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+#include "chip8-diff.h"
+
+typedef struct _C8DiffField C8DiffField;
+
+/**
+ * 逐欄比對的 guest 欄位，elem 是陣列元素的大小，純量為 0
+ */
+struct _C8DiffField {
+  const char *name;
+  size_t offset;
+  size_t size;
+  size_t elem;
+};
+
+#define FIELD(f) { #f, offsetof(Chip8, f), sizeof(((Chip8 *) 0)->f), 0 }
+#define ARRAY(f) { #f, offsetof(Chip8, f), sizeof(((Chip8 *) 0)->f), sizeof(((Chip8 *) 0)->f[0]) }
+
+static const C8DiffField fields[] = {
+  FIELD(pc),
+  FIELD(sp),
+  FIELD(i),
+  FIELD(dt),
+  FIELD(st),
+  ARRAY(v),
+  FIELD(cycles),
+  FIELD(frames),
+  FIELD(countdown),
+  ARRAY(rnd),
+  FIELD(key_waiting),
+  FIELD(keys_held),
+  FIELD(keys),
+  FIELD(hires),
+  FIELD(plane_mask),
+  ARRAY(rpl),
+  // 兩個 planes 連續，index 是 plane * FB_PLANE_SIZE + offset
+  { "fb", offsetof(Chip8, fb), sizeof(((Chip8 *) 0)->fb), 1 },
+  // mem 依 variant 配置，size 0 表示比到 stack 結尾 (見 diff_compare())
+  { "mem", offsetof(Chip8, mem), 0, 1 },
+};
+
+#undef FIELD
+#undef ARRAY
+
+struct _Chip8Diff {
+  Chip8 *vm[2];
+  int interval;
+  // 距離上一個比對點執行過的 instructions
+  int pending;
+  uint64_t checks;
+  uint64_t hash;
+  // 上一個比對點兩邊相同時的 guest 狀態
+  uint8_t *snapshot[2];
+  uint64_t idle_next[2];
+  uint32_t idle_settle[2];
+  bool diverged;
+  Chip8Divergence divergence;
+};
+
+/**
+ * 第一個不同的欄位，相同 (hash 不同只是 padding 或碰撞) 時回傳 NULL
+ */
+static const C8DiffField *diff_compare(Chip8 *a, Chip8 *b, int *index) {
+  size_t f;
+  for(f = 0; f < sizeof(fields) / sizeof(fields[0]); ++ f) {
+    const uint8_t *pa = (const uint8_t *) a + fields[f].offset;
+    const uint8_t *pb = (const uint8_t *) b + fields[f].offset;
+    size_t size = fields[f].size;
+    if(!size) {
+      uint32_t sa = c8_state_size(a), sb = c8_state_size(b);
+      size = (sa < sb ? sa : sb) + C8_STATE_OFFSET - fields[f].offset;
+    }
+    if(!memcmp(pa, pb, size)) {
+      continue;
+    }
+    *index = -1;
+    if(fields[f].elem) {
+      size_t i;
+      for(i = 0; !memcmp(pa + i, pb + i, fields[f].elem); i += fields[f].elem);
+      *index = i / fields[f].elem;
+    }
+    return &fields[f];
+  }
+  return NULL;
+}
+
+static void diff_snapshot(Chip8Diff *self) {
+  int s;
+  for(s = 0; s < 2; ++ s) {
+    memcpy(self->snapshot[s], c8_state(self->vm[s]), c8_state_size(self->vm[s]));
+    self->idle_next[s] = self->vm[s]->idle_next;
+    self->idle_settle[s] = self->vm[s]->idle_settle;
+  }
+}
+
+/**
+ * 與 c8_rewind() 一樣整個 mem 都算寫過，replay 的 journal 也要倒回去
+ */
+static void diff_restore(Chip8Diff *self) {
+  int s;
+  for(s = 0; s < 2; ++ s) {
+    Chip8 *vm = self->vm[s];
+    memcpy(c8_state(vm), self->snapshot[s], c8_state_size(vm));
+    vm->idle_next = self->idle_next[s];
+    vm->idle_settle = self->idle_settle[s];
+    vm->dirty = ~0ULL;
+    c8_mem_written(vm, 0, vm->mem_size);
+    if(vm->replay) {
+      c8_journal_seek(vm->journal, vm->cycles);
+    }
+  }
+}
+
+/**
+ * 從 snapshot 各執行 n 個 instructions，n 個一起跑，與發現差異時的
+ * 執行方式相同
+ */
+static const C8DiffField *diff_probe(Chip8Diff *self, int n, int *index) {
+  diff_restore(self);
+  if(n) {
+    c8_steps(self->vm[0], n);
+    c8_steps(self->vm[1], n);
+  }
+  return diff_compare(self->vm[0], self->vm[1], index);
+}
+
+/**
+ * snapshot 後 pending 個 instructions 內兩邊變得不同。二分找出最少要
+ * 執行幾個才會不同，最後一個就是分歧的 instruction，結束時兩邊停在
+ * 剛分歧之後。從 snapshot 重跑不出差異 (例如只有沒清掉的舊 translated
+ * code 才會錯) 時，回報 snapshot 的位置及原本看到的欄位
+ */
+static void diff_locate(Chip8Diff *self) {
+  int lo = 0, hi = self->pending, index;
+  const C8DiffField *field = diff_compare(self->vm[0], self->vm[1], &index);
+  assert(field);
+
+  if(hi && diff_probe(self, hi, &index)) {
+    while(hi - lo > 1) {
+      int mid = lo + (hi - lo) / 2;
+      if(diff_probe(self, mid, &index)) {
+        hi = mid;
+      } else {
+        lo = mid;
+      }
+    }
+    diff_probe(self, hi - 1, &index);
+  } else if(hi) {
+    warn("%s", "divergence does not reproduce from the last snapshot");
+    diff_restore(self);
+    hi = 0;
+  }
+
+  // ref 執行分歧的 instruction 之前
+  Chip8 *ref = self->vm[0];
+  self->divergence.cycles = ref->cycles;
+  self->divergence.pc = ref->pc;
+  self->divergence.opcode = c8_mem16(ref, ref->pc);
+  if(hi) {
+    field = diff_probe(self, hi, &index);
+  }
+  self->divergence.field = field->name;
+  self->divergence.index = index;
+  self->diverged = true;
+  warn("engines diverge at 0x%03x (%04x), cycles %llu, %s[%d]",
+       self->divergence.pc,
+       self->divergence.opcode,
+       (unsigned long long) self->divergence.cycles,
+       field->name,
+       index);
+}
+
+bool c8diff_check(Chip8Diff *self) {
+  assert(self);
+  if(self->diverged) {
+    return false;
+  }
+
+  ++ self->checks;
+  // 碰撞時頂多晚一個 interval 才發現
+  uint64_t h0 = c8_hash(c8_state(self->vm[0]), c8_state_size(self->vm[0]));
+  uint64_t h1 = c8_hash(c8_state(self->vm[1]), c8_state_size(self->vm[1]));
+  int index;
+  if(h0 != h1 && diff_compare(self->vm[0], self->vm[1], &index)) {
+    diff_locate(self);
+    return false;
+  }
+  self->hash = (self->hash ^ h0) * C8_HASH_MUL;
+  self->pending = 0;
+  diff_snapshot(self);
+  return true;
+}
+
+Chip8Diff *c8diff_new(const Chip8Options *ref, const Chip8Options *test, int interval) {
+  assert(ref);
+  assert(test);
+  Chip8Diff *self = calloc(1, sizeof(Chip8Diff));
+  if(!self) {
+    fatal("%s", "out of memory");
+  }
+  self->interval = interval > 0 ? interval : C8_DIFF_INTERVAL_DEFAULT;
+
+  const Chip8Options *options[2] = { ref, test };
+  int s;
+  for(s = 0; s < 2; ++ s) {
+    Chip8Options o = *options[s];
+    if(o.ui != UI_REPLAY) {
+      o.ui = UI_NULL;
+      o.journal = NULL;
+    }
+    o.rewind_frames = 0;
+    self->vm[s] = c8_new_with_options(&o);
+    if(!self->vm[s]) {
+      int err = errno;
+      c8diff_free(self);
+      errno = err;
+      return NULL;
+    }
+    self->snapshot[s] = malloc(c8_state_size(self->vm[s]));
+    if(!self->snapshot[s]) {
+      fatal("%s", "out of memory");
+    }
+  }
+  // seed 0 時兩邊各自 getrandom()，test 改用 ref 實際的 seed
+  if(!test->seed && test->ui != UI_REPLAY) {
+    c8_seed(self->vm[1], self->vm[0]->seed);
+  }
+  trace("c8diff_new(): %p, engines %d/%d, interval %d",
+        self,
+        c8_engine(self->vm[0]),
+        c8_engine(self->vm[1]),
+        self->interval);
+  return self;
+}
+
+void c8diff_free(Chip8Diff *self) {
+  if(!self) {
+    return;
+  }
+  int s;
+  for(s = 0; s < 2; ++ s) {
+    c8_free(self->vm[s]);
+    free(self->snapshot[s]);
+  }
+  free(self);
+}
+
+void c8diff_load(Chip8Diff *self, const uint8_t *app, int size) {
+  assert(self);
+  c8_load(self->vm[0], app, size);
+  c8_load(self->vm[1], app, size);
+}
+
+Chip8 *c8diff_vm(Chip8Diff *self, int side) {
+  assert(self);
+  assert(side == 0 || side == 1);
+  return self->vm[side];
+}
+
+bool c8diff_steps(Chip8Diff *self, int steps) {
+  assert(self);
+  if(self->diverged) {
+    return false;
+  }
+  // 第一次執行前的狀態就是第一個 snapshot
+  if(!self->checks && !self->pending && !c8diff_check(self)) {
+    return false;
+  }
+  while(steps > 0) {
+    int n = self->interval - self->pending;
+    if(n > steps) {
+      n = steps;
+    }
+    c8_steps(self->vm[0], n);
+    c8_steps(self->vm[1], n);
+    self->pending += n;
+    steps -= n;
+    if(self->pending == self->interval && !c8diff_check(self)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const Chip8Divergence *c8diff_divergence(Chip8Diff *self) {
+  assert(self);
+  return self->diverged ? &self->divergence : NULL;
+}
+
+uint64_t c8diff_checks(Chip8Diff *self) {
+  assert(self);
+  return self->checks;
+}
+
+uint64_t c8diff_hash(Chip8Diff *self) {
+  assert(self);
+  return self->hash;
+}
@@ -0,0 +1,586 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+
+#define JIT_CACHE_SIZE (1 << 20)
+#define JIT_MAX_OPS (64)
+#define JIT_MAX_OP_BYTES (32)
+// budget 檢查 20 bytes，每個 opcode 分類的 stats 8 bytes
+#define JIT_PROLOGUE_BYTES (20 + 16 * 8)
+// 最多兩個 exits，各 12 bytes
+#define JIT_MAX_BLOCK_BYTES (JIT_PROLOGUE_BYTES + JIT_MAX_OPS * JIT_MAX_OP_BYTES + 32)
+#define JIT_MAX_BLOCKS (MEM_SIZE / 2)
+
+#define OFF_V(x) (offsetof(Chip8, v) + (x))
+#define OFF_I offsetof(Chip8, i)
+#define OFF_PC offsetof(Chip8, pc)
+#define OFF_SP offsetof(Chip8, sp)
+#define OFF_DT offsetof(Chip8, dt)
+#define OFF_ST offsetof(Chip8, st)
+// XO-CHIP 不走 JIT，stack 固定在 STACK_ADDR
+#define OFF_STACK (offsetof(Chip8, mem) + STACK_ADDR)
+#ifdef ENABLE_STATS
+#define OFF_OPCODES(x) (offsetof(Chip8, stats.opcodes) + (x) * sizeof(uint64_t))
+#endif
+
+/**
+ * budget 是還能執行的 instructions，回傳剩下的 budget。block 可以直接
+ * jmp 到下一個 block，一次呼叫可能執行好幾個 blocks
+ */
+typedef int (*C8BlockFunc)(Chip8 *vm, int budget);
+
+typedef struct _C8Block C8Block;
+
+typedef struct _C8Exit C8Exit;
+
+/**
+ * 目的地固定的出口: pc = target 後返回。target 的 block 翻譯好後，開頭
+ * 5 bytes 改成 jmp 到該 block
+ */
+struct _C8Exit {
+  uint8_t *at;
+  uint16_t target;
+  // 已接上的 block，NULL 表示返回 c8_jit_steps()
+  C8Block *to;
+};
+
+struct _C8Block {
+  C8BlockFunc code;
+  uint16_t start;
+  // 不含
+  uint16_t end;
+  // 0 表示 start 的 opcode 無法轉譯，交給 interpreter
+  uint16_t n;
+  // 含 FX07/FX15/FX18，不能跨過 60Hz tick，只從 c8_jit_steps() 進入
+  bool timers;
+  uint8_t nexits;
+  C8Exit exits[2];
+};
+
+struct _C8Jit {
+  uint8_t *cache;
+  size_t used;
+  int nblocks;
+  C8Block *map[MEM_SIZE / 2];
+  C8Block blocks[JIT_MAX_BLOCKS];
+  // 被 live block 涵蓋的 guest bytes
+  uint8_t code_map[MEM_SIZE / 8];
+};
+
+typedef enum _JitEmit JitEmit;
+
+enum _JitEmit {
+  JIT_UNSUPPORTED,
+  JIT_CONTINUE,
+  JIT_TERMINATE,
+};
+
+/*
+ * x86-64 encoders, vm 指標固定在 rdi，只用 caller-saved 的 eax/ecx/edx
+ */
+
+static inline void emit8(uint8_t **p, uint8_t b) {
+  *(*p) ++ = b;
+}
+
+static inline void emit16(uint8_t **p, uint16_t w) {
+  memcpy(*p, &w, 2);
+  *p += 2;
+}
+
+static inline void emit32(uint8_t **p, uint32_t d) {
+  memcpy(*p, &d, 4);
+  *p += 4;
+}
+
+// <op> reg8/16, [rdi + disp32]
+static inline void emit_rdi(uint8_t **p, uint8_t reg, uint32_t disp) {
+  emit8(p, 0x80 | (reg << 3) | 0x7);
+  emit32(p, disp);
+}
+
+#define AL (0)
+#define CL (1)
+#define DL (2)
+
+// mov r8, [rdi + disp]
+static void emit_load8(uint8_t **p, uint8_t reg, uint32_t disp) {
+  emit8(p, 0x8a);
+  emit_rdi(p, reg, disp);
+}
+
+// mov [rdi + disp], r8
+static void emit_store8(uint8_t **p, uint32_t disp, uint8_t reg) {
+  emit8(p, 0x88);
+  emit_rdi(p, reg, disp);
+}
+
+// mov byte [rdi + disp], imm8
+static void emit_store8_imm(uint8_t **p, uint32_t disp, uint8_t imm) {
+  emit8(p, 0xc6);
+  emit_rdi(p, 0, disp);
+  emit8(p, imm);
+}
+
+// mov word [rdi + disp], imm16
+static void emit_store16_imm(uint8_t **p, uint32_t disp, uint16_t imm) {
+  emit8(p, 0x66);
+  emit8(p, 0xc7);
+  emit_rdi(p, 0, disp);
+  emit16(p, imm);
+}
+
+static void emit_set_pc(uint8_t **p, uint16_t pc) {
+  emit_store16_imm(p, OFF_PC, pc);
+}
+
+// mov eax, esi; ret，回傳剩下的 budget
+static void emit_ret(uint8_t **p) {
+  emit8(p, 0x89); emit8(p, 0xf0);
+  emit8(p, 0xc3);
+}
+
+// 共 12 bytes，見 C8Exit
+static void emit_exit(uint8_t **p, C8Block *block, uint16_t target) {
+  block->exits[block->nexits ++] = (C8Exit){ .at = *p, .target = target };
+  emit_set_pc(p, target);
+  emit_ret(p);
+}
+
+/**
+ * pc = addr + 2, 條件成立 (jcc 不跳) 時 addr + 4
+ */
+static void emit_skip(uint8_t **p, C8Block *block, uint8_t jcc_over, uint16_t addr) {
+  emit8(p, jcc_over);
+  emit8(p, 12);
+  emit_exit(p, block, addr + 4);
+  emit_exit(p, block, addr + 2);
+}
+
+// vf 及 vx 依 c8_step() 的順序寫回: 先 vf 再 vx
+static void emit_store_flag_result(uint8_t **p, uint8_t x, uint8_t flag) {
+  emit_store8(p, OFF_V(0xf), flag);
+  emit_store8(p, OFF_V(x), AL);
+}
+
+static JitEmit c8_jit_emit(uint8_t **p, C8Block *block, OpCode op, uint16_t addr) {
+  uint8_t x = VX(op);
+  uint8_t y = VY(op);
+
+  switch(op >> 12) {
+    case 0x0:
+      if(op != 0x00ee) {
+        return JIT_UNSUPPORTED;
+      }
+      // pc = *(uint16_t *) &stack[sp]; sp += 2
+      emit8(p, 0x0f); emit8(p, 0xb7); emit_rdi(p, AL, OFF_SP);
+      emit8(p, 0x0f); emit8(p, 0xb7); emit8(p, 0x8c); emit8(p, 0x07);
+      emit32(p, OFF_STACK);
+      emit8(p, 0x66); emit8(p, 0x89); emit_rdi(p, CL, OFF_PC);
+      emit8(p, 0x66); emit8(p, 0x83); emit_rdi(p, 0, OFF_SP); emit8(p, 2);
+      emit_ret(p);
+      return JIT_TERMINATE;
+    case 0x1:
+      emit_exit(p, block, NNN(op));
+      return JIT_TERMINATE;
+    case 0x3:
+      // cmp byte [vx], kk; jne over
+      emit8(p, 0x80); emit_rdi(p, 7, OFF_V(x)); emit8(p, KK(op));
+      emit_skip(p, block, 0x75, addr);
+      return JIT_TERMINATE;
+    case 0x4:
+      emit8(p, 0x80); emit_rdi(p, 7, OFF_V(x)); emit8(p, KK(op));
+      emit_skip(p, block, 0x74, addr);
+      return JIT_TERMINATE;
+    case 0x5:
+    case 0x9:
+      // cmp al, [vy]
+      emit_load8(p, AL, OFF_V(x));
+      emit8(p, 0x3a); emit_rdi(p, AL, OFF_V(y));
+      emit_skip(p, block, (op >> 12) == 0x5 ? 0x75 : 0x74, addr);
+      return JIT_TERMINATE;
+    case 0x6:
+      emit_store8_imm(p, OFF_V(x), KK(op));
+      return JIT_CONTINUE;
+    case 0x7:
+      // add byte [vx], kk
+      emit8(p, 0x80); emit_rdi(p, 0, OFF_V(x)); emit8(p, KK(op));
+      return JIT_CONTINUE;
+    case 0x8:
+      switch(op & 0xf) {
+        case 0x0:
+          emit_load8(p, AL, OFF_V(y));
+          emit_store8(p, OFF_V(x), AL);
+          return JIT_CONTINUE;
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+          // or/and/xor [vx], al
+          static const uint8_t opc[] = { 0, 0x08, 0x20, 0x30 };
+          emit_load8(p, AL, OFF_V(y));
+          emit8(p, opc[op & 0xf]); emit_rdi(p, AL, OFF_V(x));
+          return JIT_CONTINUE;
+        }
+        case 0x4:
+          emit_load8(p, AL, OFF_V(x));
+          emit_load8(p, CL, OFF_V(y));
+          emit8(p, 0x00); emit8(p, 0xc8);                 // add al, cl
+          emit8(p, 0x0f); emit8(p, 0x92); emit8(p, 0xc2); // setc dl
+          emit_store_flag_result(p, x, DL);
+          return JIT_CONTINUE;
+        case 0x5:
+        case 0x7:
+          // 0x5: al = vx, cl = vy; 0x7: al = vy, cl = vx
+          emit_load8(p, AL, OFF_V((op & 0xf) == 0x5 ? x : y));
+          emit_load8(p, CL, OFF_V((op & 0xf) == 0x5 ? y : x));
+          emit8(p, 0x38); emit8(p, 0xc8);                 // cmp al, cl
+          emit8(p, 0x0f); emit8(p, 0x97); emit8(p, 0xc2); // seta dl
+          emit8(p, 0x28); emit8(p, 0xc8);                 // sub al, cl
+          emit_store_flag_result(p, x, DL);
+          return JIT_CONTINUE;
+        case 0x6:
+          // vf 同時是來源時 c8_step() 會再移一次，交給 interpreter
+          if(x == 0xf) {
+            return JIT_UNSUPPORTED;
+          }
+          emit_load8(p, AL, OFF_V(x));
+          emit8(p, 0x88); emit8(p, 0xc1);                 // mov cl, al
+          emit8(p, 0x80); emit8(p, 0xe1); emit8(p, 0x01); // and cl, 1
+          emit8(p, 0xd0); emit8(p, 0xe8);                 // shr al, 1
+          emit_store_flag_result(p, x, CL);
+          return JIT_CONTINUE;
+        case 0xe:
+          if(x == 0xf) {
+            return JIT_UNSUPPORTED;
+          }
+          emit_load8(p, AL, OFF_V(x));
+          emit8(p, 0x88); emit8(p, 0xc1);                 // mov cl, al
+          emit8(p, 0xc0); emit8(p, 0xe9); emit8(p, 0x07); // shr cl, 7
+          emit8(p, 0x00); emit8(p, 0xc0);                 // add al, al
+          emit_store_flag_result(p, x, CL);
+          return JIT_CONTINUE;
+        default:
+          return JIT_UNSUPPORTED;
+      }
+    case 0xa:
+      emit_store16_imm(p, OFF_I, NNN(op));
+      return JIT_CONTINUE;
+    case 0xb:
+      // pc = (v0 + nnn) & 0xfff
+      emit8(p, 0x0f); emit8(p, 0xb6); emit_rdi(p, AL, OFF_V(0));
+      emit8(p, 0x05); emit32(p, NNN(op));
+      emit8(p, 0x25); emit32(p, 0xfff);
+      emit8(p, 0x66); emit8(p, 0x89); emit_rdi(p, AL, OFF_PC);
+      emit_ret(p);
+      return JIT_TERMINATE;
+    case 0xf:
+      switch(op & 0xff) {
+        case 0x07:
+          emit_load8(p, AL, OFF_DT);
+          emit_store8(p, OFF_V(x), AL);
+          return JIT_CONTINUE;
+        case 0x15:
+          emit_load8(p, AL, OFF_V(x));
+          emit_store8(p, OFF_DT, AL);
+          return JIT_CONTINUE;
+        case 0x18:
+          emit_load8(p, AL, OFF_V(x));
+          emit_store8(p, OFF_ST, AL);
+          return JIT_CONTINUE;
+        case 0x1e:
+          // movsx eax, byte [vx]; add word [i], ax
+          emit8(p, 0x0f); emit8(p, 0xbe); emit_rdi(p, AL, OFF_V(x));
+          emit8(p, 0x66); emit8(p, 0x01); emit_rdi(p, AL, OFF_I);
+          return JIT_CONTINUE;
+        default:
+          return JIT_UNSUPPORTED;
+      }
+    default:
+      return JIT_UNSUPPORTED;
+  }
+}
+
+static void c8_jit_mark(C8Jit *self, int start, int end, bool set) {
+  int a;
+  for(a = start; a < end && a < MEM_SIZE; ++ a) {
+    if(set) {
+      self->code_map[a >> 3] |= 1 << (a & 7);
+    } else {
+      self->code_map[a >> 3] &= ~(1 << (a & 7));
+    }
+  }
+}
+
+static void c8_jit_reset(C8Jit *self) {
+  debug("flush code cache, %d blocks, %zu bytes", self->nblocks, self->used);
+  self->used = 0;
+  self->nblocks = 0;
+  memset(self->map, 0, sizeof(self->map));
+  memset(self->code_map, 0, sizeof(self->code_map));
+}
+
+/**
+ * 進入 block 時 budget 不夠整個 block 就設好 pc 返回，否則扣掉 block
+ * 的長度並把各 opcode 分類的個數加進 stats
+ */
+static int c8_jit_prologue(uint8_t *buf, uint16_t start, int n, const uint8_t *ops) {
+  uint8_t *p = buf;
+  emit8(&p, 0x83); emit8(&p, 0xfe); emit8(&p, n);  // cmp esi, n
+  emit8(&p, 0x7d); emit8(&p, 12);                  // jge body
+  emit_set_pc(&p, start);
+  emit_ret(&p);
+  emit8(&p, 0x83); emit8(&p, 0xee); emit8(&p, n);  // sub esi, n
+#ifdef ENABLE_STATS
+  int i;
+  for(i = 0; i < 16; ++ i) {
+    if(ops[i]) {
+      // add qword [rdi + opcodes[i]], ops[i]
+      emit8(&p, 0x48); emit8(&p, 0x83); emit_rdi(&p, 0, OFF_OPCODES(i)); emit8(&p, ops[i]);
+    }
+  }
+#else
+  (void) ops;
+#endif
+  return p - buf;
+}
+
+static C8Block *c8_jit_block_at(C8Jit *self, uint16_t addr) {
+  return !(addr & 1) && addr + 1 < MEM_SIZE ? self->map[addr >> 1] : NULL;
+}
+
+static bool c8_jit_chainable(C8Block *b) {
+  return b && b->code && !b->timers;
+}
+
+static void c8_jit_chain(C8Exit *e, C8Block *to) {
+  uint8_t *p = e->at;
+  emit8(&p, 0xe9);
+  emit32(&p, (uint8_t *) to->code - (e->at + 5));
+  e->to = to;
+}
+
+static void c8_jit_unchain(C8Exit *e) {
+  uint8_t *p = e->at;
+  emit_set_pc(&p, e->target);
+  e->to = NULL;
+}
+
+/**
+ * 新的 block 的出口接到已翻譯的 blocks，其他 blocks 到它的出口也接上
+ */
+static void c8_jit_link(C8Jit *self, C8Block *block) {
+  int i, e;
+  for(e = 0; e < block->nexits; ++ e) {
+    C8Block *to = c8_jit_block_at(self, block->exits[e].target);
+    if(c8_jit_chainable(to)) {
+      c8_jit_chain(&block->exits[e], to);
+    }
+  }
+  if(!c8_jit_chainable(block)) {
+    return;
+  }
+  for(i = 0; i < self->nblocks; ++ i) {
+    C8Block *b = &self->blocks[i];
+    if(b == block || self->map[b->start >> 1] != b) {
+      continue;
+    }
+    for(e = 0; e < b->nexits; ++ e) {
+      if(!b->exits[e].to && b->exits[e].target == block->start) {
+        c8_jit_chain(&b->exits[e], block);
+      }
+    }
+  }
+}
+
+static C8Block *c8_jit_translate(C8Jit *self, Chip8 *vm, uint16_t start) {
+  uint8_t *code, *body, *p;
+  uint8_t prologue[JIT_PROLOGUE_BYTES];
+  C8Block *block;
+  uint16_t addr = start;
+  JitEmit r = JIT_CONTINUE;
+  bool timers = false;
+  int n = 0, len = 0;
+  uint8_t ops[16] = { 0 };
+
+  if(self->nblocks == JIT_MAX_BLOCKS ||
+     JIT_CACHE_SIZE - self->used < JIT_MAX_BLOCK_BYTES) {
+    c8_jit_reset(self);
+  }
+
+  block = &self->blocks[self->nblocks ++];
+  block->nexits = 0;
+  // prologue 要等 n 及 ops 確定才寫得出來，先空出最大的長度
+  body = p = self->cache + self->used + JIT_PROLOGUE_BYTES;
+  while(r == JIT_CONTINUE && n < JIT_MAX_OPS && addr + 1 < MEM_SIZE) {
+#ifdef ENABLE_THREADED_DISPATCH
+    // 停在下一個 leader 之前，跳到那裡時共用它的 block，不必再翻譯一次
+    if(n && vm->code && c8_code_leader(vm->code, addr)) {
+      break;
+    }
+#endif
+    OpCode op = (vm->mem[addr] << 8) | vm->mem[addr + 1];
+    r = c8_jit_emit(&p, block, op, addr);
+    if(r == JIT_UNSUPPORTED) {
+      break;
+    }
+    if((op & 0xf0ff) == 0xf007 || (op & 0xf0ff) == 0xf015 || (op & 0xf0ff) == 0xf018) {
+      timers = true;
+    }
+    ++ ops[op >> 12];
+    addr += 2;
+    ++ n;
+  }
+
+  if(n && r != JIT_TERMINATE) {
+    emit_exit(&p, block, addr);
+  }
+
+  block->start = start;
+  block->n = n;
+  block->timers = timers;
+  if(n) {
+    len = c8_jit_prologue(prologue, start, n, ops);
+    code = body - len;
+    memcpy(code, prologue, len);
+    block->code = (C8BlockFunc) code;
+    block->end = addr;
+    self->used = (self->used + JIT_PROLOGUE_BYTES + (p - body) + 15) & ~(size_t) 15;
+  } else {
+    block->code = NULL;
+    block->end = start + 2;
+  }
+  self->map[start >> 1] = block;
+  c8_jit_mark(self, block->start, block->end, true);
+  c8_jit_link(self, block);
+
+  trace("block 0x%03hx-0x%03hx, %d ops, %td bytes",
+        block->start,
+        block->end,
+        n,
+        p - body + len);
+
+  return block;
+}
+
+C8Jit *c8_jit_new() {
+  C8Jit *self;
+  void *cache = mmap(NULL,
+                     JIT_CACHE_SIZE,
+                     PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1,
+                     0);
+  if(cache == MAP_FAILED) {
+    return NULL;
+  }
+
+  self = calloc(1, sizeof(C8Jit));
+  if(!self) {
+    munmap(cache, JIT_CACHE_SIZE);
+    return NULL;
+  }
+  self->cache = cache;
+  return self;
+}
+
+void c8_jit_free(C8Jit *self) {
+  if(self) {
+    munmap(self->cache, JIT_CACHE_SIZE);
+    free(self);
+  }
+}
+
+void c8_jit_invalidate(C8Jit *self, int addr, int len) {
+  int a, i;
+  int end = addr + len < MEM_SIZE ? addr + len : MEM_SIZE;
+  bool hit = false;
+
+  for(a = addr; a < end; ++ a) {
+    if(!(a & 7) && a + 8 <= end && !self->code_map[a >> 3]) {
+      a += 7;
+    } else if(self->code_map[a >> 3] & (1 << (a & 7))) {
+      hit = true;
+      break;
+    }
+  }
+  if(!hit) {
+    return;
+  }
+
+  debug("guest write 0x%03x-0x%03x hits translated code", addr, end);
+  memset(self->code_map, 0, sizeof(self->code_map));
+  for(i = 0; i < self->nblocks; ++ i) {
+    C8Block *b = &self->blocks[i];
+    if(self->map[b->start >> 1] != b) {
+      continue;
+    }
+    if(b->start < end && addr < b->end) {
+      self->map[b->start >> 1] = NULL;
+    } else {
+      c8_jit_mark(self, b->start, b->end, true);
+    }
+  }
+  // 接到被移除的 blocks 的出口改回返回
+  for(i = 0; i < self->nblocks; ++ i) {
+    C8Block *b = &self->blocks[i];
+    int e;
+    if(self->map[b->start >> 1] != b) {
+      continue;
+    }
+    for(e = 0; e < b->nexits; ++ e) {
+      C8Block *to = b->exits[e].to;
+      if(to && self->map[to->start >> 1] != to) {
+        c8_jit_unchain(&b->exits[e]);
+      }
+    }
+  }
+}
+
+/**
+ * 整個 block 在剩餘 steps 內才跑 native code，其餘交給 c8_exec()。
+ * native code 以剩餘 steps 為 budget 沿著接好的出口一路執行下去，
+ * budget 不夠或出口沒接上時才回到這裡。讀寫 DT/ST 的 block 還要在
+ * 下一個 tick 前跑完，timer 才會與 c8_exec() 一致，所以不接到這種
+ * block。clock 只在這種 block 之前及結束時推進
+ */
+void c8_jit_steps(Chip8 *vm, int steps) {
+  C8Jit *self = vm->jit;
+  uint32_t pending = 0;
+
+  assert(self);
+
+  while(steps > 0 && !vm->key_waiting) {
+    C8Block *b = NULL;
+    if(!(vm->pc & 1) && vm->pc + 1 < MEM_SIZE) {
+      b = self->map[vm->pc >> 1];
+      if(!b) {
+        b = c8_jit_translate(self, vm, vm->pc);
+      }
+    }
+
+    if(b && b->n && b->n <= steps && b->timers) {
+      c8_clock_sync(vm, &pending);
+      if(b->n > vm->countdown) {
+        b = NULL;
+      }
+    }
+    if(b && b->n && b->n <= steps) {
+      CHIP8_EXEC_BEGIN();
+      int left = b->code(vm, steps);
+      CHIP8_EXEC_END();
+      pending += steps - left;
+      steps = left;
+    } else {
+      c8_exec(vm, &pending);
+      -- steps;
+    }
+  }
+  c8_run_end(vm, pending);
+}
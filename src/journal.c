@@ -0,0 +1,223 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+
+/*
+ * 數字都是 little-endian
+ *
+ *   header: "C8IJ" version(1) variant(1) 0(2) clock(4) 0(4) seed(8)
+ *   event:  cycles(8) value(8) kind(4) 0(4)
+ *
+ * C8_JOURNAL_KEYS 的 value 是那個 tick 之後的 keys bitmask，
+ * C8_JOURNAL_END 的 value 是結束時的 c8_fb_hash()
+ */
+#define C8_JOURNAL_MAGIC "C8IJ"
+#define C8_JOURNAL_VERSION (1)
+#define C8_JOURNAL_HEADER_SIZE (24)
+#define C8_JOURNAL_EVENT_SIZE (24)
+
+enum {
+  C8_JOURNAL_KEYS,
+  C8_JOURNAL_END,
+};
+
+typedef struct _C8Event C8Event;
+
+struct _C8Event {
+  uint64_t cycles;
+  uint64_t value;
+  uint32_t kind;
+};
+
+/**
+ * 錄製時依序 fwrite() 到 file，重播時整個讀進 events
+ */
+struct _C8Journal {
+  FILE *file;
+  C8Event *events;
+  uint32_t count;
+  uint32_t next;
+};
+
+static void put_le32(uint8_t *p, uint32_t v) {
+  v = htole32(v);
+  memcpy(p, &v, 4);
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+  v = htole64(v);
+  memcpy(p, &v, 8);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return le32toh(v);
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return le64toh(v);
+}
+
+C8Journal *c8_journal_create(const char *path, const C8JournalInfo *info) {
+  C8Journal *self = calloc(1, sizeof(C8Journal));
+  if(!self) {
+    return NULL;
+  }
+  self->file = fopen(path, "wbe");
+  if(!self->file) {
+    free(self);
+    return NULL;
+  }
+
+  uint8_t hdr[C8_JOURNAL_HEADER_SIZE] = { 0 };
+  memcpy(hdr, C8_JOURNAL_MAGIC, 4);
+  hdr[4] = C8_JOURNAL_VERSION;
+  hdr[5] = info->variant;
+  put_le32(hdr + 8, info->clock);
+  put_le64(hdr + 16, info->seed);
+  fwrite(hdr, sizeof(hdr), 1, self->file);
+  return self;
+}
+
+static void c8_journal_write(C8Journal *self, uint64_t cycles, uint64_t value, uint32_t kind) {
+  uint8_t ev[C8_JOURNAL_EVENT_SIZE] = { 0 };
+  put_le64(ev, cycles);
+  put_le64(ev + 8, value);
+  put_le32(ev + 16, kind);
+  if(self->file && fwrite(ev, sizeof(ev), 1, self->file) != 1) {
+    warn("unable to write input journal: %s", strerror(errno));
+    fclose(self->file);
+    self->file = NULL;
+  }
+}
+
+void c8_journal_keys(C8Journal *self, uint64_t cycles, uint16_t keys) {
+  c8_journal_write(self, cycles, keys, C8_JOURNAL_KEYS);
+}
+
+C8Journal *c8_journal_load(const char *path, C8JournalInfo *info, int *err) {
+  uint8_t buf[C8_JOURNAL_HEADER_SIZE];
+  C8Journal *self = NULL;
+  FILE *file = fopen(path, "rbe");
+  *err = 0;
+  if(!file) {
+    *err = -errno;
+    return NULL;
+  }
+  if(fread(buf, C8_JOURNAL_HEADER_SIZE, 1, file) != 1 ||
+     memcmp(buf, C8_JOURNAL_MAGIC, 4) ||
+     buf[4] != C8_JOURNAL_VERSION ||
+     buf[5] > C8_VARIANT_XOCHIP) {
+    *err = -EBADMSG;
+    goto out;
+  }
+  info->variant = buf[5];
+  info->clock = get_le32(buf + 8);
+  info->seed = get_le64(buf + 16);
+
+  self = calloc(1, sizeof(C8Journal));
+  if(!self) {
+    *err = -ENOMEM;
+    goto out;
+  }
+  uint32_t cap = 0;
+  while(fread(buf, C8_JOURNAL_EVENT_SIZE, 1, file) == 1) {
+    if(self->count == cap) {
+      cap = cap ? cap * 2 : 64;
+      C8Event *events = realloc(self->events, sizeof(C8Event) * cap);
+      if(!events) {
+        *err = -ENOMEM;
+        break;
+      }
+      self->events = events;
+    }
+    C8Event *e = &self->events[self->count ++];
+    e->cycles = get_le64(buf);
+    e->value = get_le64(buf + 8);
+    e->kind = get_le32(buf + 16);
+    // 錄製時依 tick 的順序寫入
+    if(e->kind > C8_JOURNAL_END ||
+       (self->count > 1 && e->cycles < e[-1].cycles)) {
+      *err = -EBADMSG;
+      break;
+    }
+  }
+  if(!*err && ferror(file)) {
+    *err = -EIO;
+  }
+  if(*err) {
+    c8_journal_free(self);
+    self = NULL;
+  }
+
+out:
+  fclose(file);
+  return self;
+}
+
+bool c8_journal_replay(C8Journal *self, uint64_t cycles, uint16_t *keys) {
+  bool changed = false;
+  while(self->next < self->count && self->events[self->next].cycles <= cycles) {
+    C8Event *e = &self->events[self->next ++];
+    if(e->kind == C8_JOURNAL_KEYS) {
+      *keys = e->value;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void c8_journal_seek(C8Journal *self, uint64_t cycles) {
+  uint32_t lo = 0, hi = self->count;
+  while(lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if(self->events[mid].cycles <= cycles) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  self->next = lo;
+}
+
+bool c8_journal_end_of(C8Journal *self, uint64_t *cycles, uint64_t *fb_hash) {
+  if(!self->count || self->events[self->count - 1].kind != C8_JOURNAL_END) {
+    return false;
+  }
+  *cycles = self->events[self->count - 1].cycles;
+  *fb_hash = self->events[self->count - 1].value;
+  return true;
+}
+
+void c8_journal_close(C8Journal *self, uint64_t cycles, uint64_t fb_hash) {
+  if(!self->file) {
+    return;
+  }
+  c8_journal_write(self, cycles, fb_hash, C8_JOURNAL_END);
+  if(self->file && fclose(self->file)) {
+    warn("unable to write input journal: %s", strerror(errno));
+  }
+  self->file = NULL;
+}
+
+void c8_journal_free(C8Journal *self) {
+  if(!self) {
+    return;
+  }
+  if(self->file) {
+    fclose(self->file);
+  }
+  free(self->events);
+  free(self);
+}
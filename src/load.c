@@ -0,0 +1,133 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+
+/**
+ * 讀到 EOF，多讀一個 byte 才知道有沒有超過 XO_USER_SIZE，各 VM 的上限
+ * 由 c8_load_rom() 檢查
+ */
+static int rom_read(Chip8Rom *rom, int fd) {
+  uint8_t *buf = malloc(XO_USER_SIZE + 1);
+  int n = 0;
+  if(!buf) {
+    return -ENOMEM;
+  }
+  while(n <= XO_USER_SIZE) {
+    ssize_t r = read(fd, buf + n, XO_USER_SIZE + 1 - n);
+    if(r == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      free(buf);
+      return -err;
+    } else if(!r) {
+      break;
+    }
+    n += r;
+  }
+
+  if(!n || n > XO_USER_SIZE) {
+    free(buf);
+    return n ? -EFBIG : -ENODATA;
+  }
+  rom->data = buf;
+  rom->size = n;
+  rom->mapped = false;
+  return 0;
+}
+
+/**
+ * st_size 為 0 的 regular file 可能是 /proc 之類的，一樣用 read()
+ */
+static int rom_map_fd(Chip8Rom *rom, int fd) {
+  struct stat st;
+  if(fstat(fd, &st)) {
+    return -errno;
+  }
+  if(!S_ISREG(st.st_mode) || !st.st_size) {
+    return rom_read(rom, fd);
+  }
+  if(st.st_size > XO_USER_SIZE) {
+    return -EFBIG;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(data == MAP_FAILED) {
+    return rom_read(rom, fd);
+  }
+  rom->data = data;
+  rom->size = st.st_size;
+  rom->mapped = true;
+  return 0;
+}
+
+int c8_rom_map(Chip8Rom *rom, const char *path) {
+  assert(rom);
+  assert(path);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) {
+    return -errno;
+  }
+  // mapping 在 close() 之後仍然有效
+  int err = rom_map_fd(rom, fd);
+  close(fd);
+  trace("c8_rom_map(): %s, %d", path, err);
+  return err;
+}
+
+void c8_rom_unmap(Chip8Rom *rom) {
+  assert(rom);
+  if(!rom->data) {
+    return;
+  }
+  if(rom->mapped) {
+    munmap((void *) rom->data, rom->size);
+  } else {
+    free((void *) rom->data);
+  }
+  rom->data = NULL;
+  rom->size = 0;
+}
+
+int c8_load_rom(Chip8 *self, const Chip8Rom *rom) {
+  assert(self);
+  assert(rom);
+  if(rom->size > c8_user_size(self)) {
+    return -EFBIG;
+  }
+  c8_load(self, rom->data, rom->size);
+  return 0;
+}
+
+int c8_load_fd(Chip8 *self, int fd) {
+  assert(self);
+  Chip8Rom rom;
+  int err = rom_map_fd(&rom, fd);
+  if(err) {
+    return err;
+  }
+  err = c8_load_rom(self, &rom);
+  c8_rom_unmap(&rom);
+  return err;
+}
+
+int c8_load_file(Chip8 *self, const char *path) {
+  assert(self);
+  Chip8Rom rom;
+  int err = c8_rom_map(&rom, path);
+  if(err) {
+    return err;
+  }
+  err = c8_load_rom(self, &rom);
+  c8_rom_unmap(&rom);
+  return err;
+}
@@ -0,0 +1,135 @@
+/**
+ * lockstep.c 以不同的 VEC/VW 及 intrinsics macros 各 include 一次，
+ * 產生 LS_FN(select) 及 LS_FN(exec)，所以沒有 include guard
+ */
+
+#define BLEND(o, n, m) OR(AND(m, n), ANDNOT(m, o))
+
+/**
+ * 在還有 instructions 要跑的 lanes 中找出最小的 PC，把停在該 PC 的
+ * lanes 標到 self->mask，回傳 lanes 數，都跑完時回傳 0
+ */
+static int LS_FN(select)(Chip8Lockstep *self, uint16_t *pc) {
+  const VEC idle = SET1_16(LS_IDLE_PC);
+  const VEC zero = ZERO;
+  VEC lo = idle;
+  int c;
+  for(c = 0; c < self->width; c += VW / 2) {
+    VEC active = CMPGT16(LOAD(self->left + c), zero);
+    lo = MIN16(lo, BLEND(idle, LOAD(self->pc + c), active));
+  }
+
+  _Alignas(VW) uint16_t pcs[VW / 2];
+  STORE(pcs, lo);
+  *pc = LS_IDLE_PC;
+  for(c = 0; c < VW / 2; ++ c) {
+    if(pcs[c] < *pc) {
+      *pc = pcs[c];
+    }
+  }
+  if(*pc == LS_IDLE_PC) {
+    return 0;
+  }
+
+  const VEC target = SET1_16(*pc);
+  int n = 0;
+  for(c = 0; c < self->width; c += VW) {
+    VEC m0 = AND(CMPEQ16(LOAD(self->pc + c), target),
+                 CMPGT16(LOAD(self->left + c), zero));
+    VEC m1 = AND(CMPEQ16(LOAD(self->pc + c + VW / 2), target),
+                 CMPGT16(LOAD(self->left + c + VW / 2), zero));
+    VEC m = PACK16(m0, m1);
+    STORE(self->mask + c, m);
+    n += __builtin_popcount((unsigned) MOVEMASK8(m));
+  }
+  return n;
+}
+
+/**
+ * 以 opcode 更新 self->mask 中的 lanes，opcode 需通過 ls_vector_op()
+ */
+static void LS_FN(exec)(Chip8Lockstep *self, OpCode opcode) {
+  uint8_t *vx = self->v + VX(opcode) * self->width;
+  uint8_t *vy = self->v + VY(opcode) * self->width;
+  uint8_t *vf = self->v + 0xf * self->width;
+  const VEC one = SET1_8(1);
+  const VEC two = SET1_8(2);
+  const VEC ones = CMPEQ8(one, one);
+  const VEC kk = SET1_8(KK(opcode));
+  const VEC nnn = SET1_16(NNN(opcode));
+  int c;
+  for(c = 0; c < self->width; c += VW) {
+    VEC m = LOAD(self->mask + c);
+    VEC a = LOAD(vx + c);
+    VEC b = LOAD(vy + c);
+    VEC r = a, f = ZERO, skip = ZERO;
+    bool flag = false;
+    switch(opcode >> 12) {
+      case 0x3: skip = CMPEQ8(a, kk); break;
+      case 0x4: skip = ANDNOT(CMPEQ8(a, kk), ones); break;
+      case 0x5: skip = CMPEQ8(a, b); break;
+      case 0x9: skip = ANDNOT(CMPEQ8(a, b), ones); break;
+      case 0x6: r = kk; break;
+      case 0x7: r = ADD8(a, kk); break;
+      case 0x8:
+        switch(opcode & 0xf) {
+          case 0x0: r = b; break;
+          case 0x1: r = OR(a, b); break;
+          case 0x2: r = AND(a, b); break;
+          case 0x3: r = XOR(a, b); break;
+          case 0x4:
+            r = ADD8(a, b);
+            f = ANDNOT(CMPEQ8(ADDS_U8(a, b), r), one);
+            flag = true;
+            break;
+          case 0x5:
+            r = SUB8(a, b);
+            f = AND(ANDNOT(CMPEQ8(a, b), CMPEQ8(MAX_U8(a, b), a)), one);
+            flag = true;
+            break;
+          case 0x6:
+            r = AND(SRLI16(a, 1), SET1_8(0x7f));
+            f = AND(a, one);
+            flag = true;
+            break;
+          case 0x7:
+            r = SUB8(b, a);
+            f = AND(ANDNOT(CMPEQ8(a, b), CMPEQ8(MAX_U8(a, b), b)), one);
+            flag = true;
+            break;
+          case 0xe:
+            r = ADD8(a, a);
+            f = AND(SRLI16(a, 7), one);
+            flag = true;
+            break;
+        }
+        break;
+    }
+
+    // 與 c8_step() 相同，先寫 VF 再寫 VX
+    if(flag) {
+      STORE(vf + c, BLEND(LOAD(vf + c), f, m));
+    }
+    if(opcode >> 12 >= 0x6 && opcode >> 12 <= 0x8) {
+      STORE(vx + c, BLEND(a, r, m));
+    }
+
+    VEC step = AND(m, one);
+    if(opcode >> 12 == 0x1) {
+      STORE(self->pc + c, BLEND(LOAD(self->pc + c), nnn, SX_LO(m)));
+      STORE(self->pc + c + VW / 2, BLEND(LOAD(self->pc + c + VW / 2), nnn, SX_HI(m)));
+    } else {
+      VEC inc = AND(m, ADD8(two, AND(skip, two)));
+      STORE(self->pc + c, ADD16(LOAD(self->pc + c), ZX_LO(inc)));
+      STORE(self->pc + c + VW / 2, ADD16(LOAD(self->pc + c + VW / 2), ZX_HI(inc)));
+    }
+    if(opcode >> 12 == 0xa) {
+      STORE(self->i + c, BLEND(LOAD(self->i + c), nnn, SX_LO(m)));
+      STORE(self->i + c + VW / 2, BLEND(LOAD(self->i + c + VW / 2), nnn, SX_HI(m)));
+    }
+    STORE(self->left + c, SUB16(LOAD(self->left + c), ZX_LO(step)));
+    STORE(self->left + c + VW / 2, SUB16(LOAD(self->left + c + VW / 2), ZX_HI(step)));
+  }
+}
+
+#undef BLEND
@@ -0,0 +1,519 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+#include "chip8-lockstep.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// lanes 補到 AVX2 一個 vector 的 bytes 數
+#define LS_ALIGN (32)
+// 已跑完的 lanes 在 select 時的 PC，大於任何合法的 PC
+#define LS_IDLE_PC (0x7fff)
+// left 是 int16_t
+#define LS_MAX_SEGMENT (0x7fff)
+
+typedef struct _C8LsKernel C8LsKernel;
+
+struct _C8LsKernel {
+  const char *name;
+  int (*select)(Chip8Lockstep *self, uint16_t *pc);
+  // NULL 表示沒有 SIMD，全部逐 lane 執行
+  void (*exec)(Chip8Lockstep *self, OpCode opcode);
+};
+
+struct _Chip8Lockstep {
+  int lanes;
+  // lanes 補到 LS_ALIGN 的倍數，多出的 lanes 永遠是 idle
+  int width;
+  const C8LsKernel *kernel;
+  // lanes 個 VM 連續排列，以 c8_vm_size() 為 stride，逐 lane 執行時
+  // 把 registers 搬進搬出
+  uint8_t *vm;
+  size_t stride;
+
+  // v[x * width + lane]
+  uint8_t *v;
+  uint16_t *pc;
+  uint16_t *i;
+  uint8_t *dt;
+  uint8_t *st;
+  // 這一段還要執行的 instructions
+  int16_t *left;
+  // 這一輪要執行的 lanes，0xff 或 0
+  uint8_t *mask;
+
+  // 所有 lanes 的 cycles 在每段結束時一致，共用一個虛擬時鐘
+  uint32_t clock;
+  uint32_t countdown;
+  uint64_t cycles;
+  uint64_t frames;
+
+  // 所有 lanes 的 [APP_ENTRY, code_end) 相同，PC 在其中就是同 opcode
+  bool shared;
+  uint16_t code_end;
+
+  uint64_t instructions;
+  uint64_t simd;
+};
+
+#if defined(__SSE2__)
+#define VEC __m128i
+#define VW (16)
+#define LS_FN(name) ls_sse2_##name
+#define LOAD(p) _mm_load_si128((const __m128i *) (p))
+#define STORE(p, v) _mm_store_si128((__m128i *) (p), v)
+#define ZERO _mm_setzero_si128()
+#define SET1_8(x) _mm_set1_epi8((char) (x))
+#define SET1_16(x) _mm_set1_epi16((short) (x))
+#define AND(a, b) _mm_and_si128(a, b)
+#define OR(a, b) _mm_or_si128(a, b)
+#define XOR(a, b) _mm_xor_si128(a, b)
+#define ANDNOT(a, b) _mm_andnot_si128(a, b)
+#define ADD8(a, b) _mm_add_epi8(a, b)
+#define SUB8(a, b) _mm_sub_epi8(a, b)
+#define ADD16(a, b) _mm_add_epi16(a, b)
+#define SUB16(a, b) _mm_sub_epi16(a, b)
+#define ADDS_U8(a, b) _mm_adds_epu8(a, b)
+#define MAX_U8(a, b) _mm_max_epu8(a, b)
+#define MIN16(a, b) _mm_min_epi16(a, b)
+#define CMPEQ8(a, b) _mm_cmpeq_epi8(a, b)
+#define CMPEQ16(a, b) _mm_cmpeq_epi16(a, b)
+#define CMPGT16(a, b) _mm_cmpgt_epi16(a, b)
+#define SRLI16(a, n) _mm_srli_epi16(a, n)
+#define MOVEMASK8(a) _mm_movemask_epi8(a)
+#define PACK16(a, b) _mm_packs_epi16(a, b)
+#define ZX_LO(a) _mm_unpacklo_epi8(a, ZERO)
+#define ZX_HI(a) _mm_unpackhi_epi8(a, ZERO)
+#define SX_LO(a) _mm_unpacklo_epi8(a, a)
+#define SX_HI(a) _mm_unpackhi_epi8(a, a)
+#include "lockstep-simd.h"
+#undef VEC
+#undef VW
+#undef LS_FN
+#undef LOAD
+#undef STORE
+#undef ZERO
+#undef SET1_8
+#undef SET1_16
+#undef AND
+#undef OR
+#undef XOR
+#undef ANDNOT
+#undef ADD8
+#undef SUB8
+#undef ADD16
+#undef SUB16
+#undef ADDS_U8
+#undef MAX_U8
+#undef MIN16
+#undef CMPEQ8
+#undef CMPEQ16
+#undef CMPGT16
+#undef SRLI16
+#undef MOVEMASK8
+#undef PACK16
+#undef ZX_LO
+#undef ZX_HI
+#undef SX_LO
+#undef SX_HI
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define VEC __m256i
+#define VW (32)
+#define LS_FN(name) ls_avx2_##name
+#define LOAD(p) _mm256_load_si256((const __m256i *) (p))
+#define STORE(p, v) _mm256_store_si256((__m256i *) (p), v)
+#define ZERO _mm256_setzero_si256()
+#define SET1_8(x) _mm256_set1_epi8((char) (x))
+#define SET1_16(x) _mm256_set1_epi16((short) (x))
+#define AND(a, b) _mm256_and_si256(a, b)
+#define OR(a, b) _mm256_or_si256(a, b)
+#define XOR(a, b) _mm256_xor_si256(a, b)
+#define ANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define ADD8(a, b) _mm256_add_epi8(a, b)
+#define SUB8(a, b) _mm256_sub_epi8(a, b)
+#define ADD16(a, b) _mm256_add_epi16(a, b)
+#define SUB16(a, b) _mm256_sub_epi16(a, b)
+#define ADDS_U8(a, b) _mm256_adds_epu8(a, b)
+#define MAX_U8(a, b) _mm256_max_epu8(a, b)
+#define MIN16(a, b) _mm256_min_epi16(a, b)
+#define CMPEQ8(a, b) _mm256_cmpeq_epi8(a, b)
+#define CMPEQ16(a, b) _mm256_cmpeq_epi16(a, b)
+#define CMPGT16(a, b) _mm256_cmpgt_epi16(a, b)
+#define SRLI16(a, n) _mm256_srli_epi16(a, n)
+#define MOVEMASK8(a) _mm256_movemask_epi8(a)
+// packs/unpack 以 128-bit 為單位，要把 lanes 的順序排回來
+#define PACK16(a, b) _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8)
+#define ZX_LO(a) _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a))
+#define ZX_HI(a) _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1))
+#define SX_LO(a) _mm256_cvtepi8_epi16(_mm256_castsi256_si128(a))
+#define SX_HI(a) _mm256_cvtepi8_epi16(_mm256_extracti128_si256(a, 1))
+#include "lockstep-simd.h"
+#undef VEC
+#undef VW
+#undef LS_FN
+#undef LOAD
+#undef STORE
+#undef ZERO
+#undef SET1_8
+#undef SET1_16
+#undef AND
+#undef OR
+#undef XOR
+#undef ANDNOT
+#undef ADD8
+#undef SUB8
+#undef ADD16
+#undef SUB16
+#undef ADDS_U8
+#undef MAX_U8
+#undef MIN16
+#undef CMPEQ8
+#undef CMPEQ16
+#undef CMPGT16
+#undef SRLI16
+#undef MOVEMASK8
+#undef PACK16
+#undef ZX_LO
+#undef ZX_HI
+#undef SX_LO
+#undef SX_HI
+#pragma GCC pop_options
+
+static const C8LsKernel ls_sse2 = { "sse2", ls_sse2_select, ls_sse2_exec };
+static const C8LsKernel ls_avx2 = { "avx2", ls_avx2_select, ls_avx2_exec };
+#endif
+
+#if !defined(__SSE2__)
+static int ls_scalar_select(Chip8Lockstep *self, uint16_t *pc) {
+  int l, n = 0;
+  *pc = LS_IDLE_PC;
+  for(l = 0; l < self->lanes; ++ l) {
+    if(self->left[l] > 0 && self->pc[l] < *pc) {
+      *pc = self->pc[l];
+    }
+  }
+  for(l = 0; l < self->width; ++ l) {
+    self->mask[l] = (self->left[l] > 0 && self->pc[l] == *pc) ? 0xff : 0;
+    n += self->mask[l] & 1;
+  }
+  return n;
+}
+
+static const C8LsKernel ls_scalar = { "scalar", ls_scalar_select, NULL };
+#endif
+
+static const C8LsKernel *ls_kernel() {
+#if defined(__SSE2__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    return &ls_avx2;
+  }
+  return &ls_sse2;
+#else
+  return &ls_scalar;
+#endif
+}
+
+static bool ls_vector_op(OpCode opcode) {
+  switch(opcode >> 12) {
+    case 0x1:
+    case 0x3:
+    case 0x4:
+    case 0x6:
+    case 0x7:
+    case 0xa:
+      return true;
+    case 0x5:
+    case 0x9:
+      return !(opcode & 0xf);
+    case 0x8:
+      switch(opcode & 0xf) {
+        case 0x6:
+        case 0xe:
+          // c8_step() 寫完 VF 才 shift，VX 是 VF 時結果不同
+          return VX(opcode) != 0xf;
+        default:
+          return (opcode & 0xf) <= 0x7;
+      }
+    default:
+      return false;
+  }
+}
+
+static void *ls_alloc_aligned(size_t size, size_t align) {
+  void *p = aligned_alloc(align, (size + align - 1) & ~(align - 1));
+  if(p) {
+    memset(p, 0, size);
+  }
+  return p;
+}
+
+static inline void *ls_alloc(size_t size) {
+  return ls_alloc_aligned(size, LS_ALIGN);
+}
+
+static inline Chip8 *ls_vm(Chip8Lockstep *self, int lane) {
+  return (Chip8 *) (self->vm + self->stride * lane);
+}
+
+static inline OpCode ls_opcode(Chip8 *vm, uint16_t pc) {
+  return (vm->mem[pc & (MEM_SIZE - 1)] << 8) | vm->mem[(pc + 1) & (MEM_SIZE - 1)];
+}
+
+static void ls_put(Chip8Lockstep *self, int lane) {
+  Chip8 *vm = ls_vm(self, lane);
+  int x;
+  vm->pc = self->pc[lane];
+  vm->i = self->i[lane];
+  vm->dt = self->dt[lane];
+  vm->st = self->st[lane];
+  for(x = 0; x < 16; ++ x) {
+    vm->v[x] = self->v[x * self->width + lane];
+  }
+}
+
+static void ls_get(Chip8Lockstep *self, int lane) {
+  Chip8 *vm = ls_vm(self, lane);
+  int x;
+  self->pc[lane] = vm->pc;
+  self->i[lane] = vm->i;
+  self->dt[lane] = vm->dt;
+  self->st[lane] = vm->st;
+  for(x = 0; x < 16; ++ x) {
+    self->v[x * self->width + lane] = vm->v[x];
+  }
+}
+
+static void ls_step_lane(Chip8Lockstep *self, int lane, OpCode opcode) {
+  Chip8 *vm = ls_vm(self, lane);
+  ls_put(self, lane);
+  // 只有 FX33/FX55 會寫到程式碼，stack 在 code_end 之後
+  int end = (opcode & 0xf0ff) == 0xf033 ? vm->i + 3 :
+            (opcode & 0xf0ff) == 0xf055 ? vm->i + VX(opcode) + 1 :
+            0;
+  if(end > APP_ENTRY && vm->i < self->code_end) {
+    self->shared = false;
+  }
+  // timers 由 c8ls_steps() 統一處理，lane 自己的時鐘不能 tick
+  vm->countdown = UINT32_MAX;
+  c8_step(vm);
+  ls_get(self, lane);
+  -- self->left[lane];
+}
+
+static void ls_run(Chip8Lockstep *self, int16_t n) {
+  const C8LsKernel *k = self->kernel;
+  uint16_t pc;
+  int l, count;
+
+  for(l = 0; l < self->lanes; ++ l) {
+    self->left[l] = n;
+  }
+
+  while((count = k->select(self, &pc))) {
+    uint8_t *first = memchr(self->mask, 0xff, self->width);
+    Chip8 *leader = ls_vm(self, first - self->mask);
+    OpCode opcode = ls_opcode(leader, pc);
+
+    if(!self->shared || pc < APP_ENTRY || pc + 2 > self->code_end) {
+      // 同 PC 不同 opcode 的 lanes 留到下一輪
+      for(l = first - self->mask + 1; l < self->lanes; ++ l) {
+        if(self->mask[l] && ls_opcode(ls_vm(self, l), pc) != opcode) {
+          self->mask[l] = 0;
+          -- count;
+        }
+      }
+    }
+
+    if(count > 1 && k->exec && !(pc & 1) && ls_vector_op(opcode)) {
+      k->exec(self, opcode);
+      self->simd += count;
+      continue;
+    }
+
+    for(l = first - self->mask; l < self->lanes; ++ l) {
+      if(self->mask[l]) {
+        ls_step_lane(self, l, opcode);
+      }
+    }
+  }
+}
+
+Chip8Lockstep *c8ls_new(int lanes, const Chip8Options *options) {
+  assert(lanes > 0);
+  assert(options);
+
+  Chip8Lockstep *self = calloc(1, sizeof(Chip8Lockstep));
+  if(!self) {
+    return NULL;
+  }
+  self->width = (lanes + LS_ALIGN - 1) & ~(LS_ALIGN - 1);
+  self->kernel = ls_kernel();
+  trace("c8ls_new(): %d lanes, %s", lanes, self->kernel->name);
+  if(options->variant == C8_VARIANT_XOCHIP) {
+    warn("%s", "XO-CHIP is not supported by lockstep, run as SUPER-CHIP");
+  }
+
+  Chip8Options o = *options;
+  o.ui = UI_NULL;
+  o.engine = C8_ENGINE_SWITCH;
+  o.rewind_frames = 0;
+  o.journal = NULL;
+  // SIMD kernels 的 skip 固定 2 bytes
+  if(o.variant == C8_VARIANT_XOCHIP) {
+    o.variant = C8_VARIANT_SCHIP;
+  }
+  // Chip8.fb 要 64 bytes 對齊，c8_vm_size() 已經補齊
+  self->stride = c8_vm_size(&o);
+  self->vm = ls_alloc_aligned(self->stride * lanes, _Alignof(Chip8));
+  if(!self->vm) {
+    c8ls_free(self);
+    return NULL;
+  }
+  // self->lanes 只算 c8_init() 成功的 lanes，失敗時 c8ls_free() 只 fini 它們
+  int l;
+  for(l = 0; l < lanes; ++ l) {
+    o.seed = options->seed ? options->seed + l : 0;
+    if(!c8_init(ls_vm(self, l), &o)) {
+      c8ls_free(self);
+      return NULL;
+    }
+    ls_vm(self, l)->in_frame = true;
+    self->lanes = l + 1;
+  }
+
+  self->v = ls_alloc(16 * self->width);
+  self->pc = ls_alloc(sizeof(uint16_t) * self->width);
+  self->i = ls_alloc(sizeof(uint16_t) * self->width);
+  self->dt = ls_alloc(self->width);
+  self->st = ls_alloc(self->width);
+  self->left = ls_alloc(sizeof(int16_t) * self->width);
+  self->mask = ls_alloc(self->width);
+  if(!self->v || !self->pc || !self->i || !self->dt || !self->st || !self->left || !self->mask) {
+    c8ls_free(self);
+    return NULL;
+  }
+  for(l = 0; l < self->width; ++ l) {
+    self->pc[l] = l < lanes ? ls_vm(self, l)->pc : LS_IDLE_PC;
+  }
+
+  self->clock = ls_vm(self, 0)->clock;
+  self->countdown = ls_vm(self, 0)->countdown;
+  self->shared = false;
+
+  return self;
+}
+
+void c8ls_free(Chip8Lockstep *self) {
+  if(!self) {
+    return;
+  }
+  int l;
+  for(l = 0; l < self->lanes; ++ l) {
+    c8_fini(ls_vm(self, l));
+  }
+  free(self->vm);
+  free(self->v);
+  free(self->pc);
+  free(self->i);
+  free(self->dt);
+  free(self->st);
+  free(self->left);
+  free(self->mask);
+  free(self);
+}
+
+int c8ls_lanes(Chip8Lockstep *self) {
+  assert(self);
+  return self->lanes;
+}
+
+void c8ls_load(Chip8Lockstep *self, const uint8_t *app, int size) {
+  assert(self);
+  int l;
+  for(l = 0; l < self->lanes; ++ l) {
+    c8_load(ls_vm(self, l), app, size);
+  }
+  if(self->code_end < APP_ENTRY + size) {
+    self->code_end = APP_ENTRY + size;
+  }
+  self->shared = true;
+  for(l = 1; l < self->lanes && self->shared; ++ l) {
+    self->shared = !memcmp(ls_vm(self, 0)->mem + APP_ENTRY,
+                           ls_vm(self, l)->mem + APP_ENTRY,
+                           self->code_end - APP_ENTRY);
+  }
+}
+
+void c8ls_load_lane(Chip8Lockstep *self, int lane, const uint8_t *app, int size) {
+  assert(self);
+  assert(lane >= 0 && lane < self->lanes);
+  c8_load(ls_vm(self, lane), app, size);
+  self->shared = false;
+}
+
+void c8ls_set_v(Chip8Lockstep *self, int lane, uint8_t x, uint8_t v) {
+  assert(self);
+  assert(lane >= 0 && lane < self->lanes);
+  assert(x < 16);
+  self->v[x * self->width + lane] = v;
+}
+
+void c8ls_steps(Chip8Lockstep *self, int steps) {
+  assert(self);
+  while(steps > 0) {
+    uint32_t n = steps;
+    if(n > self->countdown) {
+      n = self->countdown;
+    }
+    if(n > LS_MAX_SEGMENT) {
+      n = LS_MAX_SEGMENT;
+    }
+
+    ls_run(self, n);
+    steps -= n;
+    self->cycles += n;
+    self->instructions += (uint64_t) n * self->lanes;
+
+    self->countdown -= n;
+    if(!self->countdown) {
+      int l;
+      for(l = 0; l < self->width; ++ l) {
+        self->dt[l] -= self->dt[l] != 0;
+        self->st[l] -= self->st[l] != 0;
+      }
+      ++ self->frames;
+      self->countdown = ((self->frames + 1) * self->clock + C8_FRAME_RATE - 1) / C8_FRAME_RATE
+                        - self->cycles;
+    }
+  }
+}
+
+Chip8 *c8ls_lane(Chip8Lockstep *self, int lane) {
+  assert(self);
+  assert(lane >= 0 && lane < self->lanes);
+  Chip8 *vm = ls_vm(self, lane);
+  ls_put(self, lane);
+  vm->cycles = self->cycles;
+  vm->frames = self->frames;
+  vm->countdown = self->countdown;
+  return vm;
+}
+
+uint64_t c8ls_instructions(Chip8Lockstep *self) {
+  assert(self);
+  return self->instructions;
+}
+
+uint64_t c8ls_simd_instructions(Chip8Lockstep *self) {
+  assert(self);
+  return self->simd;
+}
@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "logging.h"
+
+#define LOG_RING_SIZE (4096)
+#define LOG_MAX_ARGS (24)
+#define LOG_STR_SIZE (128)
+#define LOG_IDLE_NS (1000000)
+
+enum {
+  LOG_ARG_INT,
+  LOG_ARG_F64,
+  LOG_ARG_STR,
+  LOG_ARG_PTR,
+};
+
+/**
+ * 384 bytes 的固定大小 record，字串參數複製到 str，arg 存 offset
+ */
+struct _LogRecord {
+  const LogSite *site;
+  uint64_t ts;
+  uint8_t nargs;
+  uint8_t str_len;
+  uint8_t types[LOG_MAX_ARGS];
+  union {
+    uint64_t u;
+    double d;
+    const void *p;
+  } args[LOG_MAX_ARGS];
+  char str[LOG_STR_SIZE];
+};
+
+typedef struct _LogRing LogRing;
+
+/**
+ * single producer (擁有的 thread)/single consumer (背景 thread)，
+ * head/tail 只增不減，各自放在不同的 cache line
+ */
+struct _LogRing {
+  _Alignas(64) atomic_uint_fast64_t head;
+  _Alignas(64) atomic_uint_fast64_t tail;
+  atomic_uint_fast64_t dropped;
+  LogRing *next;
+  LogRecord records[LOG_RING_SIZE];
+};
+
+static _Thread_local LogRing *ring;
+static _Atomic(LogRing *) rings;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_t writer;
+static atomic_bool running;
+static atomic_bool stopping;
+
+static uint64_t log_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t epoch;
+
+static size_t log_utoa(char *buf, uint64_t v, char conv) {
+  const char *digits = conv == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+  char tmp[24];
+  size_t n = 0;
+  if(conv == 'x' || conv == 'X') {
+    do {
+      tmp[n ++] = digits[v & 0xf];
+      v >>= 4;
+    } while(v);
+  } else {
+    do {
+      tmp[n ++] = digits[v % 10];
+      v /= 10;
+    } while(v);
+  }
+  for(size_t i = 0; i < n; ++ i) {
+    buf[i] = tmp[n - 1 - i];
+  }
+  return n;
+}
+
+/**
+ * 只有 width 及 0 flag 的 %d/%i/%u/%x/%X 及單純的 %s 自己轉，trace 的
+ * 參數幾乎都是這種，省下每個參數一次 snprintf()。mod 指向 length
+ * modifier，沒有的話指向 conv。其他情況傳回 -1 交給 log_format_arg()
+ */
+static int log_format_plain(char *buf, size_t size, bool zero, size_t width, const char *mod, char conv, LogRecord *r, int n) {
+  uint64_t u = n < r->nargs ? r->args[n].u : 0;
+  int type = n < r->nargs ? r->types[n] : LOG_ARG_INT;
+  char tmp[48];
+  const char *src = tmp;
+  size_t len;
+
+  if(type != (conv == 's' ? LOG_ARG_STR : LOG_ARG_INT) || (conv == 's' && (width || mod[0] != 's'))) {
+    return -1;
+  }
+  if(width > sizeof(tmp) - 24) {
+    return -1;
+  }
+  switch(conv) {
+    case 'd': case 'i': {
+      int64_t v = !strncmp(mod, "hh", 2) ? (signed char) u :
+                  *mod == 'h' ? (short) u :
+                  *mod != conv ? (int64_t) u : (int) u;
+      len = 0;
+      if(v < 0) {
+        tmp[len ++] = '-';
+      }
+      len += log_utoa(tmp + len, v < 0 ? -(uint64_t) v : (uint64_t) v, conv);
+      if(len < width) {
+        size_t pad = width - len;
+        size_t sign = zero && v < 0;
+        memmove(tmp + sign + pad, tmp + sign, len - sign);
+        memset(tmp + sign, zero ? '0' : ' ', pad);
+        len = width;
+      }
+      break;
+    }
+    case 'u': case 'x': case 'X': {
+      uint64_t v = !strncmp(mod, "hh", 2) ? (unsigned char) u :
+                   *mod == 'h' ? (unsigned short) u :
+                   *mod != conv ? u : (unsigned) u;
+      len = log_utoa(tmp, v, conv);
+      if(len < width) {
+        memmove(tmp + width - len, tmp, len);
+        memset(tmp, zero ? '0' : ' ', width - len);
+        len = width;
+      }
+      break;
+    }
+    case 's':
+      src = r->str + u;
+      len = strlen(src);
+      break;
+    default:
+      return -1;
+  }
+  if(size) {
+    size_t l = len < size - 1 ? len : size - 1;
+    memcpy(buf, src, l);
+    buf[l] = '\0';
+  }
+  return len;
+}
+
+/**
+ * 依 conversion 的 length modifier 轉回呼叫端原本的型別再交給 snprintf()
+ */
+static int log_format_arg(char *buf, size_t size, const char *spec, LogRecord *r, int n) {
+  size_t len = strlen(spec);
+  char conv = spec[len - 1];
+  const char *mod = spec + strcspn(spec, "hlzjtL");
+  uint64_t u = n < r->nargs ? r->args[n].u : 0;
+  int type = n < r->nargs ? r->types[n] : LOG_ARG_INT;
+
+  switch(conv) {
+    case 'd': case 'i':
+      if(type == LOG_ARG_F64) {
+        u = (int64_t) r->args[n].d;
+      }
+      if(!strncmp(mod, "hh", 2)) return snprintf(buf, size, spec, (signed char) u);
+      if(*mod == 'h') return snprintf(buf, size, spec, (short) u);
+      if(!strncmp(mod, "ll", 2)) return snprintf(buf, size, spec, (long long) u);
+      if(*mod == 'l') return snprintf(buf, size, spec, (long) u);
+      if(*mod == 'j') return snprintf(buf, size, spec, (intmax_t) u);
+      if(*mod == 'z' || *mod == 't') return snprintf(buf, size, spec, (ptrdiff_t) u);
+      return snprintf(buf, size, spec, (int) u);
+    case 'u': case 'x': case 'X': case 'o':
+      if(type == LOG_ARG_F64) {
+        u = (uint64_t) r->args[n].d;
+      }
+      if(!strncmp(mod, "hh", 2)) return snprintf(buf, size, spec, (unsigned char) u);
+      if(*mod == 'h') return snprintf(buf, size, spec, (unsigned short) u);
+      if(!strncmp(mod, "ll", 2)) return snprintf(buf, size, spec, (unsigned long long) u);
+      if(*mod == 'l') return snprintf(buf, size, spec, (unsigned long) u);
+      if(*mod == 'j') return snprintf(buf, size, spec, (uintmax_t) u);
+      if(*mod == 'z' || *mod == 't') return snprintf(buf, size, spec, (size_t) u);
+      return snprintf(buf, size, spec, (unsigned) u);
+    case 'c':
+      return snprintf(buf, size, spec, (int) u);
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      return snprintf(buf, size, spec, type == LOG_ARG_F64 ? r->args[n].d : (double) (int64_t) u);
+    case 's':
+      return snprintf(buf, size, spec, type == LOG_ARG_STR ? r->str + u : "(?)");
+    case 'p':
+      return snprintf(buf, size, spec, n < r->nargs ? r->args[n].p : NULL);
+  }
+  return snprintf(buf, size, "%s", spec);
+}
+
+static void log_write(LogRecord *r) {
+  const LogSite *site = r->site;
+  char line[1024];
+  char spec[32];
+  size_t len = 0;
+  const char *p = site->fmt;
+  int n = 0;
+  uint64_t ns = r->ts - epoch;
+  char num[24];
+  size_t l;
+
+#define LEFT (len < sizeof(line) ? sizeof(line) - len : 0)
+#define ADD(x) do { int _l = (x); if(_l > 0) len += _l; if(len > sizeof(line) - 1) len = sizeof(line) - 1; } while(0)
+#define PUT(s, n) do { size_t _n = (n); if(_n > sizeof(line) - 1 - len) _n = sizeof(line) - 1 - len; memcpy(line + len, (s), _n); len += _n; } while(0)
+#define PUTS(s) do { const char *_s = (s); PUT(_s, strlen(_s)); } while(0)
+
+  PUTS(site->style);
+  PUT(" ", 1);
+  PUT(num, log_utoa(num, ns / 1000000000, 'u'));
+  PUT(".", 1);
+  l = log_utoa(num, ns % 1000000000 / 1000, 'u');
+  PUT("000000", 6 - l);
+  PUT(num, l);
+  PUT(" ", 1);
+  PUTS(site->file);
+  PUT(":", 1);
+  PUT(num, log_utoa(num, site->line, 'u'));
+  PUT(" ", 1);
+  PUTS(site->func);
+  PUT("() ", 3);
+  while(*p) {
+    if(*p != '%') {
+      const char *q = strchrnul(p, '%');
+      PUT(p, q - p);
+      p = q;
+      continue;
+    }
+    if(p[1] == '%') {
+      PUT("%", 1);
+      p += 2;
+      continue;
+    }
+    const char *q = p + 1;
+    const char *mod;
+    bool zero = *q == '0';
+    size_t width = 0;
+    for(; *q >= '0' && *q <= '9'; ++ q) {
+      width = width * 10 + *q - '0';
+    }
+    for(mod = q; *q == 'h' || *q == 'l' || *q == 'z' || *q == 'j' || *q == 't'; ++ q);
+    if(*q) {
+      int w = log_format_plain(line + len, LEFT, zero, width, mod, *q, r, n);
+      if(w >= 0) {
+        ADD(w);
+        ++ n;
+        p = q + 1;
+        continue;
+      }
+    }
+    l = 1 + strspn(p + 1, "-+ #0123456789.hlzjtL");
+    if(p[l]) {
+      ++ l;
+    }
+    if(l >= sizeof(spec)) {
+      l = sizeof(spec) - 1;
+    }
+    memcpy(spec, p, l);
+    spec[l] = '\0';
+    ADD(log_format_arg(line + len, LEFT, spec, r, n ++));
+    p += l;
+  }
+  PUTS(site->sfx);
+  if(len < sizeof(line) - 1) {
+    line[len ++] = '\n';
+  } else {
+    line[len - 1] = '\n';
+  }
+
+#undef PUTS
+#undef PUT
+#undef ADD
+#undef LEFT
+
+  // 呼叫端 log_drain() 已經 flockfile()
+  fwrite_unlocked(line, 1, len, stdout);
+}
+
+/**
+ * 從所有 rings 中挑 head 的 timestamp 最早的 ring，連續輸出它的 records
+ * 直到比其他 rings 的 head 晚為止，跨 threads 的 records 也依時間排序，
+ * 只有一個 thread 在 log 時不必每筆都掃過所有 rings
+ */
+static bool log_drain() {
+  bool any = false;
+  LogRing *r;
+
+  flockfile(stdout);
+  while(true) {
+    LogRing *oldest = NULL;
+    uint64_t ts = UINT64_MAX;
+    uint64_t next = UINT64_MAX;
+    for(r = atomic_load_explicit(&rings, memory_order_acquire); r; r = r->next) {
+      uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+      if(tail == atomic_load_explicit(&r->head, memory_order_acquire)) {
+        continue;
+      }
+      LogRecord *rec = &r->records[tail % LOG_RING_SIZE];
+      if(rec->ts < ts) {
+        next = ts;
+        ts = rec->ts;
+        oldest = r;
+      } else if(rec->ts < next) {
+        next = rec->ts;
+      }
+    }
+    if(!oldest) {
+      break;
+    }
+    uint64_t tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&oldest->head, memory_order_acquire);
+    do {
+      log_write(&oldest->records[tail % LOG_RING_SIZE]);
+      atomic_store_explicit(&oldest->tail, ++ tail, memory_order_release);
+    } while(tail != head && oldest->records[tail % LOG_RING_SIZE].ts <= next);
+    any = true;
+  }
+
+  for(r = atomic_load_explicit(&rings, memory_order_acquire); r; r = r->next) {
+    uint64_t dropped = atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+    if(dropped) {
+      printf(WARN_STYLE " %llu log records dropped\e[0m\n", (unsigned long long) dropped);
+    }
+  }
+  fflush(stdout);
+  funlockfile(stdout);
+  return any;
+}
+
+static void *log_writer(void *arg) {
+  (void) arg;
+  while(!atomic_load(&stopping)) {
+    if(!log_drain()) {
+      nanosleep(&(struct timespec){ .tv_nsec = LOG_IDLE_NS }, NULL);
+    }
+  }
+  log_drain();
+  return NULL;
+}
+
+static void log_shutdown() {
+  atomic_store(&stopping, true);
+  pthread_join(writer, NULL);
+  atomic_store(&running, false);
+}
+
+static void log_init() {
+  epoch = log_now();
+  if(pthread_create(&writer, NULL, log_writer, NULL)) {
+    return;
+  }
+  atomic_store(&running, true);
+  atexit(log_shutdown);
+}
+
+/**
+ * thread 第一次 log 時配置自己的 ring 並串到 rings，thread 結束後
+ * ring 仍留著讓背景 thread 讀完
+ */
+static LogRing *log_ring() {
+  pthread_once(&once, log_init);
+  if(!atomic_load(&running)) {
+    return NULL;
+  }
+  ring = aligned_alloc(_Alignof(LogRing), sizeof(LogRing));
+  if(!ring) {
+    return NULL;
+  }
+  memset(ring, 0, sizeof(LogRing));
+  ring->next = atomic_load(&rings);
+  while(!atomic_compare_exchange_weak(&rings, &ring->next, ring));
+  return ring;
+}
+
+LogRecord *log_begin(const LogSite *site) {
+  LogRing *r = ring ? ring : log_ring();
+  // 結束後背景 thread 不在了，留在 ring 裡的不會被輸出
+  if(!r || !atomic_load_explicit(&running, memory_order_relaxed)) {
+    return NULL;
+  }
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if(head - atomic_load_explicit(&r->tail, memory_order_acquire) == LOG_RING_SIZE) {
+#ifdef ENABLE_LOG_ASYNC_DROP
+    atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    return NULL;
+#else
+    // 自己幫背景 thread 輸出，log_drain() 持有 stdout 的 lock，同時只會有一個 consumer
+    log_drain();
+#endif
+  }
+  LogRecord *rec = &r->records[head % LOG_RING_SIZE];
+  rec->site = site;
+  rec->ts = log_now();
+  rec->nargs = 0;
+  rec->str_len = 0;
+  return rec;
+}
+
+bool log_fallback() {
+  return !ring || !atomic_load(&running);
+}
+
+void log_put_s64(LogRecord *r, long long v) {
+  log_put_u64(r, v);
+}
+
+void log_put_u64(LogRecord *r, unsigned long long v) {
+  if(r->nargs < LOG_MAX_ARGS) {
+    r->types[r->nargs] = LOG_ARG_INT;
+    r->args[r->nargs ++].u = v;
+  }
+}
+
+void log_put_f64(LogRecord *r, double v) {
+  if(r->nargs < LOG_MAX_ARGS) {
+    r->types[r->nargs] = LOG_ARG_F64;
+    r->args[r->nargs ++].d = v;
+  }
+}
+
+void log_put_str(LogRecord *r, const char *v) {
+  if(r->nargs >= LOG_MAX_ARGS) {
+    return;
+  }
+  if(!v) {
+    v = "(null)";
+  }
+  size_t left = LOG_STR_SIZE - r->str_len;
+  size_t len = strnlen(v, left ? left - 1 : 0);
+  if(!left) {
+    r->types[r->nargs] = LOG_ARG_INT;
+    r->args[r->nargs ++].u = 0;
+    return;
+  }
+  memcpy(r->str + r->str_len, v, len);
+  r->str[r->str_len + len] = '\0';
+  r->types[r->nargs] = LOG_ARG_STR;
+  r->args[r->nargs ++].u = r->str_len;
+  r->str_len += len + 1;
+}
+
+void log_put_ptr(LogRecord *r, const void *v) {
+  if(r->nargs < LOG_MAX_ARGS) {
+    r->types[r->nargs] = LOG_ARG_PTR;
+    r->args[r->nargs ++].p = v;
+  }
+}
+
+void log_commit(LogRecord *r) {
+  (void) r;
+  atomic_fetch_add_explicit(&ring->head, 1, memory_order_release);
+}
+
+void log_flush() {
+  LogRing *r;
+  if(!atomic_load(&running)) {
+    return;
+  }
+  for(r = atomic_load(&rings); r; r = r->next) {
+    while(atomic_load_explicit(&r->tail, memory_order_acquire) !=
+          atomic_load_explicit(&r->head, memory_order_acquire)) {
+      nanosleep(&(struct timespec){ .tv_nsec = LOG_IDLE_NS / 10 }, NULL);
+    }
+  }
+}
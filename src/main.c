@@ -1,82 +1,356 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "chip8.h"
+#include "chip8-diff.h"
+#include "batch.h"
+#include "play.h"
 
-#define AutoFile Auto(FILE, _fclose)
+// --stats 時結束前印出統計的 VM
+static Chip8 *stats_vm;
 
-static void _fclose(FILE **f) {
-  if(*f) { fclose(*f); *f = NULL; }
+static void print_stats() {
+  Chip8Stats s;
+  int i;
+  if(!stats_vm) {
+    return;
+  }
+  c8_stats(stats_vm, &s);
+  stats_vm = NULL;
+  printf("{\"instructions\":%llu,\"ips\":%.0f,\"opcodes\":[",
+         (unsigned long long) s.instructions,
+         s.wall_ns ? s.instructions * 1e9 / s.wall_ns : 0.0);
+  for(i = 0; i < 16; ++ i) {
+    printf("%s%llu", i ? "," : "", (unsigned long long) s.opcodes[i]);
+  }
+  printf("],\"draws\":%llu,\"flushes\":%llu,\"illegals\":%llu,\"ticks\":%llu,"
+         "\"idle_skipped\":%llu,\"wall_ns\":%llu}\n",
+         (unsigned long long) s.draws,
+         (unsigned long long) s.flushes,
+         (unsigned long long) s.illegals,
+         (unsigned long long) s.ticks,
+         (unsigned long long) s.idle_skipped,
+         (unsigned long long) s.wall_ns);
 }
 
-uint8_t buf[USER_SIZE];
+// --journal 互動執行時，由 UI 呼叫 exit() 結束前寫入結尾
+static Chip8 *journal_vm;
 
-int main(int argc, char *argv[]) {
-  if(argc <= 1) {
-    printf("Usage: %s FILE.ch8 [STEPS]\n" \
-           "  FILE.ch8 Chip8 program to load\n" \
-           "  STEPS number of opcodes to run\n",
-           argv[0]);
-    exit(1);
+static void end_journal() {
+  if(journal_vm) {
+    c8_journal_end(journal_vm);
   }
+}
 
-  int64_t steps = 0;
-  if(argc > 2) {
-    steps = strtoull(argv[2], NULL, 10);
-    if(errno) {
-      printf("'%s' is not valid STEPS: %s\n", argv[2], strerror(errno));
-      exit(1);
-    }
+/**
+ * 執行到 journal 結束時的 cycles，比對 framebuffer 後印出一行 JSON，
+ * 相同時回傳 0
+ */
+static int replay(Chip8 *vm) {
+  uint64_t end, expected;
+  struct timespec t0, t1;
+  if(!c8_replay_end(vm, &end, &expected)) {
+    printf("journal has no end record, give STEPS to replay\n");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  while(c8_cycles(vm) < end) {
+    uint64_t left = end - c8_cycles(vm);
+    c8_steps(vm, left > INT32_MAX ? INT32_MAX : left);
   }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  int64_t ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + t1.tv_nsec - t0.tv_nsec;
+  uint64_t hash = c8_fb_hash(vm);
+  printf("{\"cycles\":%llu,\"fb_hash\":\"%016llx\",\"match\":%s,\"wall_ns\":%lld,\"ips\":%.0f}\n",
+         (unsigned long long) end,
+         (unsigned long long) hash,
+         hash == expected ? "true" : "false",
+         (long long) ns,
+         ns ? end * 1e9 / ns : 0.0);
+  return hash == expected ? 0 : 1;
+}
 
-  AutoFile *f = fopen(argv[1], "r");
-  if(!f) {
-    printf("unable to open %s: %s",
-           argv[1],
-           strerror(errno));
+static int parse_int(const char *name, const char *s) {
+  char *end;
+  errno = 0;
+  long v = strtol(s, &end, 10);
+  if(errno || *end || v < 0 || v > INT32_MAX) {
+    printf("'%s' is not valid %s\n", s, name);
     exit(1);
   }
+  return v;
+}
 
-  if(fseek(f, 0, SEEK_END)) {
-    printf("unable to seek to the end of %s: %s",
-           argv[1],
-           strerror(errno));
+static uint64_t parse_steps(const char *s) {
+  char *end;
+  errno = 0;
+  unsigned long long v = strtoull(s, &end, 10);
+  if(errno || *end || !*s || *s == '-') {
+    printf("'%s' is not valid STEPS\n", s);
     exit(1);
   }
+  return v;
+}
 
-  long size = ftell(f);
-  if(size <= 0) {
-    printf("unable to get size of file %s: %s",
-           argv[1],
-           strerror(errno));
-    exit(1);
+/**
+ * c8_steps() 一次最多 INT32_MAX 個
+ */
+static void run_steps(Chip8 *vm, uint64_t steps) {
+  while(steps) {
+    int n = steps > INT32_MAX ? INT32_MAX : steps;
+    c8_steps(vm, n);
+    steps -= n;
   }
+}
 
-  if(size > USER_SIZE) {
-    printf("%s too large (<= %d) to load",
-           argv[1],
-           USER_SIZE);
-    exit(1);
+static const char *engine_names[] = {
+  [C8_ENGINE_DEFAULT] = "default",
+  [C8_ENGINE_SWITCH] = "switch",
+  [C8_ENGINE_THREADED] = "threaded",
+  [C8_ENGINE_JIT] = "jit",
+};
+
+static Chip8Engine parse_engine(const char *s) {
+  int e;
+  for(e = C8_ENGINE_SWITCH; e <= C8_ENGINE_JIT; ++ e) {
+    if(!strcmp(s, engine_names[e])) {
+      return e;
+    }
+  }
+  printf("'%s' is not valid ENGINE\n", s);
+  exit(1);
+}
+
+/**
+ * 以 reference interpreter 及選定的 engine 同時執行 steps 個
+ * instructions (replay 時到 journal 結束為止)，每 interval 個比對一次，
+ * 印出一行 JSON，沒有分歧時回傳 0
+ */
+static int diff(const Chip8Options *options, const char *path, uint64_t steps, int interval) {
+  Chip8Options ref = *options;
+  ref.engine = C8_ENGINE_SWITCH;
+  AutoChip8Diff *d = c8diff_new(&ref, options, interval);
+  if(!d) {
+    printf("unable to load input journal %s: %s\n", options->journal, strerror(errno));
+    return 1;
+  }
+  int side;
+  for(side = 0; side < 2; ++ side) {
+    int err = c8_load_file(c8diff_vm(d, side), path);
+    if(err) {
+      printf("unable to load %s: %s\n", path, strerror(-err));
+      return 1;
+    }
+  }
+  uint64_t hash;
+  if(!steps && (options->ui != UI_REPLAY || !c8_replay_end(c8diff_vm(d, 0), &steps, &hash))) {
+    printf("--diff requires STEPS\n");
+    return 1;
+  }
+
+  uint64_t done = 0;
+  while(done < steps) {
+    int n = steps - done > INT32_MAX ? INT32_MAX : steps - done;
+    if(!c8diff_steps(d, n)) {
+      break;
+    }
+    done += n;
+  }
+  const Chip8Divergence *div = c8diff_check(d) ? NULL : c8diff_divergence(d);
+  if(div) {
+    printf("{\"match\":false,\"engine\":\"%s\",\"cycles\":%llu,\"pc\":\"0x%03x\",\"opcode\":\"%04x\","
+           "\"field\":\"%s\",\"index\":%d}\n",
+           engine_names[c8_engine(c8diff_vm(d, 1))],
+           (unsigned long long) div->cycles,
+           div->pc,
+           div->opcode,
+           div->field,
+           div->index);
+    return 1;
   }
+  printf("{\"match\":true,\"engine\":\"%s\",\"cycles\":%llu,\"checks\":%llu,\"hash\":\"%016llx\"}\n",
+         engine_names[c8_engine(c8diff_vm(d, 1))],
+         (unsigned long long) c8_cycles(c8diff_vm(d, 0)),
+         (unsigned long long) c8diff_checks(d),
+         (unsigned long long) c8diff_hash(d));
+  return 0;
+}
 
-  rewind(f);
-  if(errno) {
-    printf("unable to rewind file position: %s", strerror(errno));
+int main(int argc, char *argv[]) {
+  if(argc <= 1) {
+    printf("Usage: %s [--stats] [--term|--record TARGET] [--schip|--xochip] [--engine ENGINE]\n" \
+           "          [--journal FILE] FILE.ch8 [STEPS]\n" \
+           "       %s [--stats] --replay JOURNAL FILE.ch8 [STEPS]\n" \
+           "       %s [--schip|--xochip] [--engine ENGINE] [--replay JOURNAL] --diff INTERVAL\n" \
+           "          FILE.ch8 [STEPS]\n" \
+           "       %s [--term] --play SOURCE\n" \
+           "       %s --batch DIR|MANIFEST [FRAMES [THREADS]]\n" \
+           "  FILE.ch8 Chip8 program to load, - reads it from stdin\n" \
+           "  STEPS number of opcodes to run\n" \
+           "  --stats print execution statistics as JSON at exit\n" \
+           "  --term draw in the terminal with half blocks instead of a window\n" \
+           "  --schip run as SUPER-CHIP, --xochip as XO-CHIP\n" \
+           "  --engine switch, threaded or jit, falls back to switch when not built in\n" \
+           "  --record write frames as a delta stream to TARGET, a file,\n" \
+           "           - for stdout or unix:PATH, with - other output goes to stderr\n" \
+           "  --play show a stream written by --record, SOURCE is a file,\n" \
+           "         - for stdin or unix:PATH to listen on\n" \
+           "  --journal record key changes and the CXKK seed to FILE\n" \
+           "  --replay run headless with the keys of JOURNAL up to where it was\n" \
+           "           recorded and check the framebuffer\n" \
+           "  --diff run the reference interpreter and ENGINE side by side,\n" \
+           "         compare them every INTERVAL opcodes and report the first\n" \
+           "         opcode where they differ, 0 uses the default INTERVAL\n" \
+           "  DIR|MANIFEST run every .ch8 in DIR or listed in MANIFEST headless,\n" \
+           "               one JSON line per ROM\n" \
+           "  FRAMES number of 60Hz frames to run each ROM, default %d\n" \
+           "  THREADS number of workers, default number of CPUs\n" \
+           "  CHIP8_CODE_CACHE directory to keep decoded ROMs in between runs\n",
+           argv[0],
+           argv[0],
+           argv[0],
+           argv[0],
+           argv[0],
+           BATCH_FRAMES_DEFAULT);
     exit(1);
   }
 
-  if(fread(buf, 1, sizeof(buf), f) != size) {
-    printf("unable to load %s at once: %s", argv[1], strerror(errno));
+  if(!strcmp(argv[1], "--batch")) {
+    if(argc <= 2) {
+      printf("--batch requires DIR or MANIFEST\n");
+      exit(1);
+    }
+    int frames = argc > 3 ? parse_int("FRAMES", argv[3]) : BATCH_FRAMES_DEFAULT;
+    int threads = argc > 4 ? parse_int("THREADS", argv[4]) : 0;
+    return batch_run(argv[2], frames, threads, getenv("CHIP8_CODE_CACHE"), stdout);
+  }
+
+  bool stats = false;
+  UiKind ui = UI_SDL;
+  Chip8Variant variant = C8_VARIANT_CHIP8;
+  const char *record = NULL;
+  const char *journal = NULL;
+  int interval = -1;
+  Chip8Engine engine = C8_ENGINE_DEFAULT;
+  while(argc > 1 && !strncmp(argv[1], "--", 2)) {
+    if(!strcmp(argv[1], "--stats")) {
+      stats = true;
+    } else if(!strcmp(argv[1], "--term")) {
+      ui = UI_TERM;
+    } else if(!strcmp(argv[1], "--record") ||
+              !strcmp(argv[1], "--play") ||
+              !strcmp(argv[1], "--journal") ||
+              !strcmp(argv[1], "--replay") ||
+              !strcmp(argv[1], "--diff") ||
+              !strcmp(argv[1], "--engine")) {
+      if(argc <= 2) {
+        printf("%s requires an argument\n", argv[1]);
+        exit(1);
+      }
+      if(!strcmp(argv[1], "--play")) {
+        return play_run(argv[2], ui);
+      } else if(!strcmp(argv[1], "--record")) {
+        ui = UI_RECORD;
+        record = argv[2];
+      } else if(!strcmp(argv[1], "--journal")) {
+        journal = argv[2];
+      } else if(!strcmp(argv[1], "--diff")) {
+        interval = parse_int("INTERVAL", argv[2]);
+      } else if(!strcmp(argv[1], "--engine")) {
+        engine = parse_engine(argv[2]);
+      } else {
+        ui = UI_REPLAY;
+        journal = argv[2];
+      }
+      ++ argv;
+      -- argc;
+    } else if(!strcmp(argv[1], "--schip")) {
+      variant = C8_VARIANT_SCHIP;
+    } else if(!strcmp(argv[1], "--xochip")) {
+      variant = C8_VARIANT_XOCHIP;
+    } else {
+      printf("unknown option %s\n", argv[1]);
+      exit(1);
+    }
+    ++ argv;
+    -- argc;
+  }
+  if(argc <= 1) {
+    printf("FILE.ch8 is required\n");
     exit(1);
   }
 
-  AutoChip8 *vm = c8_new();
-  c8_load(vm, buf, size);
-  if(steps) {
-    c8_steps(vm, steps);
+  uint64_t steps = argc > 2 ? parse_steps(argv[2]) : 0;
+
+  Chip8Options options = {
+    .ui = ui,
+    .engine = engine,
+    .variant = variant,
+    .record = record,
+    .journal = journal,
+    .code_cache = getenv("CHIP8_CODE_CACHE"),
+  };
+  if(interval >= 0) {
+    return diff(&options, argv[1], steps, interval);
+  }
+
+  AutoChip8 *vm = c8_new_with_options(&options);
+  /*
+   * --record - 的 recorder 寫在 fd 1 的複本上，fd 1 改指向 stderr，
+   * --stats、log 及其他寫 stdout 的輸出都不會混進 frame stream
+   */
+  if(ui == UI_RECORD && !strcmp(record, "-")) {
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
+  if(!vm) {
+    if(ui == UI_RECORD) {
+      printf("unable to open %s%s%s: %s\n",
+             record,
+             journal ? " or create input journal " : "",
+             journal ? journal : "",
+             strerror(errno));
+    } else {
+      printf("unable to %s input journal %s: %s\n",
+             ui == UI_REPLAY ? "load" : "create",
+             journal,
+             strerror(errno));
+    }
+    exit(1);
+  }
+  // "-" 從 stdin 讀
+  int err = strcmp(argv[1], "-") ? c8_load_file(vm, argv[1]) : c8_load_fd(vm, 0);
+  if(err == -EFBIG) {
+    printf("%s too large (<= %d) to load\n", argv[1], c8_user_size(vm));
+    exit(1);
+  } else if(err) {
+    printf("unable to load %s: %s\n", argv[1], strerror(-err));
+    exit(1);
+  }
+  if(stats) {
+    // 互動執行時由 UI 呼叫 exit() 結束
+    stats_vm = vm;
+    atexit(print_stats);
+  }
+  if(ui == UI_REPLAY && !steps) {
+    int status = replay(vm);
+    print_stats();
+    return status;
+  } else if(steps) {
+    run_steps(vm, steps);
+    print_stats();
   } else {
+    if(journal) {
+      journal_vm = vm;
+      atexit(end_journal);
+    }
     while(true) {
-      c8_step(vm);
+      c8_run_frame(vm, 0);
+      c8_sync(vm);
     }
   }
 }
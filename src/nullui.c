@@ -0,0 +1,51 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <time.h>
+#include <stdbool.h>
+#include "config.h"
+#include "ui.h"
+#include "logging.h"
+
+typedef struct _NullUi NullUi;
+
+struct _NullUi {
+  Ui user_iface;
+};
+
+static void null_ui_poll_events(Ui *ui) {
+}
+
+static void null_ui_wait_events(Ui *ui, int64_t timeout_ns) {
+  struct timespec ts = {
+    .tv_sec = timeout_ns / 1000000000LL,
+    .tv_nsec = timeout_ns % 1000000000LL,
+  };
+  nanosleep(&ts, NULL);
+}
+
+static bool null_ui_key_pressed(Ui *ui, Chip8Key key) {
+  return false;
+}
+
+static void null_ui_flush(Ui *ui, const uint8_t *fb, int width, int height, int planes, uint64_t dirty) {
+}
+
+static void null_ui_destroy(Ui *ui) {
+}
+
+/**
+ * 不開視窗也不讀鍵盤，給 batch run 及測試用
+ */
+Ui *null_ui_new(int width, int height, int scale) {
+  NullUi *self = malloc(sizeof(NullUi));
+  UI(self)->fb = NULL;
+  UI(self)->poll_events = null_ui_poll_events;
+  UI(self)->wait_events = null_ui_wait_events;
+  UI(self)->key_pressed = null_ui_key_pressed;
+  UI(self)->flush = null_ui_flush;
+  UI(self)->destroy = null_ui_destroy;
+
+  trace("null_ui_new(): %p", self);
+
+  return UI(self);
+}
@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "logging.h"
+#include "ui.h"
+#include "chip8-record.h"
+#include "play.h"
+
+static int64_t play_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * 只接受一個連線，之後就不再需要 socket 檔
+ */
+static int play_accept(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd == -1) {
+    return -1;
+  }
+  unlink(path);
+  if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(fd, 1)) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+  int err = errno;
+  close(fd);
+  unlink(path);
+  errno = err;
+  return conn;
+}
+
+static int play_open(const char *source) {
+  if(!strcmp(source, "-")) {
+    return STDIN_FILENO;
+  } else if(!strncmp(source, "unix:", 5)) {
+    return play_accept(source + 5);
+  }
+  return open(source, O_RDONLY | O_CLOEXEC);
+}
+
+int play_run(const char *source, UiKind kind) {
+  int fd = play_open(source);
+  if(fd == -1) {
+    printf("unable to open %s: %s\n", source, strerror(errno));
+    return 1;
+  }
+
+  AutoChip8Reader *reader = c8rec_new(fd);
+  Ui *ui = ui_new(kind, UI_WIDTH, UI_HEIGHT, C8_SCALE_DEFAULT);
+  Chip8Frame frame;
+  int64_t start = play_now();
+  int r;
+
+  while((r = c8rec_next(reader, &frame)) > 0) {
+    int64_t due = start + (int64_t) frame.ts_ns, now;
+    while((now = play_now()) < due) {
+      ui_wait_events(ui, due - now);
+      ui_poll_events(ui);
+    }
+    ui_flush(ui, frame.fb, frame.width, frame.height, frame.planes, ~0ULL);
+    ui_poll_events(ui);
+  }
+
+  ui_free(ui);
+  if(fd != STDIN_FILENO) {
+    close(fd);
+  }
+  if(r < 0) {
+    printf("unable to read %s: %s\n", source, strerror(-r));
+    return 1;
+  }
+  return 0;
+}
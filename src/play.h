@@ -0,0 +1,13 @@
+#include "chip8.h"
+
+#ifndef __PLAY_H_
+#define __PLAY_H_
+
+/**
+ * 依 timestamps 的間隔把 UI_RECORD 錄下的 frame stream 畫到 ui。source
+ * 是檔案路徑、"-" (stdin) 或 "unix:PATH"，後者在 PATH listen 並等一個
+ * recorder 連進來。回傳 exit status
+ */
+int play_run(const char *source, UiKind ui);
+
+#endif /* __PLAY_H_ */
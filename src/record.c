@@ -0,0 +1,127 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8-record.h"
+#include "chip8-priv.h"
+
+#define REC_FRAME_SIZE (FB_PLANES * FB_PLANE_SIZE)
+
+struct _Chip8Reader {
+  int fd;
+  bool started;
+  int width;
+  int height;
+  int planes;
+  // planes 接在一起，與 delta 的順序相同
+  uint8_t state[REC_FRAME_SIZE];
+  uint8_t fb[FB_PLANES][FB_PLANE_SIZE];
+  uint8_t buf[C8_DELTA_MAX(REC_FRAME_SIZE)];
+};
+
+Chip8Reader *c8rec_new(int fd) {
+  Chip8Reader *self = calloc(1, sizeof(Chip8Reader));
+  if(self) {
+    self->fd = fd;
+  }
+  return self;
+}
+
+void c8rec_free(Chip8Reader *self) {
+  free(self);
+}
+
+/**
+ * 讀到 size bytes 或 EOF，回傳讀到的 bytes 數
+ */
+static int rec_read(Chip8Reader *self, uint8_t *buf, int size) {
+  int n = 0;
+  while(n < size) {
+    ssize_t r = read(self->fd, buf + n, size - n);
+    if(r == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    } else if(!r) {
+      break;
+    }
+    n += r;
+  }
+  return n;
+}
+
+static bool rec_valid_mode(int width, int height, int planes) {
+  return (width == 64 || width == FB_MAX_WIDTH) &&
+         height == width / 2 &&
+         planes >= 1 && planes <= FB_PLANES;
+}
+
+int c8rec_next(Chip8Reader *self, Chip8Frame *frame) {
+  assert(self);
+  assert(frame);
+  uint8_t hdr[C8_REC_FRAME_HEADER_SIZE];
+  int n, p;
+
+  if(!self->started) {
+    n = rec_read(self, hdr, C8_REC_HEADER_SIZE);
+    if(n <= 0) {
+      return n;
+    }
+    if(n < C8_REC_HEADER_SIZE ||
+       memcmp(hdr, C8_REC_MAGIC, 4) ||
+       hdr[4] != C8_REC_VERSION) {
+      return -EBADMSG;
+    }
+    self->started = true;
+  }
+
+  n = rec_read(self, hdr, C8_REC_FRAME_HEADER_SIZE);
+  if(n <= 0) {
+    return n;
+  } else if(n < C8_REC_FRAME_HEADER_SIZE) {
+    return -EBADMSG;
+  }
+
+  uint32_t len;
+  uint64_t ts;
+  memcpy(&len, hdr, 4);
+  memcpy(&ts, hdr + 8, 8);
+  len = le32toh(len);
+  int width = hdr[4], height = hdr[5], planes = hdr[6];
+  if(!rec_valid_mode(width, height, planes) || len > sizeof(self->buf)) {
+    return -EBADMSG;
+  }
+  if(hdr[7] & C8_REC_KEY) {
+    memset(self->state, 0, sizeof(self->state));
+    self->width = width;
+    self->height = height;
+    self->planes = planes;
+  } else if(width != self->width || height != self->height || planes != self->planes) {
+    return -EBADMSG;
+  }
+
+  n = rec_read(self, self->buf, len);
+  if(n < 0) {
+    return n;
+  }
+  int size = width * height / 8;
+  if((uint32_t) n < len || !c8_delta_apply(self->state, size * planes, self->buf, len)) {
+    return -EBADMSG;
+  }
+
+  for(p = 0; p < planes; ++ p) {
+    memcpy(self->fb[p], self->state + p * size, size);
+  }
+  frame->ts_ns = le64toh(ts);
+  frame->width = width;
+  frame->height = height;
+  frame->planes = planes;
+  frame->fb = self->fb[0];
+  return 1;
+}
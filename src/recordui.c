@@ -0,0 +1,218 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "ui.h"
+#include "logging.h"
+#include "chip8-record.h"
+#include "chip8-priv.h"
+
+#define REC_FRAME_SIZE (FB_PLANES * FB_PLANE_SIZE)
+
+typedef struct _RecordUi RecordUi;
+
+/**
+ * 前後兩個 frames 輪流放在 frames[0]/frames[1]，編碼的 buffer 也是
+ * 事先配置好的，flush 時不配置記憶體
+ */
+struct _RecordUi {
+  Ui user_iface;
+  int fd;
+  bool sock;
+  int width;
+  int height;
+  int planes;
+  int cur;
+  int64_t start_ns;
+  uint8_t frames[2][REC_FRAME_SIZE];
+  uint8_t hdr[C8_REC_FRAME_HEADER_SIZE];
+  uint8_t out[C8_DELTA_MAX(REC_FRAME_SIZE)];
+};
+
+static int64_t rec_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void rec_close(RecordUi *self) {
+  if(self->fd != -1) {
+    close(self->fd);
+  }
+  self->fd = -1;
+}
+
+/**
+ * 寫完所有 iovecs。socket 用 sendmsg() 才能加 MSG_NOSIGNAL，viewer
+ * 離開時只停止錄製，不會被 SIGPIPE 結束
+ */
+static bool rec_write(RecordUi *self, struct iovec *iov, int n) {
+  while(n) {
+    ssize_t r = self->sock ?
+                sendmsg(self->fd, &(struct msghdr){ .msg_iov = iov, .msg_iovlen = n }, MSG_NOSIGNAL) :
+                writev(self->fd, iov, n);
+    if(r < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      warn("unable to write frame stream, recording stopped: %s", strerror(errno));
+      rec_close(self);
+      return false;
+    }
+    while(n && (size_t) r >= iov->iov_len) {
+      r -= iov->iov_len;
+      ++ iov;
+      -- n;
+    }
+    if(n) {
+      iov->iov_base = (uint8_t *) iov->iov_base + r;
+      iov->iov_len -= r;
+    }
+  }
+  return true;
+}
+
+static void record_ui_poll_events(Ui *ui) {
+}
+
+static void record_ui_wait_events(Ui *ui, int64_t timeout_ns) {
+  struct timespec ts = {
+    .tv_sec = timeout_ns / 1000000000LL,
+    .tv_nsec = timeout_ns % 1000000000LL,
+  };
+  nanosleep(&ts, NULL);
+}
+
+static bool record_ui_key_pressed(Ui *ui, Chip8Key key) {
+  return false;
+}
+
+/**
+ * 把用到的 planes 接成一塊，與前一個 frame 做 c8_delta_encode()，
+ * header 及 delta 以一次 writev() 送出
+ */
+static void record_ui_flush(Ui *ui, const uint8_t *fb, int width, int height, int planes, uint64_t dirty) {
+  RecordUi *self = (RecordUi *) ui;
+  int size = width * height / 8, p;
+  uint8_t flags = 0;
+
+  if(self->fd == -1) {
+    return;
+  }
+
+  uint8_t *prev = self->frames[self->cur];
+  uint8_t *cur = self->frames[self->cur ^ 1];
+  if(width != self->width || height != self->height || planes != self->planes) {
+    memset(prev, 0, REC_FRAME_SIZE);
+    self->width = width;
+    self->height = height;
+    self->planes = planes;
+    flags |= C8_REC_KEY;
+  }
+  for(p = 0; p < planes; ++ p) {
+    memcpy(cur + p * size, fb + p * FB_PLANE_SIZE, size);
+  }
+  uint32_t len = c8_delta_encode(cur, prev, size * planes, self->out);
+  self->cur ^= 1;
+
+  uint32_t le_len = htole32(len);
+  uint64_t le_ts = htole64(rec_now() - self->start_ns);
+  memcpy(self->hdr, &le_len, 4);
+  self->hdr[4] = width;
+  self->hdr[5] = height;
+  self->hdr[6] = planes;
+  self->hdr[7] = flags;
+  memcpy(self->hdr + 8, &le_ts, 8);
+
+  struct iovec iov[2] = {
+    { .iov_base = self->hdr, .iov_len = sizeof(self->hdr) },
+    { .iov_base = self->out, .iov_len = len },
+  };
+  rec_write(self, iov, len ? 2 : 1);
+}
+
+static void record_ui_destroy(Ui *ui) {
+  rec_close((RecordUi *) ui);
+}
+
+/**
+ * "unix:PATH" 連到 viewer 在 PATH listen 的 stream socket
+ */
+static int rec_connect(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd == -1) {
+    return -1;
+  }
+  if(connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * target 是檔案路徑、"-" (dup() 的 stdout) 或 "unix:PATH"，沒有 target 或無法
+ * 開啟時回傳 NULL，errno 是原因
+ */
+Ui *ui_record_new(const char *target) {
+  if(!target) {
+    errno = EINVAL;
+    return NULL;
+  }
+  RecordUi *self = calloc(1, sizeof(RecordUi));
+  if(!self) {
+    return NULL;
+  }
+
+  UI(self)->fb = NULL;
+  UI(self)->poll_events = record_ui_poll_events;
+  UI(self)->wait_events = record_ui_wait_events;
+  UI(self)->key_pressed = record_ui_key_pressed;
+  UI(self)->flush = record_ui_flush;
+  UI(self)->destroy = record_ui_destroy;
+
+  // "-" 寫到 fd 1 的複本，呼叫端之後可以把 fd 1 改指向別處
+  if(!strcmp(target, "-")) {
+    self->fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  } else if(!strncmp(target, "unix:", 5)) {
+    self->fd = rec_connect(target + 5);
+    self->sock = true;
+  } else {
+    self->fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  if(self->fd == -1) {
+    int err = errno;
+    free(self);
+    errno = err;
+    return NULL;
+  }
+  self->start_ns = rec_now();
+
+  static const uint8_t header[C8_REC_HEADER_SIZE] = {
+    'C', '8', 'F', 'S', C8_REC_VERSION, 0, 0, 0,
+  };
+  struct iovec iov = { .iov_base = (void *) header, .iov_len = sizeof(header) };
+  rec_write(self, &iov, 1);
+
+  trace("ui_record_new(): %p, %s", self, target);
+
+  return UI(self);
+}
@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+
+typedef struct _C8Delta C8Delta;
+
+/**
+ * 相鄰兩個 snapshots 的 c8_delta_encode()
+ */
+struct _C8Delta {
+  uint8_t *data;
+  uint32_t len;
+};
+
+/**
+ * head 是最近一次 snapshot 的完整狀態，ring 中第 k 新的 delta 把
+ * 第 k 新的 snapshot 轉回第 k + 1 新的。往回 n 個 frames 就是從 head
+ * 依序套用 n - 1 個 deltas，每個只有幾個 bytes
+ */
+struct _C8Rewind {
+  uint32_t max;
+  // c8_state_size()
+  uint32_t size;
+  uint32_t first;
+  uint32_t count;
+  bool has_head;
+  size_t bytes;
+  uint8_t *head;
+  // 編碼用，最差情況每個 byte 都各自成段
+  uint8_t *scratch;
+  C8Delta ring[];
+};
+
+C8Rewind *c8_rewind_new(uint32_t frames, uint32_t size) {
+  C8Rewind *self = calloc(1, sizeof(C8Rewind) + sizeof(C8Delta) * frames);
+  if(!self) {
+    return NULL;
+  }
+  self->max = frames;
+  self->size = size;
+  self->head = malloc(size);
+  self->scratch = malloc(C8_DELTA_MAX(size));
+  if(!self->head || !self->scratch) {
+    c8_rewind_free(self);
+    return NULL;
+  }
+  return self;
+}
+
+static void c8_rewind_drop(C8Rewind *self, uint32_t index) {
+  C8Delta *d = &self->ring[index % self->max];
+  self->bytes -= d->len;
+  free(d->data);
+  d->data = NULL;
+  d->len = 0;
+}
+
+void c8_rewind_free(C8Rewind *self) {
+  if(!self) {
+    return;
+  }
+  while(self->count) {
+    c8_rewind_drop(self, self->first ++);
+    -- self->count;
+  }
+  free(self->head);
+  free(self->scratch);
+  free(self);
+}
+
+void c8_rewind_capture(Chip8 *vm) {
+  C8Rewind *self = vm->rewind;
+  uint8_t *state = c8_state(vm);
+
+  vm->snapshot_due = false;
+  if(!self->has_head) {
+    memcpy(self->head, state, self->size);
+    self->has_head = true;
+    return;
+  }
+
+  uint32_t len = c8_delta_encode(state, self->head, self->size, self->scratch);
+  uint8_t *data = len ? malloc(len) : NULL;
+  if(len && !data) {
+    warn("%s", "unable to allocate rewind delta, history dropped");
+    return;
+  }
+  if(len) {
+    memcpy(data, self->scratch, len);
+  }
+  memcpy(self->head, state, self->size);
+
+  if(self->count == self->max) {
+    c8_rewind_drop(self, self->first ++);
+    -- self->count;
+  }
+  C8Delta *d = &self->ring[(self->first + self->count ++) % self->max];
+  d->data = data;
+  d->len = len;
+  self->bytes += len;
+}
+
+int c8_rewind(Chip8 *self, int frames) {
+  assert(self);
+  C8Rewind *r = self->rewind;
+  if(!r || !r->has_head || frames <= 0) {
+    return 0;
+  }
+
+  if(frames > (int) r->count + 1) {
+    frames = r->count + 1;
+  }
+
+  // head 即第 1 個 frame，之後每往回一個 frame 套用並丟掉一個 delta
+  int n;
+  for(n = 1; n < frames; ++ n) {
+    uint32_t index = r->first + -- r->count;
+    C8Delta *d = &r->ring[index % r->max];
+    c8_delta_apply(r->head, r->size, d->data, d->len);
+    c8_rewind_drop(r, index);
+  }
+
+  memcpy(c8_state(self), r->head, r->size);
+  self->snapshot_due = false;
+  self->sync_ns = 0;
+  self->dirty = ~0ULL;
+  c8_mem_written(self, 0, self->mem_size);
+
+  return frames;
+}
+
+int c8_rewind_available(Chip8 *self) {
+  assert(self);
+  C8Rewind *r = self->rewind;
+  return r && r->has_head ? r->count + 1 : 0;
+}
+
+size_t c8_rewind_size(Chip8 *self) {
+  assert(self);
+  return self->rewind ? self->rewind->bytes : 0;
+}
@@ -17,7 +17,6 @@ struct _SdlUi {
   SDL_Renderer *rend;
   SDL_Texture *text;
   uint16_t keys;
-  uint8_t pixbuf[];
 };
 
 static Chip8Key to_chip8_key(int scancode) {
@@ -74,7 +73,11 @@ static void sdl_ui_poll_events(Ui *ui) {
           if(k == C8_KEY_NIL) {
             break;
           }
-          self->keys ^= 1 << k;
+          if(ev.type == SDL_KEYDOWN) {
+            self->keys |= 1 << k;
+          } else {
+            self->keys &= ~(1 << k);
+          }
           info("keys: 0x%hx => %hhx", self->keys, k);
         }
         break;
@@ -86,9 +89,14 @@ static void sdl_ui_poll_events(Ui *ui) {
   }
 }
 
+static void sdl_ui_wait_events(Ui *ui, int64_t timeout_ns) {
+  // event 為 NULL 時不會從 queue 取出
+  SDL_WaitEventTimeout(NULL, (timeout_ns + 999999) / 1000000);
+}
+
 static bool sdl_ui_key_pressed(Ui *ui, Chip8Key key) {
   SdlUi *self = (SdlUi *) ui;
-  return !!(self->keys & key);
+  return !!(self->keys & (1 << key));
 }
 
 static void sdl_ui_destroy(Ui *ui) {
@@ -107,34 +115,75 @@ static void sdl_ui_destroy(Ui *ui) {
 //  return buf;
 //}
 
-static void sdl_ui_flush(Ui *ui, uint8_t *fb) {
-  int x, y;
-  SdlUi *self = (SdlUi *) ui;
-  uint8_t *pbstart = self->pixbuf;
-  uint8_t *fbstart = fb;
+/**
+ * 1bpp 的一個 byte 展開成 8 個 RGB332 pixels
+ */
+static uint8_t expand[256][8];
 
-  trace("");
+static void expand_init() {
+  int b, i;
+  for(b = 0; b < 256; ++ b) {
+    for(i = 0; i < 8; ++ i) {
+      expand[b][i] = b & (0x80 >> i) ? 0xff : 0;
+    }
+  }
+}
 
-  for(y = 0; y < self->height; ++ y) {
-    for(x = 0; x < self->width; ++ x) {
-      *(pbstart + x) = (fbstart[x >> 3] >> (7 - (x & 0x7))) & 1 ? 0xff : 0;
+// XO-CHIP 兩個 planes 組成的 4 色: 黑、白、淺灰、深灰
+static const uint8_t palette[4] = { 0x00, 0xff, 0x92, 0x49 };
+
+/**
+ * 只鎖住並更新連續的 dirty 列
+ */
+static void sdl_ui_update_rows(SdlUi *self, const uint8_t *fb, int width, int planes, int first, int n) {
+  SDL_Rect rect = { 0, first, width, n };
+  uint8_t *pixels;
+  int pitch, y, x;
+
+  if(SDL_LockTexture(self->text, &rect, (void **) &pixels, &pitch)) {
+    warn("unable to lock texture: %s", SDL_GetError());
+    return;
+  }
+
+  for(y = 0; y < n; ++ y) {
+    const uint8_t *src = fb + (first + y) * (width >> 3);
+    uint8_t *dst = pixels + y * pitch;
+    if(planes == 1) {
+      for(x = 0; x < width >> 3; ++ x) {
+        memcpy(dst + x * 8, expand[src[x]], 8);
+      }
+      continue;
+    }
+    for(x = 0; x < width; ++ x) {
+      uint8_t bit = 0x80 >> (x & 7);
+      dst[x] = palette[(src[x >> 3] & bit ? 1 : 0) |
+                       (src[FB_PLANE_SIZE + (x >> 3)] & bit ? 2 : 0)];
     }
+  }
+
+  SDL_UnlockTexture(self->text);
+}
+
+/**
+ * texture 以最大解析度建立，只用左上 width x height，再放大到整個視窗
+ */
+static void sdl_ui_flush(Ui *ui, const uint8_t *fb, int width, int height, int planes, uint64_t dirty) {
+  SdlUi *self = (SdlUi *) ui;
+  SDL_Rect src = { 0, 0, width, height };
+
+  trace("dirty=0x%016llx", (unsigned long long) dirty);
 
-    pbstart += self->width;
-    fbstart += self->width >> 3;
+  while(dirty) {
+    int first = __builtin_ctzll(dirty);
+    uint64_t rest = dirty >> first;
+    // 64 列全部 dirty 時 ~rest 為 0
+    int n = ~rest ? __builtin_ctzll(~rest) : 64;
+    sdl_ui_update_rows(self, fb, width, planes, first, n);
+    dirty = n == 64 ? 0 : dirty & ~(((1ULL << n) - 1) << first);
   }
 
-  SDL_UpdateTexture(self->text, NULL, self->pixbuf, self->width);
-  SDL_RenderCopy(self->rend, self->text, NULL, NULL);
+  SDL_RenderCopy(self->rend, self->text, &src, NULL);
   SDL_RenderPresent(self->rend);
-
-  //int r, c;
-  //for(r = 0; r < 32; r ++) {
-  //  for(c = 0; c < 8; c ++) {
-  //    printf("%s", to_bin(fb[r * (UI_WIDTH >> 3) + c], (char[9]){}));
-  //  }
-  //  printf("\n");
-  //}
 }
 
 Ui *sdl_ui_new(int width, int height, int scale) {
@@ -160,15 +209,30 @@ Ui *sdl_ui_new(int width, int height, int scale) {
 
   text = SDL_CreateTexture(rend,
                            SDL_PIXELFORMAT_RGB332,
-                           SDL_TEXTUREACCESS_STATIC,
-                           width,
-                           height);
+                           SDL_TEXTUREACCESS_STREAMING,
+                           FB_MAX_WIDTH,
+                           FB_MAX_HEIGHT);
   if(!text) {
     fatal("unable to create texture: %s", SDL_GetError());
   }
 
-  self = malloc(sizeof(SdlUi) + (width * height));
+  if(!expand[1][7]) {
+    expand_init();
+  }
+
+  // streaming texture 的初始內容未定義
+  uint8_t *pixels;
+  int pitch, y;
+  if(!SDL_LockTexture(text, NULL, (void **) &pixels, &pitch)) {
+    for(y = 0; y < FB_MAX_HEIGHT; ++ y) {
+      memset(pixels + y * pitch, 0, FB_MAX_WIDTH);
+    }
+    SDL_UnlockTexture(text);
+  }
+
+  self = malloc(sizeof(SdlUi));
   UI(self)->poll_events = sdl_ui_poll_events;
+  UI(self)->wait_events = sdl_ui_wait_events;
   UI(self)->key_pressed = sdl_ui_key_pressed;
   UI(self)->destroy = sdl_ui_destroy;
   UI(self)->flush = sdl_ui_flush;
@@ -179,7 +243,6 @@ Ui *sdl_ui_new(int width, int height, int scale) {
   self->height = height;
   self->scale = scale;
   self->keys = 0;
-  memset(self->pixbuf, 0, width * height);
 
   return UI(self);
 }
@@ -1,15 +1,277 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
 #include "ui.h"
+#include "logging.h"
 
-typedef struct _TermDisp TermDisp;
+// 兩列 pixels 合成一列字元，hires 時最多 32 列
+#define TERM_ROWS (FB_MAX_HEIGHT / 2)
+// 終端機只送按下 (及 auto repeat)，最後一次收到後維持按下的時間
+#define TERM_KEY_HOLD_NS (200000000LL)
+// 每個 cell 最多 3 bytes UTF-8 加上 \e[rr;ccH
+#define TERM_OUT_SIZE (TERM_ROWS * FB_MAX_WIDTH * 12 + 64)
 
-struct _TermDisp {
-  Ui ui;
+typedef struct _TermUi TermUi;
+
+struct _TermUi {
+  Ui user_iface;
+  // 畫面上目前的 cells，bit 0 是上半、bit 1 是下半
+  uint8_t shown[TERM_ROWS][FB_MAX_WIDTH];
+  // 上次 flush 的解析度，改變時整個畫面重畫
+  int width;
+  int height;
+  bool raw;
+  int64_t key_until[16];
+  char out[TERM_OUT_SIZE];
 };
 
+static const char *cells[4] = { " ", "▀", "▄", "█" };
+
+// atexit()/signal handler 還原終端機用
+static struct termios saved;
+static bool saved_valid;
+static bool active;
+
+// 顯示游標並移到畫面 (16 或 32 列) 之下
+static const char restore_lores[] = "\e[?25h\e[17;1H\n";
+static const char restore_hires[] = "\e[?25h\e[33;1H\n";
+static const char *restore_seq = restore_lores;
+
+/**
+ * 只用 async-signal-safe 的 write()/tcsetattr()，signal handler 也能呼叫
+ */
+static void term_restore() {
+  if(!active) {
+    return;
+  }
+  active = false;
+  if(saved_valid) {
+    saved_valid = false;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+  }
+  if(write(STDOUT_FILENO, restore_seq, strlen(restore_seq)) < 0) {
+    // 已經在結束了，沒有其他能做的
+  }
+}
+
+static void term_on_signal(int sig) {
+  term_restore();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static bool term_raw_mode() {
+  struct termios raw;
+  if(!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved)) {
+    return false;
+  }
+  raw = saved;
+  raw.c_lflag &= ~(ICANON | ECHO);
+  raw.c_iflag &= ~(IXON | ICRNL);
+  // read() 沒有資料時立即回傳 0，不必設 O_NONBLOCK 影響同一個 tty 的其他 process
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+  if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw)) {
+    return false;
+  }
+  saved_valid = true;
+  return true;
+}
+
+static int64_t term_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static Chip8Key to_chip8_key(char c) {
+  switch(c) {
+    case '1': return C8_KEY_1;
+    case '2': return C8_KEY_2;
+    case '3': return C8_KEY_3;
+    case '4': return C8_KEY_C;
+    case 'q': return C8_KEY_4;
+    case 'w': return C8_KEY_5;
+    case 'e': return C8_KEY_6;
+    case 'r': return C8_KEY_D;
+    case 'a': return C8_KEY_7;
+    case 's': return C8_KEY_8;
+    case 'd': return C8_KEY_9;
+    case 'f': return C8_KEY_E;
+    case 'z': return C8_KEY_A;
+    case 'x': return C8_KEY_0;
+    case 'c': return C8_KEY_B;
+    case 'v': return C8_KEY_F;
+  }
+  return C8_KEY_NIL;
+}
+
+static void term_ui_poll_events(Ui *ui) {
+  TermUi *self = (TermUi *) ui;
+  char buf[64];
+  ssize_t n, i;
+
+  if(!self->raw) {
+    return;
+  }
+
+  int64_t now = term_now();
+  while((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+    for(i = 0; i < n; ++ i) {
+      if(buf[i] == '\e') {
+        // 單獨的 ESC 結束，方向鍵等 escape sequences 略過
+        if(i + 1 == n) {
+          exit(0);
+        }
+        if(buf[i + 1] == '[' || buf[i + 1] == 'O') {
+          for(i += 2; i < n && (buf[i] < 0x40 || buf[i] > 0x7e); ++ i);
+        }
+        continue;
+      }
+      Chip8Key k = to_chip8_key(buf[i] | 0x20);
+      if(k != C8_KEY_NIL) {
+        self->key_until[k] = now + TERM_KEY_HOLD_NS;
+      }
+    }
+  }
+}
+
+static void term_ui_wait_events(Ui *ui, int64_t timeout_ns) {
+  TermUi *self = (TermUi *) ui;
+  if(!self->raw) {
+    struct timespec ts = {
+      .tv_sec = timeout_ns / 1000000000LL,
+      .tv_nsec = timeout_ns % 1000000000LL,
+    };
+    nanosleep(&ts, NULL);
+    return;
+  }
+  struct pollfd fd = { .fd = STDIN_FILENO, .events = POLLIN };
+  poll(&fd, 1, (timeout_ns + 999999) / 1000000);
+}
+
+static bool term_ui_key_pressed(Ui *ui, Chip8Key key) {
+  TermUi *self = (TermUi *) ui;
+  return self->key_until[key & 0xf] > term_now();
+}
+
+static char *term_move(char *p, int row, int col) {
+  return p + sprintf(p, "\e[%d;%dH", row + 1, col + 1);
+}
+
+/**
+ * 只比對 dirty 列所在的字元列，與畫面上不同的 cells 才輸出，連續的
+ * cells 靠游標自動前進，不必重新定位。整個 frame 一次 write()。
+ * 終端機只有兩色，XO-CHIP 的兩個 planes 疊在一起
+ */
+static void term_ui_flush(Ui *ui, const uint8_t *fb, int width, int height, int planes, uint64_t dirty) {
+  TermUi *self = (TermUi *) ui;
+  char *p = self->out;
+  int row, x, stride = width >> 3;
+
+  if(width != self->width || height != self->height) {
+    p = stpcpy(p, "\e[2J");
+    memset(self->shown, 0, sizeof(self->shown));
+    self->width = width;
+    self->height = height;
+    restore_seq = height > UI_HEIGHT ? restore_hires : restore_lores;
+  }
+
+  for(row = 0; row < height / 2; ++ row) {
+    if(!(dirty & (3ULL << (row * 2)))) {
+      continue;
+    }
+    const uint8_t *top = fb + row * 2 * stride;
+    const uint8_t *bottom = top + stride;
+    const uint8_t *top2 = planes > 1 ? top + FB_PLANE_SIZE : top;
+    const uint8_t *bottom2 = planes > 1 ? bottom + FB_PLANE_SIZE : bottom;
+    int next = -1;
+    for(x = 0; x < width; ++ x) {
+      uint8_t bit = 0x80 >> (x & 7);
+      uint8_t cell = ((top[x >> 3] | top2[x >> 3]) & bit ? 1 : 0) |
+                     ((bottom[x >> 3] | bottom2[x >> 3]) & bit ? 2 : 0);
+      if(cell == self->shown[row][x]) {
+        continue;
+      }
+      if(x != next) {
+        p = term_move(p, row, x);
+      }
+      p = stpcpy(p, cells[cell]);
+      self->shown[row][x] = cell;
+      next = x + 1;
+    }
+  }
+
+  const char *q = self->out;
+  while(q < p) {
+    ssize_t n = write(STDOUT_FILENO, q, p - q);
+    if(n < 0) {
+      if(errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      warn("unable to write to terminal: %s", strerror(errno));
+      break;
+    }
+    q += n;
+  }
+}
+
+static void term_ui_destroy(Ui *ui) {
+  term_restore();
+}
+
+/**
+ * 以 Unicode 半格字元把 64x32 畫成 64x16 個字元，hires 的 128x64 畫成
+ * 128x32 個字元，scale 不使用。
+ * stdin 是 tty 時切成 raw mode 讀鍵盤
+ */
 Ui *term_ui_new(int width, int height, int scale) {
-  TermDisp *self = malloc(sizeof(TermDisp));
+  TermUi *self = malloc(sizeof(TermUi));
+  if(!self) {
+    fatal("%s", "out of memory");
+  }
+  assert(width == UI_WIDTH && height == UI_HEIGHT);
+
+  UI(self)->fb = NULL;
+  UI(self)->poll_events = term_ui_poll_events;
+  UI(self)->wait_events = term_ui_wait_events;
+  UI(self)->key_pressed = term_ui_key_pressed;
+  UI(self)->flush = term_ui_flush;
+  UI(self)->destroy = term_ui_destroy;
+
+  // 清過的畫面全是空白 cells
+  memset(self->shown, 0, sizeof(self->shown));
+  self->width = UI_WIDTH;
+  self->height = UI_HEIGHT;
+  restore_seq = restore_lores;
+  memset(self->key_until, 0, sizeof(self->key_until));
+  self->raw = term_raw_mode();
+
+  static bool registered;
+  if(!registered) {
+    registered = true;
+    atexit(term_restore);
+    signal(SIGINT, term_on_signal);
+    signal(SIGTERM, term_on_signal);
+  }
+  active = true;
+
+  static const char init[] = "\e[?25l\e[2J";
+  if(write(STDOUT_FILENO, init, sizeof(init) - 1) < 0) {
+    warn("unable to write to terminal: %s", strerror(errno));
+  }
+
+  trace("term_ui_new(): %p, raw: %d", self, self->raw);
 
   return UI(self);
 }
-
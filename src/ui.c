@@ -6,13 +6,20 @@
 
 extern Ui *term_ui_new(int width, int height, int scale);
 extern Ui *sdl_ui_new(int width, int height, int scale);
+extern Ui *null_ui_new(int width, int height, int scale);
 
 Ui *ui_new(UiKind kind, int width, int height, int scale) {
   trace("ui_new()");
-  if(kind == UI_SDL) {
-    return sdl_ui_new(width, height, scale);
-  } else {
-    return term_ui_new(width, height, scale);
+  switch(kind) {
+    case UI_SDL:
+      return sdl_ui_new(width, height, scale);
+    case UI_NULL:
+    case UI_REPLAY:
+      return null_ui_new(width, height, scale);
+    case UI_RECORD:
+      return ui_record_new(NULL);
+    default:
+      return term_ui_new(width, height, scale);
   }
 }
 
@@ -20,12 +27,16 @@ inline void ui_poll_events(Ui *self) {
   self->poll_events(self);
 }
 
+inline void ui_wait_events(Ui *self, int64_t timeout_ns) {
+  self->wait_events(self, timeout_ns);
+}
+
 inline bool ui_key_pressed(Ui *self, Chip8Key key) {
   return self->key_pressed(self, key);
 }
 
-inline void ui_flush(Ui *ui, uint8_t *fb) {
-  ui->flush(ui, fb);
+inline void ui_flush(Ui *ui, const uint8_t *fb, int width, int height, int planes, uint64_t dirty) {
+  ui->flush(ui, fb, width, height, planes, dirty);
 }
 
 void ui_free(Ui *self) {
@@ -0,0 +1,97 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-priv.h"
+
+static void c8_watch_lines(Chip8 *self) {
+  int i, w;
+  memset(self->watch_lines, 0, sizeof(self->watch_lines));
+  for(i = 0; i < self->nwatches; ++ i) {
+    C8Watch *watch = &self->watches[i];
+    for(w = 0; w < C8_MEM_LINES / 64; ++ w) {
+      self->watch_lines[w] |= c8_lines_mask(watch->addr, watch->len, w);
+    }
+  }
+}
+
+int c8_watch_add(Chip8 *self, uint16_t addr, uint16_t len, Chip8WatchFunc func, void *data) {
+  assert(self);
+  assert(func);
+  if(!len || addr >= MEM_SIZE || len > MEM_SIZE - addr) {
+    warn("watch range 0x%x+%u is outside memory", addr, len);
+    return -1;
+  }
+  if(self->nwatches == self->watches_size) {
+    int size = self->watches_size ? self->watches_size * 2 : 4;
+    C8Watch *watches = realloc(self->watches, sizeof(C8Watch) * size);
+    if(!watches) {
+      fatal("%s", "out of memory");
+    }
+    self->watches = watches;
+    self->watches_size = size;
+  }
+  int id = self->watch_next_id ++;
+  self->watches[self->nwatches ++] = (C8Watch) {
+    .id = id,
+    .addr = addr,
+    .len = len,
+    .func = func,
+    .data = data,
+  };
+  c8_watch_lines(self);
+  trace("c8_watch_add(): %d, 0x%03x+%u", id, addr, len);
+  return id;
+}
+
+bool c8_watch_remove(Chip8 *self, int id) {
+  assert(self);
+  int i;
+  for(i = 0; i < self->nwatches; ++ i) {
+    if(self->watches[i].id == id) {
+      memmove(&self->watches[i],
+              &self->watches[i + 1],
+              sizeof(C8Watch) * (self->nwatches - i - 1));
+      -- self->nwatches;
+      c8_watch_lines(self);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * 先以 watch_lines 排除沒碰到任何 watch 的寫入，再逐一比對範圍，
+ * callbacks 依加入的順序呼叫
+ */
+void c8_watch_hit(Chip8 *self, int addr, int len) {
+  int i, w;
+  uint64_t hit = 0;
+  for(w = addr / C8_MEM_LINE / 64; w <= (addr + len - 1) / C8_MEM_LINE / 64; ++ w) {
+    hit |= self->watch_lines[w] & c8_lines_mask(addr, len, w);
+  }
+  if(!hit) {
+    return;
+  }
+
+  int end = addr + len;
+  for(i = 0; i < self->nwatches; ++ i) {
+    C8Watch *watch = &self->watches[i];
+    int lo = addr > watch->addr ? addr : watch->addr;
+    int hi = end < watch->addr + watch->len ? end : watch->addr + watch->len;
+    if(lo < hi) {
+      watch->func(self, lo, hi - lo, watch->data);
+    }
+  }
+}
+
+void c8_mem_dirty(Chip8 *self, uint64_t lines[C8_MEM_LINES / 64], bool clear) {
+  assert(self);
+  assert(lines);
+  memcpy(lines, self->mem_dirty, sizeof(self->mem_dirty));
+  if(clear) {
+    memset(self->mem_dirty, 0, sizeof(self->mem_dirty));
+  }
+}
@@ -0,0 +1,122 @@
+#include <assert.h>
+#include "chip8.h"
+#include "chip8-ops.h"
+#include "chip8-cfg.h"
+
+static Chip8 *new_vm(Chip8Variant variant, const uint8_t *prog, int size) {
+  Chip8 *vm = c8_new_with_options(&(Chip8Options){
+    .ui = UI_NULL,
+    .seed = 1,
+    .variant = variant,
+  });
+  c8_load(vm, prog, size);
+  return vm;
+}
+
+int main() {
+  {
+    uint8_t prog[] = {
+      OP_6xkk(0, 0),          // 0x200
+      OP_7xkk(0, 1),          // 0x202 loop
+      OP_2nnn(0x212),
+      OP_3xkk(0, 5),          // 0x206
+      OP_1nnn(0x202),
+      OP_1nnn(0x20a),         // 0x20a
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      OP_annn(0x20c),         // 0x212
+      OP_00EE,
+      OP_bnnn(0x300),         // 走不到
+    };
+    AutoChip8 *vm = new_vm(C8_VARIANT_CHIP8, prog, sizeof(prog));
+    AutoChip8Cfg *cfg = c8_cfg_build(vm);
+    const Chip8Block *b = c8_cfg_blocks(cfg);
+    assert(c8_cfg_count(cfg) == 6);
+
+    // 0x202 是跳躍目標，0x200 直接落進去
+    assert(b[0].start == 0x200 && b[0].end == 0x202);
+    assert(b[0].flags == 0);
+    assert(b[0].succ[0] == 1 && b[0].succ[1] == -1);
+
+    assert(b[1].start == 0x202 && b[1].end == 0x206);
+    assert(b[1].flags == (C8_BLOCK_CALL | C8_BLOCK_LOOP_HEADER));
+    assert(b[1].succ[0] == 5 && b[1].succ[1] == 2);
+
+    assert(b[2].start == 0x206 && b[2].end == 0x208);
+    assert(b[2].flags == C8_BLOCK_SKIP);
+    assert(b[2].succ[0] == 3 && b[2].succ[1] == 4);
+
+    assert(b[3].flags == C8_BLOCK_JUMP);
+    assert(b[3].succ[0] == 1);
+
+    // 跳回自己的 idle loop
+    assert(b[4].start == 0x20a);
+    assert(b[4].flags == (C8_BLOCK_JUMP | C8_BLOCK_LOOP_HEADER));
+    assert(b[4].succ[0] == 4);
+
+    assert(b[5].start == 0x212 && b[5].end == 0x216);
+    assert(b[5].flags == C8_BLOCK_RETURN);
+    assert(b[5].succ[0] == -1 && b[5].succ[1] == -1);
+
+    assert(c8_cfg_block_at(cfg, 0x200) == 0);
+    assert(c8_cfg_block_at(cfg, 0x204) == 1);
+    assert(c8_cfg_block_at(cfg, 0x214) == 5);
+    assert(c8_cfg_block_at(cfg, 0x203) == -1);
+    assert(c8_cfg_block_at(cfg, 0x20c) == -1);
+    assert(c8_cfg_block_at(cfg, 0x216) == -1);
+    assert(c8_cfg_block_at(cfg, 0xffff) == -1);
+
+    assert(c8_cfg_is_code(cfg, 0x200));
+    assert(c8_cfg_is_code(cfg, 0x20b));
+    assert(!c8_cfg_is_code(cfg, 0x20c));
+    assert(!c8_cfg_is_code(cfg, 0x211));
+    assert(c8_cfg_is_code(cfg, 0x215));
+    assert(!c8_cfg_is_code(cfg, 0x216));
+    assert(!c8_cfg_is_code(cfg, 0x1ff));
+  }
+
+  {
+    // XO-CHIP 的 F000 NNNN 佔 4 bytes，skip 要整個跳過
+    uint8_t prog[] = {
+      0xf0, 0x00, 0x03, 0x00, // 0x200
+      OP_3xkk(0, 0),          // 0x204
+      0xf0, 0x00, 0x12, 0x34, // 0x206
+      OP_00fd,                // 0x20a
+    };
+    AutoChip8 *vm = new_vm(C8_VARIANT_XOCHIP, prog, sizeof(prog));
+    AutoChip8Cfg *cfg = c8_cfg_build(vm);
+    const Chip8Block *b = c8_cfg_blocks(cfg);
+    assert(c8_cfg_count(cfg) == 3);
+    assert(b[0].start == 0x200 && b[0].end == 0x206);
+    assert(b[0].flags == C8_BLOCK_SKIP);
+    assert(b[0].succ[0] == 1 && b[0].succ[1] == 2);
+    assert(b[1].start == 0x206 && b[1].end == 0x20a);
+    assert(b[1].flags == 0);
+    assert(b[1].succ[0] == 2);
+    assert(b[2].start == 0x20a && b[2].flags == C8_BLOCK_EXIT);
+    assert(b[2].succ[0] == -1);
+    assert(c8_cfg_is_code(cfg, 0x209));
+
+    // CHIP-8 沒有 F000，一開始就是 illegal
+    AutoChip8 *plain = new_vm(C8_VARIANT_CHIP8, prog, sizeof(prog));
+    AutoChip8Cfg *pcfg = c8_cfg_build(plain);
+    assert(c8_cfg_count(pcfg) == 1);
+    assert(c8_cfg_blocks(pcfg)[0].flags == C8_BLOCK_ILLEGAL);
+    assert(c8_cfg_blocks(pcfg)[0].end == 0x202);
+    assert(!c8_cfg_is_code(pcfg, 0x204));
+  }
+
+  {
+    // 一路 fall through 到 mem 結尾，最後一個 instruction 沒有 successor
+    uint8_t prog[] = {
+      OP_1nnn(0xffe),
+    };
+    AutoChip8 *vm = new_vm(C8_VARIANT_CHIP8, prog, sizeof(prog));
+    AutoChip8Cfg *cfg = c8_cfg_build(vm);
+    const Chip8Block *b = c8_cfg_blocks(cfg);
+    assert(c8_cfg_count(cfg) == 2);
+    assert(b[1].start == 0xffe && b[1].end == 0x1000);
+    assert(b[1].succ[0] == -1);
+  }
+
+  return 0;
+}
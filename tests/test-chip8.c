@@ -1,11 +1,89 @@
+#define _DEFAULT_SOURCE
 #include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "logging.h"
 #include "chip8.h"
 #include "chip8-ops.h"
 
+static Chip8 *c8_new_headless() {
+  return c8_new_with_options(&(Chip8Options){ .ui = UI_NULL });
+}
+
+static void write_all(int fd, const uint8_t *data, int size) {
+  while(size > 0) {
+    ssize_t n = write(fd, data, size);
+    assert(n > 0);
+    data += n;
+    size -= n;
+  }
+}
+
+// 內容為 data 的暫存檔
+static char *temp_rom(const uint8_t *data, int size) {
+  static char path[64];
+  strcpy(path, "/tmp/test-chip8-XXXXXX");
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  write_all(fd, data, size);
+  close(fd);
+  return path;
+}
+
+static void assert_same_state(Chip8 *a, Chip8 *b) {
+  int i;
+  assert(c8_pc(a) == c8_pc(b));
+  assert(c8_sp(a) == c8_sp(b));
+  assert(c8_i(a) == c8_i(b));
+  assert(c8_dt(a) == c8_dt(b));
+  assert(c8_st(a) == c8_st(b));
+  for(i = 0; i < 16; ++ i) {
+    assert(c8_v(a, i) == c8_v(b, i));
+  }
+  for(i = 0; i < MEM_SIZE; ++ i) {
+    assert(c8_mem8(a, i) == c8_mem8(b, i));
+  }
+}
+
+typedef struct _Snap Snap;
+
+struct _Snap {
+  uint64_t cycles;
+  uint64_t frames;
+  int16_t pc;
+  int16_t i;
+  int8_t sp;
+  int8_t dt;
+  int8_t v[16];
+  uint8_t mem[MEM_SIZE];
+};
+
+static void snap(Chip8 *vm, Snap *s) {
+  int i;
+  memset(s, 0, sizeof(Snap));
+  s->cycles = c8_cycles(vm);
+  s->frames = c8_frames(vm);
+  s->pc = c8_pc(vm);
+  s->i = c8_i(vm);
+  s->sp = c8_sp(vm);
+  s->dt = c8_dt(vm);
+  for(i = 0; i < 16; ++ i) {
+    s->v[i] = c8_v(vm, i);
+  }
+  for(i = 0; i < MEM_SIZE; ++ i) {
+    s->mem[i] = c8_mem8(vm, i);
+  }
+}
+
+static void assert_snap(Chip8 *vm, Snap *expected) {
+  Snap s;
+  snap(vm, &s);
+  assert(!memcmp(&s, expected, sizeof(Snap)));
+}
+
 int main() {
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     assert(c8_pc(vm) == APP_ENTRY);
     c8_load(vm, (uint8_t[]){OP_NOP}, 2);
     c8_step(vm);
@@ -13,7 +91,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     c8_load(vm, (uint8_t[]){OP_1nnn(0x234)}, 2);
     assert(c8_pc(vm) == APP_ENTRY);
     c8_step(vm);
@@ -21,7 +99,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     c8_load(vm, (uint8_t[]){OP_2nnn(0x202), OP_00EE}, 4);
     assert(c8_pc(vm) == APP_ENTRY);
     assert(c8_stack_empty(vm));
@@ -35,14 +113,14 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     c8_load(vm, (uint8_t[]){OP_8xy3(0, 0)}, 2);
     c8_step(vm);
     assert(c8_v(vm, 0) == 0);
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_8xy3(0, 0),
       OP_3xkk(0, 0)
@@ -54,7 +132,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_8xy3(0, 0),
       OP_3xkk(0, 1)
@@ -66,7 +144,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_8xy3(0, 0),
       OP_4xkk(0, 1)
@@ -78,7 +156,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_8xy3(0, 0),
       OP_4xkk(0, 0)
@@ -90,7 +168,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(0, 123),
       OP_6xkk(1, 111),
@@ -103,7 +181,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_8xy3(2, 2),
       OP_7xkk(2, 1),
@@ -119,7 +197,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(4, 0xf0),
       OP_6xkk(5, 0x0f),
@@ -135,7 +213,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(4, 0xff),
       OP_6xkk(5, 0x0f),
@@ -147,7 +225,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(4, 0xff),
       OP_6xkk(5, 0xff),
@@ -160,7 +238,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(4, 0xfe),
       OP_6xkk(5, 0x1),
@@ -173,7 +251,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(4, 123),
       OP_6xkk(5, 23),
@@ -186,7 +264,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(4, 23),
       OP_6xkk(5, 123),
@@ -199,7 +277,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(4, 23),
       OP_6xkk(5, 123),
@@ -212,7 +290,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(6, 2),
       OP_8xy6(6),
@@ -224,7 +302,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(6, 3),
       OP_8xy6(6),
@@ -236,7 +314,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(8, 23),
       OP_6xkk(9, 123),
@@ -249,7 +327,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(8, 123),
       OP_6xkk(9, 23),
@@ -262,7 +340,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(6, 0x80),
       OP_8xye(6),
@@ -274,7 +352,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(6, 0x40),
       OP_8xye(6),
@@ -286,7 +364,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(0, 0x40),
       OP_6xkk(1, 0x40),
@@ -298,7 +376,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(0, 0x40),
       OP_6xkk(1, 0x41),
@@ -310,7 +388,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(0, 0),
       OP_bnnn(0x202),
@@ -321,7 +399,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(0, 0x10),
       OP_bnnn(0x200),
@@ -332,7 +410,7 @@ int main() {
   }
 
   {
-    AutoChip8 *vm = c8_new();
+    AutoChip8 *vm = c8_new_headless();
     uint8_t ops[] = {
       OP_6xkk(0, 0),
       OP_cxkk(0, 0xff),
@@ -347,4 +425,682 @@ int main() {
     assert(c8_v(vm, 0) != (c8_v(vm, 1) ^ c8_v(vm, 2)));
     assert(c8_v(vm, 3) == 0);
   }
+
+  {
+    uint8_t ops[] = {
+      OP_cxkk(0, 0xff),
+      OP_cxkk(1, 0xff),
+      OP_cxkk(2, 0xff),
+    };
+    AutoChip8 *a = c8_new_with_options(&(Chip8Options){ .ui = UI_NULL, .seed = 42 });
+    AutoChip8 *b = c8_new_with_options(&(Chip8Options){ .ui = UI_NULL, .seed = 42 });
+    c8_load(a, ops, sizeof(ops));
+    c8_load(b, ops, sizeof(ops));
+    c8_steps(a, 3);
+    c8_steps(b, 3);
+    assert(c8_v(a, 0) == c8_v(b, 0));
+    assert(c8_v(a, 1) == c8_v(b, 1));
+    assert(c8_v(a, 2) == c8_v(b, 2));
+
+    // c8_seed() 重設同一個 seed 重現同樣的序列，不同 seed 不同
+    AutoChip8 *c = c8_new_with_options(&(Chip8Options){ .ui = UI_NULL, .seed = 7 });
+    AutoChip8 *d = c8_new_with_options(&(Chip8Options){ .ui = UI_NULL, .seed = 42 });
+    c8_seed(c, 42);
+    c8_seed(d, 43);
+    c8_load(c, ops, sizeof(ops));
+    c8_load(d, ops, sizeof(ops));
+    c8_steps(c, 3);
+    c8_steps(d, 3);
+    assert(c8_v(a, 0) == c8_v(c, 0));
+    assert(c8_v(a, 1) == c8_v(c, 1));
+    assert(c8_v(a, 2) == c8_v(c, 2));
+    assert(c8_v(a, 0) != c8_v(d, 0) ||
+           c8_v(a, 1) != c8_v(d, 1) ||
+           c8_v(a, 2) != c8_v(d, 2));
+  }
+
+  {
+    // entropy mode 跨過多次 pool refill
+    uint8_t ops[] = {
+      OP_cxkk(0, 0xff),
+      OP_1nnn(0x200),
+    };
+    uint8_t seen[256] = { 0 };
+    int i, distinct = 0;
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .entropy = true,
+    });
+    c8_load(vm, ops, sizeof(ops));
+    for(i = 0; i < 1000; ++ i) {
+      c8_steps(vm, 2);
+      seen[(uint8_t) c8_v(vm, 0)] = 1;
+    }
+    for(i = 0; i < 256; ++ i) {
+      distinct += seen[i];
+    }
+    assert(distinct > 200);
+  }
+
+  {
+    uint8_t ops[] = {
+      OP_6xkk(0, 1),          // 0x200
+      OP_6xkk(1, 0x37),
+      OP_6xkk(8, 0),
+      OP_8xy4(1, 0),          // 0x206
+      OP_8xy5(2, 1),
+      OP_8xy6(3),
+      OP_8xye(1),
+      OP_8xy7(4, 1),
+      OP_8xy1(5, 1),
+      OP_8xy2(6, 1),
+      OP_8xy3(7, 1),
+      OP_7xkk(8, 3),
+      OP_annn(0x400),
+      OP_fx33(1),
+      OP_fx55(7),
+      OP_fx65(3),
+      OP_2nnn(0x22a),
+      OP_3xkk(8, 0x40),
+      OP_1nnn(0x206),
+      OP_1nnn(0x200),
+      OP_NOP,
+      OP_dxyn(0, 1, 5),       // 0x22a
+      OP_00EE,
+    };
+    AutoChip8 *ref = c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .engine = C8_ENGINE_SWITCH,
+    });
+    AutoChip8 *vm = c8_new_headless();
+    c8_load(ref, ops, sizeof(ops));
+    c8_load(vm, ops, sizeof(ops));
+    c8_steps(ref, 5000);
+    c8_steps(vm, 5000);
+    assert_same_state(ref, vm);
+  }
+
+  {
+    AutoChip8 *vm = c8_new_headless();
+    uint8_t ops[] = {
+      OP_7xkk(0, 1),
+      OP_1nnn(0x200),
+    };
+    c8_load(vm, ops, sizeof(ops));
+    c8_run_frame(vm, 10);
+    assert(c8_v(vm, 0) == 5);
+    assert(c8_pc(vm) == APP_ENTRY);
+    c8_run_frame(vm, 0);
+    assert(c8_v(vm, 0) == 5 + C8_CLOCK_DEFAULT / 60 / 2);
+  }
+
+  {
+    AutoChip8 *vm = c8_new_headless();
+    uint8_t ops[] = {
+      OP_6xkk(0, 3),
+      OP_fx15(0),
+      OP_fx07(1),             // 0x204
+      OP_3xkk(1, 0),
+      OP_1nnn(0x204),
+      OP_6xkk(2, 1),          // 0x20a
+      OP_1nnn(0x20a),
+    };
+    c8_load(vm, ops, sizeof(ops));
+    c8_run_frame(vm, 0);
+    assert(c8_frames(vm) == 1);
+    assert(c8_cycles(vm) == C8_CLOCK_DEFAULT / 60);
+    assert(c8_dt(vm) == 2);
+    c8_run_frame(vm, 0);
+    c8_run_frame(vm, 0);
+    assert(c8_dt(vm) == 0);
+    assert(c8_v(vm, 2) == 0);
+    c8_run_frame(vm, 0);
+    assert(c8_v(vm, 2) == 1);
+    assert(c8_frames(vm) == 4);
+    assert(c8_cycles(vm) == 4 * C8_CLOCK_DEFAULT / 60);
+  }
+
+  {
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){ .ui = UI_NULL, .clock = 150 });
+    uint8_t ops[] = {
+      OP_6xkk(0, 100),
+      OP_fx15(0),
+      OP_fx18(0),
+      OP_1nnn(0x206),
+    };
+    c8_load(vm, ops, sizeof(ops));
+    c8_steps(vm, 150);
+    // 150 cycles 剛好一秒，第一個 tick 在第 3 個 cycle 之後
+    assert(c8_frames(vm) == 60);
+    assert(c8_dt(vm) == 100 - 60);
+    assert(c8_st(vm) == 100 - 60);
+  }
+
+  {
+    AutoChip8 *vm = c8_new_headless();
+    uint8_t ops[] = {
+      0xf0, 0xff,
+      OP_6xkk(0, 1),
+      0xe0, 0x00,
+      OP_1nnn(0x200),
+    };
+    c8_load(vm, ops, sizeof(ops));
+    c8_steps(vm, 8);
+    assert(c8_illegals(vm) == 4);
+    assert(c8_cycles(vm) == 8);
+  }
+
+  {
+    uint8_t ops[] = {
+      OP_6xkk(0, 60),
+      OP_6xkk(1, 1),
+      OP_annn(0x210),
+      OP_dxyn(0, 1, 2),
+      OP_dxyn(0, 1, 2),       // 0x208
+      OP_6xkk(1, 31),
+      OP_dxyn(0, 1, 2),
+      OP_1nnn(0x20e),
+      0xff, 0x81,             // 0x210
+    };
+    int wrap;
+    for(wrap = 0; wrap < 2; ++ wrap) {
+      AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+        .ui = UI_NULL,
+        .sprite_wrap = wrap,
+      });
+      const uint8_t *fb = c8_fb(vm);
+      c8_load(vm, ops, sizeof(ops));
+
+      // x=60 的右半邊繞回同一列的左邊
+      c8_steps(vm, 4);
+      assert(c8_flag(vm) == 0);
+      assert(fb[8] == 0xf0 && fb[15] == 0x0f);
+      assert(fb[16] == 0x10 && fb[23] == 0x08);
+      assert(fb[9] == 0 && fb[24] == 0);
+
+      c8_steps(vm, 1);
+      assert(c8_flag(vm) == 1);
+      int i;
+      for(i = 0; i < FRAMEBUFFER_SIZE; ++ i) {
+        assert(!fb[i]);
+      }
+
+      // 最後一列之後裁掉或繞回第 0 列，不會寫到 stack
+      c8_steps(vm, 2);
+      assert(c8_flag(vm) == 0);
+      assert(fb[248] == 0xf0 && fb[255] == 0x0f);
+      assert(fb[0] == (wrap ? 0x10 : 0) && fb[7] == (wrap ? 0x08 : 0));
+      for(i = MEM_SIZE - STACK_SIZE; i < MEM_SIZE; ++ i) {
+        assert(!c8_mem8(vm, i));
+      }
+    }
+  }
+
+  {
+    static Snap snaps[101];
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .seed = 1,
+      .rewind_frames = 3600,
+    });
+    uint8_t ops[] = {
+      OP_7xkk(0, 1),
+      OP_cxkk(1, 0x3f),
+      OP_annn(0x300),
+      OP_fx33(0),
+      OP_dxyn(1, 0, 3),
+      OP_fx15(0),
+      OP_1nnn(0x200),
+    };
+    int f;
+    c8_load(vm, ops, sizeof(ops));
+    assert(!c8_rewind(vm, 1));
+    for(f = 1; f <= 100; ++ f) {
+      c8_run_frame(vm, 0);
+      snap(vm, &snaps[f]);
+    }
+    assert(c8_rewind_available(vm) == 100);
+    // 每個 frame 只動到十幾個 bytes
+    assert(c8_rewind_size(vm) < 99 * 64);
+
+    assert(c8_rewind(vm, 1) == 1);
+    assert_snap(vm, &snaps[100]);
+    assert(c8_rewind(vm, 10) == 10);
+    assert_snap(vm, &snaps[91]);
+    assert(c8_rewind(vm, 5) == 5);
+    assert_snap(vm, &snaps[87]);
+    assert(c8_rewind_available(vm) == 87);
+
+    // 回溯後重跑的結果相同
+    for(f = 88; f <= 100; ++ f) {
+      c8_run_frame(vm, 0);
+      assert_snap(vm, &snaps[f]);
+    }
+    assert(c8_rewind(vm, 1000) == 100);
+    assert_snap(vm, &snaps[1]);
+  }
+
+  {
+    Chip8Stats stats;
+    AutoChip8 *vm = c8_new_headless();
+    uint8_t ops[] = {
+      OP_annn(0x300),
+      OP_dxyn(0, 0, 1),
+      OP_dxyn(0, 0, 1),
+      OP_1nnn(0x206),
+    };
+    c8_load(vm, ops, sizeof(ops));
+    c8_run_frame(vm, 0);
+    if(c8_stats(vm, &stats)) {
+      assert(stats.opcodes[0xa] == 1);
+      assert(stats.opcodes[0xd] == 2);
+      assert(stats.opcodes[0x1] == stats.instructions - 3);
+      assert(stats.draws == 2);
+      // frame 中只 flush 一次
+      assert(stats.flushes == 1);
+    }
+    assert(stats.instructions == c8_cycles(vm));
+    assert(stats.ticks == 1);
+  }
+
+  {
+    // FX0A 沒有按鍵時停在原地，clock 及 timers 照走，不再解譯
+    Chip8Engine engines[] = { C8_ENGINE_SWITCH, C8_ENGINE_THREADED, C8_ENGINE_JIT };
+    int e;
+    for(e = 0; e < 3; ++ e) {
+      AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+        .ui = UI_NULL,
+        .engine = engines[e],
+      });
+      uint8_t ops[] = {
+        OP_6xkk(0, 100),
+        OP_fx15(0),
+        OP_6xkk(1, 7),
+        OP_fx0a(1),             // 0x206
+        OP_6xkk(1, 8),
+      };
+      c8_load(vm, ops, sizeof(ops));
+      c8_steps(vm, 4);
+      assert(c8_pc(vm) == 0x206);
+      c8_steps(vm, 1000000);
+      assert(c8_pc(vm) == 0x206);
+      assert(c8_v(vm, 1) == 7);
+      assert(c8_cycles(vm) == 1000004);
+      assert(c8_dt(vm) == 0);
+      c8_run_frame(vm, 0);
+      assert(c8_pc(vm) == 0x206);
+      assert(c8_frames(vm) == 1000004 / 10 + 1);
+
+      Chip8Stats stats;
+      if(c8_stats(vm, &stats)) {
+        assert(stats.opcodes[0x6] == 2);
+        assert(stats.opcodes[0xf] == stats.instructions - 2);
+      }
+    }
+  }
+
+  {
+    // idle loop 一次推進到下一個 tick，結果與逐一 c8_step() 相同
+    Chip8Engine engines[] = { C8_ENGINE_SWITCH, C8_ENGINE_THREADED, C8_ENGINE_JIT };
+    uint8_t ops[] = {
+      OP_6xkk(0, 30),
+      OP_fx15(0),
+      OP_fx07(1),             // 0x204
+      OP_3xkk(1, 0),
+      OP_1nnn(0x204),
+      OP_7xkk(2, 1),          // 0x20a
+      OP_7xkk(3, 1),          // 0x20c
+      OP_3xkk(3, 0),
+      OP_1nnn(0x20c),
+      OP_fx15(0),
+      OP_annn(0x300),         // 0x214
+      OP_fx07(4),
+      OP_4xkk(4, 0),
+      OP_1nnn(0x21e),
+      OP_1nnn(0x214),
+      OP_1nnn(0x21e),         // 0x21e
+    };
+    uint32_t clocks[] = { C8_CLOCK_DEFAULT, 60000 };
+    int c, e, i, n;
+    for(c = 0; c < 2; ++ c)
+    for(e = 0; e < 3; ++ e) {
+      Chip8Options o = { .ui = UI_NULL, .clock = clocks[c], .engine = engines[e] };
+      AutoChip8 *vm = c8_new_with_options(&o);
+      o.engine = C8_ENGINE_SWITCH;
+      AutoChip8 *ref = c8_new_with_options(&o);
+      c8_load(vm, ops, sizeof(ops));
+      c8_load(ref, ops, sizeof(ops));
+      Snap expected;
+      for(i = 1, n = 0; n < 200000; n += i, i = i * 13 % 4099 + 1) {
+        c8_steps(vm, i);
+        int k;
+        for(k = 0; k < i; ++ k) {
+          c8_step(ref);
+        }
+        snap(ref, &expected);
+        assert_snap(vm, &expected);
+      }
+      assert(c8_pc(vm) == 0x21e);
+      assert(c8_v(vm, 2) == 1);
+
+      Chip8Stats a, b;
+      if(c8_stats(vm, &a) && c8_stats(ref, &b)) {
+        assert(!memcmp(a.opcodes, b.opcodes, sizeof(a.opcodes)));
+      }
+      // 大部分時間停在最後的 1nnn
+      c8_stats(vm, &a);
+      assert(a.idle_skipped > (uint64_t) n / 2);
+      c8_stats(ref, &b);
+      assert(!b.idle_skipped);
+    }
+  }
+
+  {
+    // 預設 clock 一個 frame 只有 10 cycles，idle loop 一樣直接推進
+    uint8_t jmp[] = {
+      OP_1nnn(0x200),
+    };
+    AutoChip8 *vm = c8_new_headless();
+    Chip8Stats stats;
+    c8_load(vm, jmp, sizeof(jmp));
+    c8_steps(vm, 1000);
+    c8_stats(vm, &stats);
+    assert(c8_cycles(vm) == 1000 && c8_frames(vm) == 1000 / (C8_CLOCK_DEFAULT / 60));
+    assert(stats.idle_skipped == 1000);
+
+    // 讀 DT 的 loop 每個 frame 推進到 tick 前。tick 後讀到新 DT 的
+    // 一圈及 tick 前放不下的不到一圈逐一執行
+    uint8_t wait[] = {
+      OP_6xkk(0, 30),
+      OP_fx15(0),
+      OP_fx07(1),             // 0x204
+      OP_3xkk(1, 0),
+      OP_1nnn(0x204),
+      OP_1nnn(0x20a),         // 0x20a
+    };
+    AutoChip8 *dt = c8_new_headless();
+    AutoChip8 *ref = c8_new_headless();
+    c8_load(dt, wait, sizeof(wait));
+    c8_load(ref, wait, sizeof(wait));
+    int k;
+    for(k = 0; k < 200; k += C8_CLOCK_DEFAULT / 60) {
+      Snap expected;
+      int i;
+      c8_steps(dt, C8_CLOCK_DEFAULT / 60);
+      for(i = 0; i < C8_CLOCK_DEFAULT / 60; ++ i) {
+        c8_step(ref);
+      }
+      snap(ref, &expected);
+      assert_snap(dt, &expected);
+    }
+    c8_stats(dt, &stats);
+    assert(c8_dt(dt) && c8_frames(dt) == 200 / (C8_CLOCK_DEFAULT / 60));
+    assert(stats.idle_skipped >= (c8_frames(dt) - 2) * (C8_CLOCK_DEFAULT / 60 - 2 * 3));
+  }
+
+  {
+    // c8_load_file()/c8_load_fd()/c8_rom_map() 的內容相同，錯誤時 mem 不變
+    uint8_t rom[USER_SIZE + 1];
+    int i;
+    for(i = 0; i < (int) sizeof(rom); ++ i) {
+      rom[i] = i * 7 + 3;
+    }
+    AutoChip8 *a = c8_new_headless();
+    AutoChip8 *b = c8_new_headless();
+    AutoChip8 *c = c8_new_headless();
+
+    char *path = temp_rom(rom, USER_SIZE);
+    assert(!c8_load_file(a, path));
+
+    Chip8Rom image;
+    assert(!c8_rom_map(&image, path));
+    assert(image.mapped && image.size == USER_SIZE);
+    c8_load_rom(b, &image);
+    c8_rom_unmap(&image);
+    assert(!image.data);
+    unlink(path);
+
+    int fds[2];
+    assert(!pipe(fds));
+    write_all(fds[1], rom, USER_SIZE);
+    close(fds[1]);
+    assert(!c8_load_fd(c, fds[0]));
+    close(fds[0]);
+
+    for(i = 0; i < USER_SIZE; ++ i) {
+      assert(c8_mem8(a, APP_ENTRY + i) == rom[i]);
+    }
+    assert_same_state(a, b);
+    assert_same_state(a, c);
+
+    path = temp_rom(rom, USER_SIZE + 1);
+    assert(c8_load_file(a, path) == -EFBIG);
+    unlink(path);
+    path = temp_rom(rom, 0);
+    assert(c8_load_file(a, path) == -ENODATA);
+    assert(c8_rom_map(&image, path) == -ENODATA);
+    unlink(path);
+    assert(c8_load_file(a, path) == -ENOENT);
+
+    assert(!pipe(fds));
+    write_all(fds[1], rom, USER_SIZE + 1);
+    close(fds[1]);
+    assert(c8_load_fd(a, fds[0]) == -EFBIG);
+    close(fds[0]);
+    assert_same_state(a, b);
+  }
+
+  {
+    // SCHIP: 128x64、16x16 sprite、捲動及 RPL flags
+    uint8_t ops[] = {
+      OP_00ff,                // 0x200
+      OP_annn(0x300),
+      OP_6xkk(0, 56),
+      OP_6xkk(1, 0),
+      OP_dxyn(0, 1, 0),       // 0x208
+      OP_00fb,
+      OP_00fb,
+      OP_00fc,
+      OP_00cn(1),             // 0x210
+      OP_6xkk(0, 1),
+      OP_6xkk(1, 2),
+      OP_6xkk(2, 3),
+      OP_fx75(2),             // 0x218
+      OP_6xkk(0, 0),
+      OP_6xkk(1, 0),
+      OP_6xkk(2, 0),
+      OP_fx85(2),             // 0x220
+      OP_00fe,
+      OP_1nnn(0x224),
+    };
+    uint8_t rom[0x120] = { 0 };
+    int i;
+    memcpy(rom, ops, sizeof(ops));
+    for(i = 0; i < 16; ++ i) {
+      rom[0x100 + i * 2] = 0x80;
+      rom[0x101 + i * 2] = 0x01;
+    }
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .variant = C8_VARIANT_SCHIP,
+    });
+    const uint8_t *fb = c8_fb(vm);
+    c8_load(vm, rom, sizeof(rom));
+
+    c8_steps(vm, 1);
+    assert(c8_fb_width(vm) == 128 && c8_fb_height(vm) == 64);
+    // 每列 16 bytes，pixels 56 及 71
+    c8_steps(vm, 4);
+    assert(c8_flag(vm) == 0);
+    assert(fb[7] == 0x80 && fb[8] == 0x01);
+    assert(fb[15 * 16 + 7] == 0x80 && !fb[16 * 16 + 7]);
+    c8_steps(vm, 1);
+    assert(fb[7] == 0x08 && fb[8] == 0 && fb[9] == 0x10);
+    // 跨過 64-bit word 的邊界
+    c8_steps(vm, 1);
+    assert(fb[7] == 0 && fb[8] == 0x80 && fb[9] == 0x01);
+    c8_steps(vm, 1);
+    assert(fb[7] == 0x08 && fb[8] == 0 && fb[9] == 0x10);
+    c8_steps(vm, 1);
+    assert(!fb[7] && fb[16 + 7] == 0x08);
+    assert(fb[16 * 16 + 7] == 0x08 && !fb[17 * 16 + 7]);
+
+    c8_steps(vm, 9);
+    assert(c8_v(vm, 0) == 1 && c8_v(vm, 1) == 2 && c8_v(vm, 2) == 3);
+    c8_steps(vm, 1);
+    assert(c8_fb_width(vm) == 64 && c8_fb_height(vm) == 32);
+    for(i = 0; i < FB_PLANE_SIZE; ++ i) {
+      assert(!fb[i]);
+    }
+
+    // 原本的 CHIP-8 不認得 SCHIP opcodes
+    AutoChip8 *chip8 = c8_new_headless();
+    c8_load(chip8, (uint8_t[]){ OP_00ff, OP_1nnn(0x202) }, 4);
+    c8_steps(chip8, 1);
+    Chip8Stats stats;
+    c8_stats(chip8, &stats);
+    assert(stats.illegals == 1);
+    assert(c8_fb_width(chip8) == 64);
+  }
+
+  {
+    // XO-CHIP: F000 NNNN、bitplanes、5XY2/5XY3 及往上捲動
+    uint8_t ops[] = {
+      OP_f000(0x300),         // 0x200
+      OP_6xkk(0, 0),
+      OP_3xkk(0, 0),
+      OP_f000(0x1234),        // 0x208
+      OP_fn01(2),
+      OP_dxyn(0, 0, 1),
+      OP_fn01(3),             // 0x210
+      OP_dxyn(0, 0, 1),
+      OP_6xkk(1, 0x11),
+      OP_6xkk(2, 0x22),
+      OP_6xkk(3, 0x33),       // 0x218
+      OP_annn(0x310),
+      OP_5xy2(1, 3),
+      OP_5xy3(3, 1),
+      OP_00dn(1),             // 0x220
+      OP_1nnn(0x222),
+    };
+    uint8_t rom[0x102] = { 0 };
+    memcpy(rom, ops, sizeof(ops));
+    rom[0x100] = 0xc0;
+    rom[0x101] = 0x0f;
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .variant = C8_VARIANT_XOCHIP,
+    });
+    const uint8_t *p0 = c8_fb_plane(vm, 0);
+    const uint8_t *p1 = c8_fb_plane(vm, 1);
+    c8_load(vm, rom, sizeof(rom));
+
+    c8_steps(vm, 1);
+    assert(c8_i(vm) == 0x300 && c8_pc(vm) == 0x204);
+    // skip 整個跳過 4 bytes 的 F000 NNNN
+    c8_steps(vm, 2);
+    assert(c8_pc(vm) == 0x20c && c8_i(vm) == 0x300);
+    c8_steps(vm, 2);
+    assert(!p0[0] && p1[0] == 0xc0);
+    // 兩個 planes 依序使用 I 之後的 sprite 資料
+    c8_steps(vm, 2);
+    assert(p0[0] == 0xc0 && p1[0] == 0xcf);
+    assert(c8_flag(vm) == 0);
+
+    c8_steps(vm, 5);
+    assert(c8_i(vm) == 0x310);
+    assert(c8_mem8(vm, 0x310) == 0x11 && c8_mem8(vm, 0x312) == 0x33);
+    c8_steps(vm, 1);
+    assert(c8_v(vm, 1) == 0x33 && c8_v(vm, 2) == 0x22 && c8_v(vm, 3) == 0x11);
+    c8_steps(vm, 1);
+    assert(!p0[0] && !p1[0]);
+  }
+
+  {
+    // XO-CHIP 有 64 KiB，I 超過 4 KiB 的存取不會 wrap，ROM 可以超過 USER_SIZE
+    uint8_t ops[] = {
+      OP_f000(0xf000),        // 0x200
+      OP_6xkk(0, 0x12),
+      OP_6xkk(1, 0x34),       // 0x206
+      OP_fx55(1),
+      OP_6xkk(0, 0),          // 0x20a
+      OP_6xkk(1, 0),
+      OP_f000(0xf000),        // 0x20e
+      OP_fx65(1),             // 0x212
+      OP_6xkk(2, 0xfe),
+      OP_fx33(2),             // 0x216
+      OP_6xkk(2, 0xa),
+      OP_fx29(2),             // 0x21a
+      OP_fx30(2),
+      OP_2nnn(0x222),         // 0x21e
+      OP_NOP,
+      OP_1nnn(0x222),         // 0x222
+    };
+    uint8_t *rom = calloc(1, XO_USER_SIZE);
+    memcpy(rom, ops, sizeof(ops));
+    rom[XO_USER_SIZE - 1] = 0x5a;
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .variant = C8_VARIANT_XOCHIP,
+      .rewind_frames = 4,
+    });
+    assert(c8_mem_size(vm) == XO_MEM_SIZE && c8_user_size(vm) == XO_USER_SIZE);
+    c8_load(vm, rom, XO_USER_SIZE);
+    assert(c8_mem8(vm, XO_MEM_SIZE - 1) == 0x5a);
+    free(rom);
+
+    c8_steps(vm, 4);
+    assert(c8_i(vm) == (int16_t) 0xf002);
+    assert(c8_mem8(vm, 0xf000) == 0x12 && c8_mem8(vm, 0xf001) == 0x34);
+    assert(c8_mem8(vm, 0x000) != 0x12);
+    c8_steps(vm, 4);
+    assert(c8_v(vm, 0) == 0x12 && c8_v(vm, 1) == 0x34);
+    c8_steps(vm, 2);
+    assert(c8_mem8(vm, 0xf002) == 2 && c8_mem8(vm, 0xf003) == 5 && c8_mem8(vm, 0xf004) == 4);
+
+    // FX29 指到 0x000 的小字型，FX30 指到 0x050 的大字型
+    c8_steps(vm, 2);
+    assert(c8_i(vm) == 0xa * 5 && c8_mem8(vm, c8_i(vm)) == 0xf0);
+    c8_steps(vm, 1);
+    assert(c8_i(vm) == 0x50 + 0xa * 10 && c8_mem8(vm, c8_i(vm)) == 0x7e);
+
+    // stack 在 64 KiB 之後，rewind 的 snapshot 涵蓋到 stack 結尾
+    c8_steps(vm, 1);
+    assert(c8_pc(vm) == 0x222 && c8_stack_peek(vm) == 0x220);
+    c8_steps(vm, C8_CLOCK_DEFAULT / 20);
+    assert(c8_rewind_available(vm) > 0);
+    c8_rewind(vm, 1);
+    assert(c8_pc(vm) == 0x222 && c8_stack_peek(vm) == 0x220);
+    assert(c8_mem8(vm, 0xf002) == 2 && c8_mem8(vm, XO_MEM_SIZE - 1) == 0x5a);
+    assert(c8_illegals(vm) == 0);
+  }
+
+  {
+    // CHIP-8 沒有大字型
+    uint8_t ops[] = {
+      OP_fx30(0),
+    };
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .variant = C8_VARIANT_CHIP8,
+    });
+    assert(c8_mem_size(vm) == MEM_SIZE && c8_user_size(vm) == USER_SIZE);
+    c8_load(vm, ops, sizeof(ops));
+    c8_steps(vm, 1);
+    assert(c8_illegals(vm) == 1 && c8_i(vm) == 0);
+  }
+
+  {
+    // heap 上的每個 VM 的 framebuffer 都對齊 cache line
+    Chip8 *vms[64];
+    int k;
+    for(k = 0; k < 64; ++ k) {
+      vms[k] = c8_new_headless();
+      assert(!((uintptr_t) c8_fb_plane(vms[k], 0) & 63));
+      assert(!((uintptr_t) c8_fb_plane(vms[k], 1) & 63));
+    }
+    for(k = 0; k < 64; ++ k) {
+      c8_free(vms[k]);
+    }
+  }
 }
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <string.h>
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-ops.h"
+#include "chip8-diff.h"
+
+// CXKK/DRW/BCD/FX55 的迴圈，每一輪 I 都從程式之後開始
+static uint8_t busy[] = {
+  OP_annn(0x300),         // 0x200
+  OP_cxkk(0, 0xff),       // 0x202
+  OP_cxkk(1, 0x3f),
+  OP_dxyn(0, 1, 5),
+  OP_fx33(0),
+  OP_7xkk(2, 1),
+  OP_fx55(2),
+  OP_1nnn(0x200),
+};
+
+/**
+ * 第 122 個 instruction 在 0x20c 把 8 列的 sprite 畫在 y = 30，只有
+ * sprite_wrap 的一邊會畫到最上面兩列以外的列
+ */
+static uint8_t wrap[] = {
+  OP_6xkk(0, 0),          // 0x200
+  OP_6xkk(1, 30),
+  OP_annn(0x210),
+  OP_7xkk(2, 1),          // 0x206
+  OP_3xkk(2, 40),
+  OP_1nnn(0x206),
+  OP_dxyn(0, 1, 8),       // 0x20c
+  OP_1nnn(0x20e),
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static uint64_t run_busy(Chip8Engine engine, uint64_t seed) {
+  AutoChip8Diff *d = c8diff_new(&(Chip8Options){
+    .ui = UI_NULL,
+    .engine = C8_ENGINE_SWITCH,
+    .seed = seed,
+  }, &(Chip8Options){
+    .ui = UI_NULL,
+    .engine = engine,
+    .seed = seed,
+  }, 1000);
+  c8diff_load(d, busy, sizeof(busy));
+  assert(c8diff_steps(d, 50000));
+  assert(c8diff_steps(d, 50000));
+  assert(!c8diff_divergence(d));
+  // 執行前一次加上每 1000 個一次
+  assert(c8diff_checks(d) == 101);
+  assert(c8_cycles(c8diff_vm(d, 0)) == 100000);
+  assert(c8_cycles(c8diff_vm(d, 1)) == 100000);
+  return c8diff_hash(d);
+}
+
+int main() {
+  {
+    uint64_t hash = run_busy(C8_ENGINE_THREADED, 0x5eed);
+    assert(run_busy(C8_ENGINE_JIT, 0x5eed) == hash);
+    assert(run_busy(C8_ENGINE_SWITCH, 0x5eed) == hash);
+    assert(run_busy(C8_ENGINE_THREADED, 0x5eee) != hash);
+    // 兩邊都沒給 seed，test 用 ref 拿到的
+    run_busy(C8_ENGINE_THREADED, 0);
+  }
+
+  {
+    AutoChip8Diff *d = c8diff_new(&(Chip8Options){
+      .ui = UI_NULL,
+      .engine = C8_ENGINE_SWITCH,
+      .seed = 1,
+    }, &(Chip8Options){
+      .ui = UI_NULL,
+      .engine = C8_ENGINE_THREADED,
+      .seed = 1,
+      .sprite_wrap = true,
+    }, 50);
+    c8diff_load(d, wrap, sizeof(wrap));
+    assert(!c8diff_steps(d, 1000));
+    const Chip8Divergence *div = c8diff_divergence(d);
+    assert(div);
+    assert(div->cycles == 122);
+    assert(div->pc == 0x20c);
+    assert(div->opcode == 0xd018);
+    assert(!strcmp(div->field, "fb"));
+    assert(div->index == 0);
+    // 停在剛分歧之後，不再往前
+    assert(c8_cycles(c8diff_vm(d, 0)) == 123);
+    assert(c8_cycles(c8diff_vm(d, 1)) == 123);
+    assert(!c8diff_steps(d, 1000));
+    assert(!c8diff_check(d));
+    assert(c8_cycles(c8diff_vm(d, 1)) == 123);
+  }
+
+  {
+    // 一開始就不同時怪不到任何 instruction
+    AutoChip8Diff *d = c8diff_new(&(Chip8Options){
+      .ui = UI_NULL,
+      .seed = 1,
+    }, &(Chip8Options){
+      .ui = UI_NULL,
+      .seed = 2,
+    }, 0);
+    c8diff_load(d, busy, sizeof(busy));
+    assert(!c8diff_steps(d, 10));
+    const Chip8Divergence *div = c8diff_divergence(d);
+    assert(div->cycles == 0);
+    assert(div->pc == 0x200);
+    assert(!strcmp(div->field, "rnd"));
+  }
+
+  return 0;
+}
@@ -0,0 +1,392 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-ops.h"
+
+#define PROG_OPS (96)
+#define DATA_ADDR (APP_ENTRY + 0x100)
+
+static uint32_t seed = 1;
+
+static uint32_t rnd() {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static uint16_t rnd_addr() {
+  return APP_ENTRY + (rnd() % PROG_OPS) * 2;
+}
+
+static uint16_t rnd_data() {
+  return DATA_ADDR + (rnd() & 0xff);
+}
+
+static uint16_t rnd_slot() {
+  return APP_ENTRY + (rnd() % (PROG_OPS / 2)) * 4;
+}
+
+static void gen_op(uint8_t *op, bool first) {
+  uint8_t x = rnd() & 0xf, y = rnd() & 0xf, kk = rnd();
+  switch(rnd() % (first ? 20 : 15)) {
+    case 0: memcpy(op, (uint8_t[]){OP_6xkk(x, kk)}, 2); break;
+    case 1: memcpy(op, (uint8_t[]){OP_7xkk(x, kk)}, 2); break;
+    case 2: memcpy(op, (uint8_t[]){OP_8xy0(x, y)}, 2); break;
+    case 3: memcpy(op, (uint8_t[]){OP_8xy1(x, y)}, 2); break;
+    case 4: memcpy(op, (uint8_t[]){OP_8xy2(x, y)}, 2); break;
+    case 5: memcpy(op, (uint8_t[]){OP_8xy3(x, y)}, 2); break;
+    case 6: memcpy(op, (uint8_t[]){OP_8xy4(x, y)}, 2); break;
+    case 7: memcpy(op, (uint8_t[]){OP_8xy5(x, y)}, 2); break;
+    case 8: memcpy(op, (uint8_t[]){OP_8xy6(x)}, 2); break;
+    case 9: memcpy(op, (uint8_t[]){OP_8xy7(x, y)}, 2); break;
+    case 10: memcpy(op, (uint8_t[]){OP_8xye(x)}, 2); break;
+    case 11: memcpy(op, (uint8_t[]){OP_cxkk(x, kk)}, 2); break;
+    case 12: memcpy(op, (uint8_t[]){OP_fx07(x)}, 2); break;
+    case 13: memcpy(op, (uint8_t[]){OP_fx15(x)}, 2); break;
+    case 14: memcpy(op, (uint8_t[]){OP_1nnn(rnd_slot())}, 2); break;
+    case 15: memcpy(op, (uint8_t[]){OP_3xkk(x, kk & 3)}, 2); break;
+    case 16: memcpy(op, (uint8_t[]){OP_4xkk(x, kk & 3)}, 2); break;
+    case 17: memcpy(op, (uint8_t[]){OP_5xy0(x, y)}, 2); break;
+    case 18: memcpy(op, (uint8_t[]){OP_9xy0(x, y)}, 2); break;
+    default: memcpy(op, (uint8_t[]){OP_annn(rnd_addr())}, 2); break;
+  }
+}
+
+/**
+ * 每兩個 opcode 一組，跳躍只會落在組的開頭。存取 mem 的 opcode 只放在
+ * 組的第二個並緊接在 Annn 之後，I 永遠指向程式後的資料區
+ */
+static void gen(uint8_t *buf) {
+  int i;
+  for(i = 0; i < PROG_OPS; i += 2) {
+    uint8_t *op = buf + i * 2;
+    if(rnd() % 3) {
+      gen_op(op, true);
+      gen_op(op + 2, false);
+      continue;
+    }
+    uint8_t x = rnd() & 0xf;
+    memcpy(op, (uint8_t[]){OP_annn(rnd_data())}, 2);
+    switch(rnd() % 4) {
+      case 0: memcpy(op + 2, (uint8_t[]){OP_fx33(x)}, 2); break;
+      case 1: memcpy(op + 2, (uint8_t[]){OP_fx55(x & 3)}, 2); break;
+      case 2: memcpy(op + 2, (uint8_t[]){OP_dxyn(x, rnd() & 0xf, rnd() & 0xf)}, 2); break;
+      default: memcpy(op + 2, (uint8_t[]){OP_fx65(x)}, 2); break;
+    }
+  }
+  memcpy(buf + PROG_OPS * 2, (uint8_t[]){OP_1nnn(APP_ENTRY)}, 2);
+}
+
+static bool same_state(Chip8 *a, Chip8 *b) {
+  int i;
+  if(c8_pc(a) != c8_pc(b) ||
+     c8_sp(a) != c8_sp(b) ||
+     c8_i(a) != c8_i(b) ||
+     c8_dt(a) != c8_dt(b) ||
+     c8_st(a) != c8_st(b)) {
+    return false;
+  }
+  for(i = 0; i < 16; ++ i) {
+    if(c8_v(a, i) != c8_v(b, i)) {
+      return false;
+    }
+  }
+  for(i = 0; i < MEM_SIZE; ++ i) {
+    if(c8_mem8(a, i) != c8_mem8(b, i)) {
+      return false;
+    }
+  }
+  if(c8_fb_width(a) != c8_fb_width(b) ||
+     memcmp(c8_fb_plane(a, 0), c8_fb_plane(b, 0), FB_PLANE_SIZE) ||
+     memcmp(c8_fb_plane(a, 1), c8_fb_plane(b, 1), FB_PLANE_SIZE)) {
+    return false;
+  }
+  return true;
+}
+
+static Chip8 *new_vm(Chip8Engine engine, Chip8Variant variant) {
+  return c8_new_with_options(&(Chip8Options){
+    .ui = UI_NULL,
+    .seed = 0x1234,
+    .engine = engine,
+    .variant = variant,
+  });
+}
+
+static void check_variant(Chip8Engine engine, Chip8Variant variant, const uint8_t *prog, int size, int steps) {
+  AutoChip8 *ref = new_vm(C8_ENGINE_SWITCH, variant);
+  AutoChip8 *vm = new_vm(engine, variant);
+  int i;
+  c8_load(ref, (uint8_t *) prog, size);
+  c8_load(vm, (uint8_t *) prog, size);
+  // 不同的 step 切法都要一致
+  for(i = 1; steps > 0; i = i * 3 % 97 + 1) {
+    c8_steps(ref, i);
+    c8_steps(vm, i);
+    assert(same_state(ref, vm));
+    steps -= i;
+  }
+
+  Chip8Stats rs, vs;
+  if(c8_stats(ref, &rs) && c8_stats(vm, &vs)) {
+    uint64_t sum = 0;
+    for(i = 0; i < 16; ++ i) {
+      assert(rs.opcodes[i] == vs.opcodes[i]);
+      sum += rs.opcodes[i];
+    }
+    assert(sum == rs.instructions);
+    assert(rs.instructions == vs.instructions);
+    assert(rs.draws == vs.draws);
+    assert(rs.ticks == vs.ticks);
+  }
+}
+
+static void check_engine(Chip8Engine engine, const uint8_t *prog, int size, int steps) {
+  check_variant(engine, C8_VARIANT_CHIP8, prog, size, steps);
+}
+
+// dir 中第一個 code cache entry，沒有時回傳 false
+static bool cache_entry(const char *dir, char *path, size_t size) {
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  bool found = false;
+  assert(d);
+  while(!found && (e = readdir(d))) {
+    const char *ext = strrchr(e->d_name, '.');
+    if(ext && !strcmp(ext, ".c8code")) {
+      snprintf(path, size, "%s/%s", dir, e->d_name);
+      found = true;
+    }
+  }
+  closedir(d);
+  return found;
+}
+
+static int cache_count(const char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  int n = 0;
+  assert(d);
+  while((e = readdir(d))) {
+    n += e->d_name[0] != '.';
+  }
+  closedir(d);
+  return n;
+}
+
+// 把 path 從 whence 起 offset 的 byte 反相
+static void cache_poke(const char *path, long offset, int whence) {
+  FILE *f = fopen(path, "r+b");
+  assert(f);
+  assert(!fseek(f, offset, whence));
+  long at = ftell(f);
+  int c = fgetc(f);
+  assert(c != EOF);
+  assert(!fseek(f, at, SEEK_SET));
+  fputc(c ^ 0xff, f);
+  fclose(f);
+}
+
+static Chip8 *cache_vm(Chip8Engine engine, const char *dir, const uint8_t *prog, int size) {
+  Chip8 *vm = c8_new_with_options(&(Chip8Options){
+    .ui = UI_NULL,
+    .seed = 0x1234,
+    .engine = engine,
+    .code_cache = dir,
+  });
+  c8_load(vm, prog, size);
+  return vm;
+}
+
+static void check_cached(Chip8Engine engine, const char *dir, const uint8_t *prog, int size, bool cached) {
+  AutoChip8 *ref = new_vm(C8_ENGINE_SWITCH, C8_VARIANT_CHIP8);
+  AutoChip8 *vm = cache_vm(engine, dir, prog, size);
+  assert(c8_code_cached(vm) == cached);
+  c8_load(ref, prog, size);
+  c8_steps(ref, 3000);
+  c8_steps(vm, 3000);
+  assert(same_state(ref, vm));
+}
+
+int main() {
+  Chip8Engine engines[] = { C8_ENGINE_THREADED, C8_ENGINE_JIT };
+  int e, i;
+
+  for(e = 0; e < sizeof(engines) / sizeof(engines[0]); ++ e) {
+    for(i = 0; i < 200; ++ i) {
+      uint8_t prog[PROG_OPS * 2 + 2];
+      gen(prog);
+      check_engine(engines[e], prog, sizeof(prog), 20000);
+    }
+  }
+
+  {
+    // 兩個 blocks 經由 skip 及 1nnn 互相接在一起，budget 在中途用完
+    uint8_t prog[] = {
+      OP_7xkk(0, 1),          // 0x200
+      OP_1nnn(0x206),
+      OP_7xkk(2, 3),          // 0x204
+      OP_7xkk(1, 1),
+      OP_3xkk(1, 0x40),
+      OP_1nnn(0x200),
+      OP_6xkk(1, 0),          // 0x20c
+      OP_1nnn(0x204),
+    };
+    for(e = 0; e < sizeof(engines) / sizeof(engines[0]); ++ e) {
+      check_engine(engines[e], prog, sizeof(prog), 5000);
+    }
+  }
+
+  {
+    // 改寫已轉譯的 6xkk
+    uint8_t prog[] = {
+      OP_6xkk(0, 1),          // 0x200
+      OP_7xkk(1, 1),
+      OP_6xkk(2, 0x7f),
+      OP_annn(0x200),
+      OP_3xkk(1, 2),
+      OP_1nnn(0x200),
+      OP_6xkk(0, 0x60),       // 0x20c
+      OP_6xkk(1, 0x05),
+      OP_fx55(1),
+      OP_1nnn(0x200),
+    };
+    for(e = 0; e < sizeof(engines) / sizeof(engines[0]); ++ e) {
+      AutoChip8 *vm = new_vm(engines[e], C8_VARIANT_CHIP8);
+      c8_load(vm, prog, sizeof(prog));
+      c8_steps(vm, 14);
+      assert(c8_mem16(vm, 0x200) == 0x6005);
+      c8_steps(vm, 3);
+      assert(c8_v(vm, 0) == 5);
+      check_engine(engines[e], prog, sizeof(prog), 1000);
+    }
+  }
+
+  {
+    // 程式寫到 stack 之前的最後面再跳過去執行
+    uint8_t prog[] = {
+      OP_6xkk(0, 0x60),
+      OP_6xkk(1, 0x05),
+      OP_6xkk(2, 0x1e),
+      OP_6xkk(3, 0xa2),
+      OP_annn(0xea0),
+      OP_fx55(3),
+      OP_1nnn(0xea0),
+    };
+    for(e = 0; e < sizeof(engines) / sizeof(engines[0]); ++ e) {
+      AutoChip8 *vm = new_vm(engines[e], C8_VARIANT_CHIP8);
+      c8_load(vm, prog, sizeof(prog));
+      c8_steps(vm, 100);
+      assert(c8_pc(vm) == 0xea2);
+      assert(c8_v(vm, 0) == 5);
+      check_engine(engines[e], prog, sizeof(prog), 1000);
+    }
+  }
+
+  {
+    // SCHIP/XO-CHIP 的擴充 opcodes 交給 c8_ext()，XO-CHIP 的 skip 跳過 F000 NNNN
+    uint8_t schip[] = {
+      OP_00ff,                // 0x200
+      OP_annn(0x240),
+      OP_6xkk(0, 0x7c),
+      OP_6xkk(1, 0x3a),
+      OP_dxyn(0, 1, 0),
+      OP_00cn(3),
+      OP_00fb,
+      OP_fx75(1),
+      OP_8xy4(0, 1),
+      OP_dxyn(1, 0, 4),
+      OP_00fc,
+      OP_fx85(0),
+      OP_00fe,
+      OP_dxyn(0, 1, 0),
+      OP_1nnn(0x200),
+    };
+    uint8_t xo[] = {
+      OP_00ff,                // 0x200
+      OP_annn(0x240),
+      OP_6xkk(0, 0x7c),
+      OP_7xkk(1, 0x3a),
+      OP_4xkk(1, 0x3a),
+      OP_f000(0x0245),
+      OP_fn01(3),
+      OP_dxyn(0, 1, 5),
+      OP_00dn(2),
+      OP_00fb,
+      OP_5xy2(0, 1),
+      OP_5xy3(1, 0),
+      OP_fn01(2),
+      OP_dxyn(1, 0, 0),
+      OP_00fe,
+      OP_1nnn(0x200),
+    };
+    uint8_t buf[0x60] = { 0 };
+    for(i = 0; i < 0x20; ++ i) {
+      buf[0x40 + i] = 0x5a ^ i * 7;
+    }
+    for(e = 0; e < sizeof(engines) / sizeof(engines[0]); ++ e) {
+      memcpy(buf, schip, sizeof(schip));
+      check_variant(engines[e], C8_VARIANT_SCHIP, buf, sizeof(buf), 5000);
+      memset(buf, 0, 0x40);
+      memcpy(buf, xo, sizeof(xo));
+      check_variant(engines[e], C8_VARIANT_XOCHIP, buf, sizeof(buf), 5000);
+    }
+  }
+
+  {
+    // 奇數長度，最後的 0x12 與其後的 0x00 組成 1200
+    uint8_t prog[C8_CODE_CACHE_MIN + 1] = {
+      OP_7xkk(0, 1),          // 0x200
+      OP_2nnn(0x20a),
+      OP_3xkk(0, 0x10),       // 0x204
+      OP_1nnn(0x200),
+      OP_1nnn(APP_ENTRY + C8_CODE_CACHE_MIN), // 0x208
+      OP_8xy4(1, 0),          // 0x20a
+      OP_00EE,
+    };
+    prog[C8_CODE_CACHE_MIN] = 0x12;
+    char dir[] = "/tmp/test-engines-XXXXXX";
+    char path[PATH_MAX];
+    assert(mkdtemp(dir));
+    AutoChip8 *probe = cache_vm(C8_ENGINE_THREADED, dir, prog, sizeof(prog));
+    if(c8_engine(probe) == C8_ENGINE_THREADED) {
+      // 小 ROM 不查也不寫
+      uint8_t small[] = { OP_7xkk(0, 1), OP_1nnn(0x200) };
+      check_cached(C8_ENGINE_THREADED, dir, small, sizeof(small), false);
+      check_cached(C8_ENGINE_THREADED, dir, small, sizeof(small), false);
+
+      // 第一次分析後寫入，之後直接載入
+      assert(!c8_code_cached(probe));
+      assert(cache_entry(dir, path, sizeof(path)) && cache_count(dir) == 1);
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), true);
+      check_cached(C8_ENGINE_JIT, dir, prog, sizeof(prog), true);
+
+      // 損壞、截斷及舊版的 entry 都被忽略並覆寫
+      cache_poke(path, -1, SEEK_END);
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), false);
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), true);
+      assert(!truncate(path, 100));
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), false);
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), true);
+      cache_poke(path, 4, SEEK_SET);
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), false);
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), true);
+
+      // 內容不同的 ROM 有自己的 entry
+      prog[1] = 2;
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), false);
+      check_cached(C8_ENGINE_THREADED, dir, prog, sizeof(prog), true);
+      assert(cache_count(dir) == 2);
+    }
+    while(cache_entry(dir, path, sizeof(path))) {
+      unlink(path);
+    }
+    assert(!rmdir(dir));
+  }
+}
@@ -0,0 +1,144 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-ops.h"
+
+static char path[] = "/tmp/test-journal-XXXXXX";
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+  while(n --) {
+    *p ++ = v;
+    v >>= 8;
+  }
+}
+
+/**
+ * 手動寫出 clock 600 (每 10 cycles 一個 tick) 的 journal，events 是
+ * (cycles, keys) 對
+ */
+static void write_journal(const uint64_t *events, int n) {
+  uint8_t buf[24];
+  FILE *f = fopen(path, "wb");
+  assert(f);
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, "C8IJ", 4);
+  buf[4] = 1;
+  put_le(buf + 8, 600, 4);
+  put_le(buf + 16, 1, 8);
+  fwrite(buf, sizeof(buf), 1, f);
+  for(; n > 0; -- n, events += 2) {
+    memset(buf, 0, sizeof(buf));
+    put_le(buf, events[0], 8);
+    put_le(buf + 8, events[1], 8);
+    fwrite(buf, sizeof(buf), 1, f);
+  }
+  fclose(f);
+}
+
+static Chip8 *replay_vm() {
+  return c8_new_with_options(&(Chip8Options){
+    .ui = UI_REPLAY,
+    .journal = path,
+  });
+}
+
+int main() {
+  close(mkstemp(path));
+
+  {
+    // key 5 在第 2 到第 5 個 tick 之間按著，其餘時間 v1 不變
+    uint8_t prog[] = {
+      OP_6xkk(0, 5),          // 0x200
+      OP_ex9e(0),
+      OP_1nnn(0x202),
+      OP_7xkk(1, 1),
+      OP_1nnn(0x202),
+    };
+    write_journal((uint64_t[]){ 20, 1 << 5, 50, 0 }, 2);
+    AutoChip8 *vm = replay_vm();
+    c8_load(vm, prog, sizeof(prog));
+    c8_steps(vm, 20);
+    assert(c8_v(vm, 1) == 0);
+    c8_steps(vm, 30);
+    uint8_t pressed = c8_v(vm, 1);
+    assert(pressed > 0);
+    c8_steps(vm, 100);
+    assert(c8_v(vm, 1) == pressed);
+    uint64_t cycles, hash;
+    // 沒有結尾的 journal
+    assert(!c8_replay_end(vm, &cycles, &hash));
+  }
+
+  {
+    // FX0A 停著的 VM 在按鍵的 tick 繼續
+    uint8_t prog[] = {
+      OP_fx0a(1),             // 0x200
+      OP_1nnn(0x202),
+    };
+    write_journal((uint64_t[]){ 30, 1 << 7 }, 1);
+    AutoChip8 *vm = replay_vm();
+    c8_load(vm, prog, sizeof(prog));
+    c8_steps(vm, 29);
+    assert(c8_pc(vm) == 0x200);
+    c8_steps(vm, 71);
+    assert(c8_pc(vm) == 0x202);
+    assert(c8_v(vm, 1) == 7);
+  }
+
+  {
+    // 錄下 seed/clock/variant，重播到結尾的 framebuffer 相同
+    uint8_t prog[] = {
+      OP_00E0,                // 0x200
+      OP_cxkk(0, 0x7f),
+      OP_cxkk(1, 0x3f),
+      OP_fx29(0),
+      OP_dxyn(0, 1, 5),
+      OP_1nnn(0x202),
+    };
+    uint64_t hash, cycles;
+    {
+      AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+        .ui = UI_NULL,
+        .seed = 0xc8,
+        .clock = 1000,
+        .variant = C8_VARIANT_SCHIP,
+        .journal = path,
+      });
+      c8_load(vm, prog, sizeof(prog));
+      c8_steps(vm, 12345);
+      hash = c8_fb_hash(vm);
+    }
+    AutoChip8 *vm = replay_vm();
+    c8_load(vm, prog, sizeof(prog));
+    uint64_t expected;
+    assert(c8_replay_end(vm, &cycles, &expected));
+    assert(cycles == 12345);
+    assert(expected == hash);
+    c8_steps(vm, cycles);
+    assert(c8_fb_hash(vm) == hash);
+  }
+
+  {
+    // 開不了或格式不對的 journal 回傳 NULL，不結束 process
+    errno = 0;
+    assert(!c8_new_with_options(&(Chip8Options){
+      .ui = UI_NULL,
+      .journal = "/nonexistent/journal",
+    }));
+    assert(errno == ENOENT);
+
+    FILE *f = fopen(path, "wb");
+    assert(f);
+    fputs("not a journal", f);
+    fclose(f);
+    errno = 0;
+    assert(!replay_vm());
+    assert(errno == EBADMSG);
+  }
+
+  unlink(path);
+}
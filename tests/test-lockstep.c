@@ -0,0 +1,160 @@
+#include <assert.h>
+#include <stdio.h>
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-ops.h"
+#include "chip8-lockstep.h"
+
+#define PROG_OPS (64)
+#define DATA_ADDR (APP_ENTRY + 0x100)
+#define MAX_LANES (70)
+
+static uint32_t seed = 7;
+
+static uint32_t rnd() {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/**
+ * 大部份是 ALU 及 skip，讓 lanes 常常停在同一個 PC 又會分岐，
+ * 跳躍只落在偶數 slot 上。FX33 可能寫到資料區或改寫程式碼
+ */
+static void gen(uint8_t *buf) {
+  int i;
+  for(i = 0; i < PROG_OPS; ++ i) {
+    uint8_t *op = buf + i * 2;
+    if(!i) {
+      memcpy(op, (uint8_t[]){OP_annn(DATA_ADDR)}, 2);
+      continue;
+    }
+    uint8_t x = rnd() & 0xf, y = rnd() & 0xf, kk = rnd();
+    switch(rnd() % 25) {
+      case 0: memcpy(op, (uint8_t[]){OP_6xkk(x, kk)}, 2); break;
+      case 1: case 2: memcpy(op, (uint8_t[]){OP_7xkk(x, kk)}, 2); break;
+      case 3: memcpy(op, (uint8_t[]){OP_8xy0(x, y)}, 2); break;
+      case 4: memcpy(op, (uint8_t[]){OP_8xy1(x, y)}, 2); break;
+      case 5: memcpy(op, (uint8_t[]){OP_8xy2(x, y)}, 2); break;
+      case 6: memcpy(op, (uint8_t[]){OP_8xy3(x, y)}, 2); break;
+      case 7: memcpy(op, (uint8_t[]){OP_8xy4(x, y)}, 2); break;
+      case 8: memcpy(op, (uint8_t[]){OP_8xy5(x, y)}, 2); break;
+      case 9: memcpy(op, (uint8_t[]){OP_8xy6(x)}, 2); break;
+      case 10: memcpy(op, (uint8_t[]){OP_8xy7(x, y)}, 2); break;
+      case 11: memcpy(op, (uint8_t[]){OP_8xye(x)}, 2); break;
+      case 12: memcpy(op, (uint8_t[]){OP_3xkk(x, kk & 3)}, 2); break;
+      case 13: memcpy(op, (uint8_t[]){OP_4xkk(x, kk & 3)}, 2); break;
+      case 14: memcpy(op, (uint8_t[]){OP_5xy0(x, y)}, 2); break;
+      case 15: memcpy(op, (uint8_t[]){OP_9xy0(x, y)}, 2); break;
+      case 16: memcpy(op, (uint8_t[]){OP_cxkk(x, kk)}, 2); break;
+      case 17: memcpy(op, (uint8_t[]){OP_fx07(x)}, 2); break;
+      case 18: memcpy(op, (uint8_t[]){OP_fx15(x)}, 2); break;
+      case 19: memcpy(op, (uint8_t[]){OP_annn(DATA_ADDR + (kk & 0xf0))}, 2); break;
+      case 20: memcpy(op, (uint8_t[]){OP_fx33(x)}, 2); break;
+      case 21: memcpy(op, (uint8_t[]){OP_annn(APP_ENTRY + (kk & 0x7e))}, 2); break;
+      case 22: memcpy(op, (uint8_t[]){OP_dxyn(x, y, kk)}, 2); break;
+      default:
+        memcpy(op, (uint8_t[]){OP_1nnn(APP_ENTRY + (rnd() % (PROG_OPS / 2)) * 4)}, 2);
+        break;
+    }
+  }
+  // skip 可能越過第一個
+  memcpy(buf + PROG_OPS * 2, (uint8_t[]){OP_1nnn(APP_ENTRY), OP_1nnn(APP_ENTRY)}, 4);
+}
+
+static Chip8 *new_ref(int lane) {
+  return c8_new_with_options(&(Chip8Options){
+    .ui = UI_NULL,
+    .seed = 0x1234 + lane,
+    .engine = C8_ENGINE_SWITCH,
+  });
+}
+
+static void assert_same_state(Chip8 *a, Chip8 *b) {
+  int i;
+  assert(c8_pc(a) == c8_pc(b));
+  assert(c8_i(a) == c8_i(b));
+  assert(c8_dt(a) == c8_dt(b));
+  assert(c8_st(a) == c8_st(b));
+  assert(c8_cycles(a) == c8_cycles(b));
+  for(i = 0; i < 16; ++ i) {
+    assert(c8_v(a, i) == c8_v(b, i));
+  }
+  for(i = 0; i < MEM_SIZE; ++ i) {
+    assert(c8_mem8(a, i) == c8_mem8(b, i));
+  }
+}
+
+/**
+ * per_lane 時每個 lane 前面多一段設定 V0-VF 的 6xkk，走 opcode 逐一比對的路徑
+ */
+static void check(int lanes, bool per_lane, int steps) {
+  AutoChip8Lockstep *ls = c8ls_new(lanes, &(Chip8Options){ .seed = 0x1234 });
+  Chip8 *refs[MAX_LANES];
+  uint8_t body[PROG_OPS * 2 + 4];
+  uint8_t prog[32 + sizeof(body)];
+  int l, x, i;
+
+  gen(body);
+  for(l = 0; l < lanes; ++ l) {
+    int size = 0;
+    if(per_lane) {
+      for(x = 0; x < 16; ++ x) {
+        memcpy(prog + size, (uint8_t[]){OP_6xkk(x, rnd() & 3)}, 2);
+        size += 2;
+      }
+    }
+    memcpy(prog + size, body, sizeof(body));
+    size += sizeof(body);
+    // 跳躍位址以 APP_ENTRY 起算，per_lane 的設定段之後直接跑 body 沒關係
+    refs[l] = new_ref(l);
+    c8_load(refs[l], prog, size);
+    if(per_lane) {
+      c8ls_load_lane(ls, l, prog, size);
+    } else if(!l) {
+      c8ls_load(ls, prog, size);
+    }
+  }
+
+  for(i = 1; steps > 0; i = i * 7 % 53 + 1) {
+    c8ls_steps(ls, i);
+    for(l = 0; l < lanes; ++ l) {
+      c8_steps(refs[l], i);
+      assert_same_state(c8ls_lane(ls, l), refs[l]);
+    }
+    steps -= i;
+  }
+  assert(c8ls_instructions(ls) == c8_cycles(refs[0]) * lanes);
+
+  for(l = 0; l < lanes; ++ l) {
+    c8_free(refs[l]);
+  }
+}
+
+int main() {
+  int i;
+  for(i = 0; i < 30; ++ i) {
+    check(1, false, 1000);
+    check(37, false, 1000);
+    check(MAX_LANES, i & 1, 1000);
+  }
+
+  {
+    // 沒有分岐的迴圈全部以 SIMD 執行
+    AutoChip8Lockstep *ls = c8ls_new(64, &(Chip8Options){ .seed = 1 });
+    uint8_t prog[] = {
+      OP_7xkk(0, 1),
+      OP_8xy4(1, 0),
+      OP_8xy5(2, 1),
+      OP_1nnn(APP_ENTRY),
+    };
+    c8ls_load(ls, prog, sizeof(prog));
+    c8ls_steps(ls, 400);
+    assert(c8ls_instructions(ls) == 400 * 64);
+#if defined(__SSE2__)
+    assert(c8ls_simd_instructions(ls) == 400 * 64);
+#endif
+    for(i = 0; i < 64; ++ i) {
+      assert(c8_v(c8ls_lane(ls, i), 0) == 100);
+    }
+  }
+}
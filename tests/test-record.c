@@ -0,0 +1,121 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-ops.h"
+#include "chip8-record.h"
+
+static void assert_same_frame(Chip8 *vm, const Chip8Frame *frame) {
+  int size = c8_fb_width(vm) * c8_fb_height(vm) / 8;
+  assert(frame->width == c8_fb_width(vm));
+  assert(frame->height == c8_fb_height(vm));
+  assert(frame->planes == 1);
+  assert(!memcmp(frame->fb, c8_fb(vm), size));
+}
+
+// 把 path 的前 size bytes 寫到新的暫存檔，回傳開啟的 fd
+static int truncated(const char *path, int size) {
+  char tmp[] = "/tmp/test-record-XXXXXX";
+  uint8_t buf[256];
+  int in = open(path, O_RDONLY);
+  int out = mkstemp(tmp);
+  assert(in != -1 && out != -1);
+  unlink(tmp);
+  while(size > 0) {
+    int n = read(in, buf, size < sizeof(buf) ? size : sizeof(buf));
+    assert(n > 0);
+    assert(write(out, buf, n) == n);
+    size -= n;
+  }
+  close(in);
+  lseek(out, 0, SEEK_SET);
+  return out;
+}
+
+int main() {
+  uint8_t ops[] = {
+    OP_annn(0x300),         // 0x200
+    OP_6xkk(0, 0),
+    OP_6xkk(1, 0),
+    OP_dxyn(0, 1, 5),       // 0x206
+    OP_7xkk(0, 1),
+    OP_3xkk(0, 16),
+    OP_1nnn(0x206),
+    OP_00ff,                // 0x20e
+    OP_dxyn(0, 1, 5),
+    OP_1nnn(0x212),
+  };
+  uint8_t rom[0x105] = { 0 };
+  memcpy(rom, ops, sizeof(ops));
+  memcpy(rom + 0x100, (uint8_t[]){ 0xf0, 0x90, 0x90, 0x90, 0xf0 }, 5);
+
+  char path[] = "/tmp/test-record-XXXXXX";
+  close(mkstemp(path));
+
+  {
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+      .ui = UI_RECORD,
+      .record = path,
+      .variant = C8_VARIANT_SCHIP,
+    });
+    c8_load(vm, rom, sizeof(rom));
+
+    // 每次 c8_steps() 結束時 flush，讀到的最後一個 frame 就是目前的畫面
+    int fd = open(path, O_RDONLY);
+    AutoChip8Reader *reader = c8rec_new(fd);
+    Chip8Frame frame;
+    int i, frames = 0;
+    for(i = 0; i < 3 + 16 * 4 + 3; ++ i) {
+      int got = 0, r;
+      c8_steps(vm, 1);
+      while((r = c8rec_next(reader, &frame)) > 0) {
+        ++ got;
+      }
+      assert(!r);
+      if(got) {
+        assert_same_frame(vm, &frame);
+        frames += got;
+      }
+    }
+    assert(c8_fb_width(vm) == 128);
+    assert(frames == 16 + 2);
+    close(fd);
+
+    // 每個 frame 只有幾個 bytes 的 delta
+    struct stat st;
+    assert(!stat(path, &st));
+    assert(st.st_size < C8_REC_HEADER_SIZE + frames * (C8_REC_FRAME_HEADER_SIZE + 24));
+  }
+
+  {
+    struct stat st;
+    Chip8Frame frame;
+    assert(!stat(path, &st));
+
+    // 截斷在 frame 中間
+    int fd = truncated(path, st.st_size - 1);
+    AutoChip8Reader *reader = c8rec_new(fd);
+    int r;
+    while((r = c8rec_next(reader, &frame)) > 0);
+    assert(r == -EBADMSG);
+    close(fd);
+
+    // 沒有任何資料是空的 stream，header 不完整是錯誤
+    fd = truncated(path, 0);
+    AutoChip8Reader *empty = c8rec_new(fd);
+    assert(c8rec_next(empty, &frame) == 0);
+    close(fd);
+    fd = truncated(path, 3);
+    AutoChip8Reader *partial = c8rec_new(fd);
+    assert(c8rec_next(partial, &frame) == -EBADMSG);
+    close(fd);
+  }
+
+  unlink(path);
+}
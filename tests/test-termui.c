@@ -0,0 +1,53 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "chip8.h"
+#include "chip8-ops.h"
+
+static int out;
+
+static void expect(const char *s) {
+  char buf[4096];
+  ssize_t n = read(out, buf, sizeof(buf) - 1);
+  buf[n < 0 ? 0 : n] = '\0';
+  assert(!strcmp(buf, s));
+}
+
+int main() {
+  int fds[2];
+  assert(!pipe(fds));
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  out = fds[0];
+  // stdout 接到 pipe，stdin 不是 tty 時不切 raw mode
+  fflush(stdout);
+  dup2(fds[1], STDOUT_FILENO);
+  dup2(open("/dev/null", O_RDONLY), STDIN_FILENO);
+
+  uint8_t prog[0x101] = {
+    OP_annn(0x300),
+    OP_dxyn(0, 0, 1),
+    OP_6xkk(1, 1),
+    OP_dxyn(0, 1, 1),
+    OP_1nnn(0x208),
+  };
+  prog[0x100] = 0xf0;
+
+  Chip8 *vm = c8_new_with_options(&(Chip8Options){ .ui = UI_TERM, .seed = 1 });
+  expect("\e[?25l\e[2J");
+  c8_load(vm, prog, sizeof(prog));
+
+  c8_steps(vm, 2);
+  expect("\e[1;1H▀▀▀▀");
+  // 只輸出改變的 cells
+  c8_steps(vm, 2);
+  expect("\e[1;1H████");
+  c8_steps(vm, 10);
+  expect("");
+
+  c8_free(vm);
+  expect("\e[?25h\e[17;1H\n");
+}
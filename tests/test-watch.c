@@ -0,0 +1,111 @@
+#include <assert.h>
+#include <string.h>
+#include "chip8.h"
+#include "chip8-ops.h"
+
+typedef struct _Hits Hits;
+
+struct _Hits {
+  int count;
+  uint16_t addr;
+  uint16_t len;
+  uint16_t pc;
+};
+
+static void on_write(Chip8 *vm, uint16_t addr, uint16_t len, void *data) {
+  Hits *hits = data;
+  ++ hits->count;
+  hits->addr = addr;
+  hits->len = len;
+  hits->pc = c8_pc(vm);
+}
+
+// I 從 0x30e 開始，FX33 跨過 0x310 的 line 邊界
+static uint8_t prog[] = {
+  OP_annn(0x30e),         // 0x200
+  OP_6xkk(0, 123),
+  OP_fx33(0),             // 0x204
+  OP_annn(0x340),
+  OP_fx55(3),             // 0x208
+  OP_2nnn(0x20e),
+  OP_1nnn(0x200),         // 0x20c
+  OP_00EE,                // 0x20e
+};
+
+static void run(Chip8Engine engine) {
+  AutoChip8 *vm = c8_new_with_options(&(Chip8Options){
+    .ui = UI_NULL,
+    .seed = 1,
+    .engine = engine,
+  });
+  uint64_t lines[C8_MEM_LINES / 64];
+
+  c8_load(vm, prog, sizeof(prog));
+  c8_mem_dirty(vm, lines, true);
+  assert(lines[0] == 0x1ULL << 32 && !lines[1] && !lines[2] && !lines[3]);
+  c8_mem_dirty(vm, lines, false);
+  assert(!lines[0]);
+
+  Hits bcd = {0}, regs = {0}, stack = {0}, miss = {0};
+  int id = c8_watch_add(vm, 0x30f, 1, on_write, &bcd);
+  assert(id >= 0);
+  assert(c8_watch_add(vm, 0x342, 8, on_write, &regs) >= 0);
+  assert(c8_watch_add(vm, MEM_SIZE - STACK_SIZE, STACK_SIZE, on_write, &stack) >= 0);
+  // 同一個 line 但沒有重疊
+  assert(c8_watch_add(vm, 0x344, 4, on_write, &miss) >= 0);
+  assert(c8_watch_add(vm, 0xfff, 2, on_write, &miss) == -1);
+  assert(c8_watch_add(vm, 0x200, 0, on_write, &miss) == -1);
+
+  c8_steps(vm, 3);
+  assert(bcd.count == 1 && bcd.addr == 0x30f && bcd.len == 1);
+  assert(bcd.pc == 0x206);
+  assert(c8_mem8(vm, 0x30e) == 1 && c8_mem8(vm, 0x30f) == 2 && c8_mem8(vm, 0x310) == 3);
+
+  c8_steps(vm, 3);
+  assert(regs.count == 1 && regs.addr == 0x342 && regs.len == 2);
+  assert(stack.count == 1 && stack.len == 2);
+  assert(miss.count == 0);
+
+  c8_mem_dirty(vm, lines, true);
+  // 0x300/0x310 是 BCD，0x340 是 FX55，最後一行是 stack
+  assert(lines[0] == (0x3ULL << 48 | 0x1ULL << 52));
+  assert(!lines[1] && !lines[2]);
+  assert(lines[3] == 0x1ULL << 63);
+
+  // 00EE、1200 後再跑到 FX33
+  assert(c8_watch_remove(vm, id));
+  assert(!c8_watch_remove(vm, id));
+  c8_steps(vm, 5);
+  assert(bcd.count == 1);
+  c8_mem_dirty(vm, lines, true);
+  assert(lines[0] == 0x3ULL << 48);
+
+  // host 端的寫入也算
+  Hits load = {0};
+  assert(c8_watch_add(vm, 0x20e, 2, on_write, &load) >= 0);
+  c8_load(vm, prog, sizeof(prog));
+  assert(load.count == 1 && load.addr == 0x20e && load.len == 2);
+}
+
+int main() {
+  run(C8_ENGINE_SWITCH);
+  run(C8_ENGINE_THREADED);
+  run(C8_ENGINE_JIT);
+
+  {
+    // I 超出 mem 時 FX33 不寫，也不標記
+    uint8_t bcd[] = {
+      OP_annn(0xfff),
+      OP_fx33(0),
+    };
+    AutoChip8 *vm = c8_new_with_options(&(Chip8Options){ .ui = UI_NULL, .seed = 1 });
+    uint64_t lines[C8_MEM_LINES / 64];
+    c8_load(vm, bcd, sizeof(bcd));
+    c8_mem_dirty(vm, lines, true);
+    c8_steps(vm, 2);
+    c8_mem_dirty(vm, lines, false);
+    assert(!lines[0] && !lines[1] && !lines[2] && !lines[3]);
+  }
+
+  return 0;
+}